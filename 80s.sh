@@ -63,7 +63,7 @@ CC="${CC:-$DEFAULT_COMPILER}"
 mkdir -p bin
 
 DEFINES=""
-LIBS="-lm -ldl -lpthread -lcrypto -lssl"
+LIBS="-lm -ldl -lpthread -lcrypto -lssl -lz"
 
 if [ "$(uname -o)" = "Msys" ]; then
   SO_EXT="dll"
@@ -98,7 +98,7 @@ echo "Compiler: $CC"
 if [ "$LINK" = "dynamic" ]; then
   DEFINES="$DEFINES -DS80_DYNAMIC=1"
   DEFINES="$DEFINES -DS80_DYNAMIC_SO=\"$OUT.$SO_EXT\""
-  $CC src/80s/80s_common.c src/80s/80s_common.windows.c src/80s/dynstr.c src/80s/algo.c src/80s/crypto.c \
+  $CC src/80s/80s_common.c src/80s/80s_common.windows.c src/80s/dynstr.c src/80s/algo.c src/80s/crypto.c src/80s/zstream.c src/80s/fileio.c \
       src/80s/lua.c src/80s/lua_net.c src/80s/lua_codec.c src/80s/lua_crypto.c \
       src/80s/serve.epoll.c src/80s/serve.kqueue.c src/80s/serve.iocp.c \
       -shared -fPIC \
@@ -112,7 +112,7 @@ if [ "$LINK" = "dynamic" ]; then
     $CC src/80s/80s.c $DEFINES $FLAGS -fPIC $LUA_LIB $LIBS -o "$OUT"
   fi
 else
-  $CC src/80s/80s.c src/80s/80s_common.c src/80s/80s_common.windows.c src/80s/dynstr.c src/80s/algo.c src/80s/crypto.c \
+  $CC src/80s/80s.c src/80s/80s_common.c src/80s/80s_common.windows.c src/80s/dynstr.c src/80s/algo.c src/80s/crypto.c src/80s/zstream.c src/80s/fileio.c \
       src/80s/lua.c src/80s/lua_net.c src/80s/lua_codec.c src/80s/lua_crypto.c \
       src/80s/serve.epoll.c src/80s/serve.kqueue.c src/80s/serve.iocp.c \
       "$LUA_LIB" \
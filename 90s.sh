@@ -111,7 +111,7 @@ xmake() {
 
 echo "Compiling lib80s"
 xmake "$CC" "$FLAGS -fPIC $DEFINES" "$LIBS" "-" "bin/lib80s.a" \
-    src/80s/80s.c src/80s/80s_common.c src/80s/80s_common.windows.c src/80s/dynstr.c src/80s/algo.c src/80s/crypto.c \
+    src/80s/80s.c src/80s/80s_common.c src/80s/80s_common.windows.c src/80s/dynstr.c src/80s/algo.c src/80s/crypto.c src/80s/zstream.c src/80s/fileio.c \
     src/80s/serve.epoll.c src/80s/serve.kqueue.c src/80s/serve.iocp.c
 
 FLAGS="$FLAGS -std=c++23 -Isrc/ -fPIC -fcoroutines"
@@ -148,8 +148,9 @@ else
   echo "Compiling 90s web server"
     FLAGS="$FLAGS $DEFINES"
     xmake "$CXX" "$FLAGS" "$LIBS" "bin/lib80s.a" "$OUT" \
-      src/90s/90s.cpp src/90s/afd.cpp src/90s/context.cpp \
+      src/90s/90s.cpp src/90s/afd.cpp src/90s/context.cpp src/90s/task_pool.cpp src/90s/connection_pool.cpp src/90s/tracing.cpp \
       src/90s/httpd/environment.cpp src/90s/httpd/render_context.cpp src/90s/httpd/server.cpp \
+      src/90s/httpd/hpack.cpp src/90s/httpd/http2.cpp src/90s/httpd/router.cpp src/90s/httpd/compression.cpp src/90s/httpd/static_files.cpp src/90s/httpd/page_cache.cpp \
       src/90s/util/util.cpp \
       src/90s/sql/mysql.cpp src/90s/sql/mysql_util.cpp \
       src/90s/storage/disk_storage.cpp\
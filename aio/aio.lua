@@ -16,6 +16,8 @@
 --- @field quit fun(c_reload: lightuserdata|nil) exit the worker
 --- @field listdir fun(dir: string): string[] list files in directory
 --- @field readfile fun(path: string, mode: string): string|nil read file contents
+--- @field readfile_async fun(c_reload: lightuserdata, worker_id: integer, path: string): request: lightuserdata|nil, error: string|nil read file on a helper thread, result is mailed back as S80_MB_FILE or S80_MB_FILE_ERROR with sender_fd == request
+--- @field writefile_async fun(c_reload: lightuserdata, worker_id: integer, path: string, data: string, mode: string): request: lightuserdata|nil, error: string|nil write ("w") or append ("a") to file on a helper thread, completion is mailed back like with readfile_async
 --- @field inotify_init fun(elfd: lightuserdata): fd: lightuserdata|nil, error: string|nil initialize inotify
 --- @field inotify_add fun(elfd: lightuserdata, childfd: lightuserdata, target: string): wd: lightuserdata add file to watchlist of inotify, returns watch descriptor
 --- @field inotify_remove fun(elfd: lightuserdata, childfd: lightuserdata, wd: lightuserdata): boolean, string|nil remove watch decriptor from watchlist
@@ -53,6 +55,8 @@ net = net or {}
 --- @field ssl_read fun(bio: lightuserdata): string|nil, integer|nil read from SSL, returns decrypted data or nil on error, return true if write is requested
 --- @field ssl_write fun(bio: lightuserdata, data: string): integer write data to SSL, encrypted data can be retrieved using bio_read later
 --- @field ssl_requests_io fun(bio: lightuserdata): boolean|nil nil if error, true if IO request, false otherwise
+--- @field ssl_stats fun(): {server_handshakes: integer, server_resumptions: integer, client_handshakes: integer, client_resumptions: integer, cache_hits: integer, cache_misses: integer, ticket_rotations: integer} process-wide TLS handshake and session resumption counters
+--- @field ssl_ticket_rotation fun(seconds: integer): boolean set how often are shared session ticket keys rotated
 crypto = crypto or {}
 
 --- @class codec
@@ -64,6 +68,10 @@ crypto = crypto or {}
 --- @field url_decode fun(text: string): string URL decode text
 --- @field mysql_encode fun(text: string): string MySQL encode text
 --- @field html_encode fun(text: string): string HTML encode text
+--- @field deflate_stream fun(mode: "deflate"|"inflate", format: "gzip"|"zlib"|"raw", level: integer|nil, max_output: integer|nil): lightuserdata|nil, string|nil create (or reuse worker's idle) compression stream, max_output caps number of produced bytes, 0 or nil for no cap
+--- @field deflate_update fun(stream: lightuserdata, data: string, flush: "sync"|"finish"|nil): string|nil, boolean|string feed data to stream, returns output and true if stream ended, nil and error otherwise
+--- @field deflate_reset fun(stream: lightuserdata): boolean reset stream, so it can be used for new data
+--- @field deflate_release fun(stream: lightuserdata) return the stream back to worker's pool
 codec = codec or {}
 
 --- @alias dnsresponse {ip: string, cname: string|nil, error: string|nil}
@@ -92,6 +100,10 @@ S80_FD_OTHER = S80_FD_OTHER or nil
 S80_RELOAD = S80_RELOAD or nil
 --- @type integer
 S80_MB_MESSAGE = S80_MB_MESSAGE or nil
+--- @type integer
+S80_MB_FILE = S80_MB_FILE or nil
+--- @type integer
+S80_MB_FILE_ERROR = S80_MB_FILE_ERROR or nil
 --- @type lightuserdata
 NILFD = NILFD or nil
 --- @type integer
@@ -437,6 +449,10 @@ if not aio then
         ---@type {[string]: {size: integer, data: {[string]: {expire: integer|nil, data: any}}}}
         cache = {},
         max_cache_size = 10000,
+        -- maximum number of idle coroutines kept for reuse
+        cor_pool_limit = 256,
+        --- @type {[lightuserdata]: fun(result: any)}
+        file_requests = {},
 
         --- @type {[string]: fun(sock: aiosocket)}
         close_handlers = {}
@@ -1210,6 +1226,58 @@ function aio:read_file_sync(path, mode)
     return net.readfile(path, mode)
 end
 
+--- Read file without blocking the event loop, file is read on a helper thread as is, in binary mode
+---@param path string
+---@return aiopromise<string|{error: string}> promise resolving to file contents
+function aio:read_file(path)
+    local resolve, resolver = self:prepare_promise()
+    local request, err = net.readfile_async(S80_RELOAD, WORKERID, path)
+    if not request then
+        resolve(make_error("failed to read file: " .. tostring(err)))
+    else
+        self.file_requests[request] = resolve
+    end
+    return resolver
+end
+
+--- Write file without blocking the event loop, file is written on a helper thread
+---@param path string
+---@param data string
+---@param mode string|nil "w" to overwrite (default), "a" to append
+---@return aiopromise<boolean|{error: string}> promise resolving to true on success
+function aio:write_file(path, data, mode)
+    local resolve, resolver = self:prepare_promise()
+    local request, err = net.writefile_async(S80_RELOAD, WORKERID, path, data, mode or "w")
+    if not request then
+        resolve(make_error("failed to write file: " .. tostring(err)))
+    else
+        self.file_requests[request] = function (result)
+            if iserror(result) then
+                resolve(result)
+            else
+                resolve(true)
+            end
+        end
+    end
+    return resolver
+end
+
+--- Handle completion of asynchronous file operation
+---@param request lightuserdata request handle
+---@param type integer S80_MB_FILE or S80_MB_FILE_ERROR
+---@param message string file contents or error
+function aio:on_file(request, type, message)
+    local resolve = self.file_requests[request]
+    if resolve then
+        self.file_requests[request] = nil
+        if type == S80_MB_FILE then
+            resolve(message)
+        else
+            resolve(make_error(message))
+        end
+    end
+end
+
 --- Open a process
 ---@param elfd lightuserdata event loop
 ---@param command string command
@@ -1384,7 +1452,9 @@ function aio:start()
     ---@param type integer message type
     ---@param message string message contents
     _G.on_message = function(sender_worker_id, sender_elfd, sender_fd, elfd, fd, type, message)
-
+        if type == S80_MB_FILE or type == S80_MB_FILE_ERROR then
+            aio:on_file(sender_fd, type, message)
+        end
     end
 end
 
@@ -1507,7 +1577,11 @@ end
 --- @return aiothen
 function aio:cor2(target, event_handler, close_handler, callback)
     local data = nil
-    local cor = self:cor0(callback)
+    local finished = false
+    local cor = self:pooled_cor(function (...)
+        callback(...)
+        finished = true
+    end)
     local on_resolved, resolve_event = self:prepare_promise()
 
     --- Resolver callable within coroutine
@@ -1530,8 +1604,7 @@ function aio:cor2(target, event_handler, close_handler, callback)
         data = data_
 
         -- if coroutine finished it's job, unsubscribe the event handler
-        local status = coroutine.status(cor)
-        if status == "dead" then
+        if finished or coroutine.status(cor) == "dead" then
             dead = true
             return
         end
@@ -1546,7 +1619,7 @@ function aio:cor2(target, event_handler, close_handler, callback)
 
         -- in case close event was invoked from the coroutine, it shall be handled here
         if ended then
-            if coroutine.status(cor) ~= "dead" then
+            if not finished and coroutine.status(cor) ~= "dead" then
                 ok, result = coroutine.resume(cor, provider, resolver)
                 ended = false
 
@@ -1561,8 +1634,7 @@ function aio:cor2(target, event_handler, close_handler, callback)
     if close_handler ~= nil then
         target[close_handler] = function(self, ...)
             if dead then return end
-            local status = coroutine.status(cor)
-            if status == "dead" then
+            if finished or coroutine.status(cor) == "dead" then
                 dead = true
                 return
             end
@@ -1628,13 +1700,85 @@ function aio:cor0(callback)
     return coroutine.create(callback)
 end
 
+--- Idle coroutines of this worker waiting to be reused
+--- @type thread[]
+local cor_pool, cor_pool_n = {}, 0
+
+--- Number of times each pooled coroutine was handed out, resumers that
+--- outlive their callback compare it to tell the coroutine got reused
+--- @type table<thread, integer>
+local cor_pool_generation = setmetatable({}, {__mode = "k"})
+
+--- Key that only aio:pooled_cor resumes an idle coroutine with
+local cor_pool_take = {}
+
+--- Body of pooled coroutine, defined below
+local cor_pool_main
+
+--- Put coroutine back to pool and pass results of finished callback to
+--- whoever resumed it, as if the coroutine returned them; if the pool is
+--- already full, coroutine returns them for real and dies
+---@param cor thread
+---@param ... any callback results
+---@return any ... callback results when the pool is full
+local function cor_pool_release(cor, ...)
+    if cor_pool_n >= (aio.cor_pool_limit or 0) then
+        return ...
+    end
+    cor_pool_n = cor_pool_n + 1
+    cor_pool[cor_pool_n] = cor
+    local key, callback = coroutine.yield(...)
+    -- anyone else resuming an idle coroutine is a stale resumer of the
+    -- previous callback, its values must not reach the next one
+    while key ~= cor_pool_take do
+        key, callback = coroutine.yield()
+    end
+    return cor_pool_main(key, callback)
+end
+
+--- Body of pooled coroutine, first resume hands over the callback, second
+--- resume provides its arguments; if callback fails, coroutine dies and
+--- is never returned to the pool
+---@param key table cor_pool_take
+---@param callback function
+function cor_pool_main(key, callback)
+    -- both are tail calls, so the stack doesn't grow with every reuse
+    return cor_pool_release(coroutine.running(), callback(coroutine.yield()))
+end
+
+--- Create a new coroutine or reuse an idle one from the worker's pool.
+---
+--- Once callback finishes, the coroutine is returned to the pool without
+--- dying, so the owner must track completion itself (i.e. by a flag set
+--- at the end of callback) and never resume it afterwards; resumes that
+--- come anyway are swallowed while it's idle and aio:await drops the ones
+--- of a callback that isn't running it anymore
+---@param callback fun(...: any): any
+---@return thread coroutine
+function aio:pooled_cor(callback)
+    local cor
+    if cor_pool_n > 0 then
+        cor = cor_pool[cor_pool_n]
+        cor_pool[cor_pool_n] = nil
+        cor_pool_n = cor_pool_n - 1
+    else
+        cor = coroutine.create(cor_pool_main)
+    end
+    cor_pool_generation[cor] = (cor_pool_generation[cor] or 0) + 1
+    coroutine.resume(cor, cor_pool_take, callback)
+    return cor
+end
+
 --- Execute code in async environment so await can be used
+---
+--- Coroutine used for execution comes from the pool, so it might
+--- be reused once the callback finishes
 ---@param callback function to be ran
 ---@param on_error function|nil error handler
 ---@return thread coroutine
 ---@return boolean ok value
 function aio:async(callback, on_error)
-    local cor = aio:cor0(callback)
+    local cor = aio:pooled_cor(callback)
     local ok, result = coroutine.resume(cor)
     if not ok then
         print("aio.async failed: ", result)
@@ -1651,6 +1795,7 @@ end
 ---@return T response
 function aio:await(promise)
     local self_cor = coroutine.running()
+    local generation = cor_pool_generation[self_cor]
     local premature, yielded = nil, false
     if type(promise) == "thread" then
         local result = {coroutine.resume(promise)}
@@ -1666,6 +1811,10 @@ function aio:await(promise)
                 premature = {...}
                 return
             end
+            -- a pooled coroutine might be running another callback by now
+            if cor_pool_generation[self_cor] ~= generation then
+                return
+            end
             local ok, result = coroutine.resume(self_cor, ...)
             if not ok then
                 print("aio.await failed: ", result)
@@ -1699,7 +1848,15 @@ end
 ---@return aiothen 
 function aio:buffered_cor(target, reader)
     return self:cor(target, function (stream, resolve)
-        local reader = self:cor0(reader)
+        local reader_finished = false
+        local function finish_reader(...)
+            reader_finished = true
+            return ...
+        end
+        local reader_callback = reader
+        local reader = self:pooled_cor(function (...)
+            return finish_reader(reader_callback(...))
+        end)
         -- resume the coroutine the first time and receive initial
         -- requested number of bytes to be read
         local ok, requested, up_limit = coroutine.resume(reader, resolve)
@@ -1807,7 +1964,7 @@ function aio:buffered_cor(target, reader)
         end
 
         -- after main stream is over, signalize end by sending nil to the reader
-        if coroutine.status(reader) ~= "dead" then
+        if not reader_finished and coroutine.status(reader) ~= "dead" then
             ok, requested = coroutine.resume(reader, nil, "eof")
             if not ok then
                 print("aio.buffered_cor: finishing coroutine failed", requested)
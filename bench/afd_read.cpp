@@ -0,0 +1,91 @@
+// Throughput and peak heap of afd's receive path: HTTP-like requests (a head read with read_until,
+// then a read_n body) are fed through on_data in fixed size chunks, the way recv delivers them.
+// Every operator new is counted, so the peak shows how much the receive buffer grew.
+//
+// usage (from repository root), lib80s.a comes from ./90s.sh:
+//   c++ -std=c++23 -O2 -Isrc -Isrc/90s -o bin/bench_afd_read bench/afd_read.cpp src/90s/afd.cpp bin/lib80s.a -lssl -lcrypto -lz -lpthread && bin/bench_afd_read
+// only on_data, read_until and read_n are used, so it builds on trees before the bounded buffer too
+#include "afd.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+// callbacks lib80s expects from its host, no event loop runs here
+extern "C" {
+    void on_receive(read_params params) {}
+    void on_close(close_params params) {}
+    void on_write(write_params params) {}
+    void on_accept(accept_params params) {}
+    void on_message(message_params params) {}
+    void s80_print(const char *fmt, ...) {}
+}
+
+using namespace s90;
+
+static size_t live_bytes = 0, peak_bytes = 0;
+
+void* operator new(size_t size) {
+    void *p = malloc(size);
+    if(!p) throw std::bad_alloc();
+    live_bytes += malloc_usable_size(p);
+    if(live_bytes > peak_bytes) peak_bytes = live_bytes;
+    return p;
+}
+void operator delete(void *p) noexcept {
+    if(p) live_bytes -= malloc_usable_size(p);
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+static aiopromise<nil> serve(ptr<afd> fd, size_t body, size_t *requests, size_t *checksum) {
+    for(;;) {
+        auto head = co_await fd->read_until("\r\n\r\n");
+        if(!head) break;
+        auto data = co_await fd->read_n(body);
+        if(!data) break;
+        *checksum += (unsigned char)data->front() + (unsigned char)data->back();
+        (*requests)++;
+    }
+    co_return nil {};
+}
+
+int main() {
+    constexpr size_t stream_size = 100 * 1000 * 1000;
+    struct { size_t body, chunk; } cases[] = {
+        {1024 * 1024, 16384},
+        {64 * 1024, 16384},
+        {100, 16384},
+        {10 * 1000 * 1000, 65536}
+    };
+    for(auto [body, chunk] : cases) {
+        std::string request = "POST /upload HTTP/1.1\r\nHost: localhost\r\nContent-Length: " + std::to_string(body) + "\r\n\r\n";
+        request.append(body, 'x');
+        // requests are repeated until the stream is big enough, chunks cross request boundaries
+        std::string stream;
+        while(stream.size() < stream_size) stream += request;
+        size_t expected = stream.size() / request.size();
+
+        size_t requests = 0, checksum = 0;
+        auto fd = ptr_new<afd>(nullptr, (fd_t)-1, (fd_t)-1, S80_FD_OTHER);
+        size_t baseline = live_bytes;
+        peak_bytes = live_bytes;
+        auto start = std::chrono::steady_clock::now();
+        serve(fd, body, &requests, &checksum);
+        for(size_t offset = 0; offset < stream.size(); offset += chunk) {
+            fd->on_data(std::string_view(stream).substr(offset, chunk));
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t peak = peak_bytes - baseline;
+        // fails the pending head read, so serve returns and releases the fd
+        fd->close(false);
+
+        printf("body %8zu B, chunk %5zu B: %5.2f GB/s, peak heap %7zu KiB\n", body, chunk, stream.size() / elapsed / 1e9, peak / 1024);
+        if(requests != expected || checksum != requests * 2 * 'x') {
+            printf("served %zu of %zu requests\n", requests, expected);
+            return 1;
+        }
+    }
+    return 0;
+}
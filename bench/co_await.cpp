@@ -0,0 +1,109 @@
+// Cost of co_await on aiopromise in the shapes the server hits the most: awaiting a promise that is
+// resolved already, awaiting a chain of coroutines that complete without suspending, suspending on
+// a pending promise until it gets resolved, and taking an uncontended aiolock.
+// Every operator new is counted, coroutine frames taken from frame_arena don't show up.
+//
+// usage (from repository root):
+//   c++ -std=c++23 -O2 -Isrc/90s -o bin/bench_co_await bench/co_await.cpp src/90s/tracing.cpp && bin/bench_co_await [iterations]
+#include "aiopromise.hpp"
+#include "util/aiolock.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+using namespace s90;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static aiopromise<int> ready(int i) {
+    aiopromise<int> result;
+    result.resolve(std::move(i));
+    return result;
+}
+
+static aiopromise<int> inner(int i) {
+    co_return i + 1;
+}
+
+static aiopromise<int> outer(int i) {
+    co_return co_await inner(i) + 1;
+}
+
+// promise the driver resolves once the awaiting coroutine is suspended on it
+static aiopromise<int>::weak_type pending_slot;
+
+static aiopromise<int> pending() {
+    aiopromise<int> result;
+    pending_slot = result.weak();
+    return result;
+}
+
+static aiopromise<nil> await_ready(int n, long long *sum) {
+    for(int i = 0; i < n; i++) *sum += co_await ready(i);
+    co_return nil {};
+}
+
+static aiopromise<nil> await_nested(int n, long long *sum) {
+    for(int i = 0; i < n; i++) *sum += co_await outer(i);
+    co_return nil {};
+}
+
+static aiopromise<nil> await_pending(int n, long long *sum) {
+    for(int i = 0; i < n; i++) *sum += co_await pending();
+    co_return nil {};
+}
+
+static aiopromise<nil> await_lock(int n, long long *sum) {
+    util::aiolock lock;
+    for(int i = 0; i < n; i++) {
+        *sum += co_await lock.lock();
+        lock.unlock();
+    }
+    co_return nil {};
+}
+
+static void resolve_pending() {
+    while(auto state = pending_slot.lock()) {
+        pending_slot = aiopromise<int>::weak_type();
+        aiopromise(state).resolve(1);
+    }
+}
+
+template<class Run>
+static void measure(const char *name, int n, Run run) {
+    allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    run();
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-32s %6.1f ns, %.2f allocations\n", name, elapsed / n, (double)allocations / n);
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 5000000;
+    long long sum = 0;
+    // warm up, so the freelists are filled the same way a running worker has them
+    await_nested(1000, &sum);
+    await_pending(1000, &sum);
+    resolve_pending();
+
+    measure("co_await resolved promise", n, [&]() { await_ready(n, &sum); });
+    measure("co_await 2 nested sync coros", n, [&]() { await_nested(n, &sum); });
+    measure("co_await suspended + resumed", n, [&]() {
+        await_pending(n, &sum);
+        resolve_pending();
+    });
+    measure("uncontended aiolock::lock", n, [&]() { await_lock(n, &sum); });
+    // keeps the loops from being optimized away
+    return sum == 0;
+}
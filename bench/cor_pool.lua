@@ -0,0 +1,95 @@
+-- Requests per second and GC time of the /echo path of server/simple_http.lua
+-- with and without the coroutine pool of aio (aio.cor_pool_limit).
+--
+-- Requests are fed straight into aio:handle_as_http over a fake socket, so
+-- only the Lua side is measured: buffered_cor, cor2, async and the handler.
+-- GC time is how long a full collection takes after a run with the collector stopped.
+--
+-- usage (from repository root): luajit bench/cor_pool.lua [connections] [requests per connection]
+package.path = "./?.lua;" .. package.path
+-- outside of 80s there are no worker globals
+WORKERID = WORKERID or 0
+require("aio.aio")
+
+-- plain Lua stand-ins for the C helpers when ran outside of 80s
+if not codec.url_decode then
+    codec.url_decode = function(text)
+        return (text:gsub("+", " "):gsub("%%(%x%x)", function(hex) return string.char(tonumber(hex, 16)) end))
+    end
+end
+-- same results as the C scanner: full match, or partial match at the end
+if not net.partscan then
+    net.partscan = function(haystack, needle, offset)
+        local pos = haystack:find(needle, offset, true)
+        if pos then return pos, #needle end
+        for length = math.min(#needle - 1, #haystack - offset + 1), 1, -1 do
+            if haystack:sub(-length) == needle:sub(1, length) then
+                return #haystack - length + 1, length
+            end
+        end
+        return #haystack + 1, 0
+    end
+end
+
+local connections = tonumber(arg and arg[1]) or 20000
+local per_connection = tonumber(arg and arg[2]) or 5
+
+aio:http_get("/echo", function (fd, query, headers, body)
+    local params = aio:parse_query(query)
+    fd:http_response(
+        "200 OK",
+        "text/plain; charset=utf-8",
+        ("Hi, %s!"):format(params.name or "Nomad")
+    )
+end)
+
+local responses = 0
+local socket = {}
+socket.__index = socket
+function socket:http_response(status, content_type, response) responses = responses + 1 end
+function socket:close() end
+
+local request = "GET /echo?name=bench HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+
+local function run()
+    for _ = 1, connections do
+        local fd = setmetatable({}, socket)
+        aio:handle_as_http(fd)
+        for _ = 1, per_connection do
+            fd:on_data(nil, nil, request, #request)
+        end
+        fd:on_close(nil, nil)
+    end
+end
+
+local function measure(limit)
+    aio.cor_pool_limit = limit
+    run()
+    collectgarbage("collect")
+    responses = 0
+    local started = os.clock()
+    run()
+    local elapsed = os.clock() - started
+    local served = responses
+
+    -- once more without the collector, to see what the run leaves behind and what it takes to collect
+    collectgarbage("collect")
+    collectgarbage("stop")
+    local memory = collectgarbage("count")
+    run()
+    local allocated = collectgarbage("count") - memory
+    started = os.clock()
+    collectgarbage("collect")
+    local collected = os.clock() - started
+    collectgarbage("restart")
+    return served / elapsed, allocated / served, collected
+end
+
+print(string.format("%s, %d connections x %d requests", jit and jit.version or _VERSION, connections, per_connection))
+for _, limit in ipairs({0, 256}) do
+    local rate, allocated, collected = measure(limit)
+    print(string.format(
+        "cor_pool_limit=%-4d %8.0f req/s  %.2f KB allocated/request  %.1f ms to collect %d requests",
+        limit, rate, allocated, collected * 1000, connections * per_connection
+    ))
+end
@@ -0,0 +1,71 @@
+// Cost of finding and locking the connection of an event, with many connections open: the
+// std::map context used to keep against fd_table. Events hit random connections, so lookups
+// miss the cache the way they do under C10K load.
+//
+// usage (from repository root), lib80s.a comes from ./90s.sh:
+//   c++ -std=c++23 -O2 -Isrc -Isrc/90s -o bin/bench_fd_table bench/fd_table.cpp src/90s/afd.cpp bin/lib80s.a -lssl -lcrypto -lz -lpthread && bin/bench_fd_table
+#include "fd_table.hpp"
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+// callbacks lib80s expects from its host, no event loop runs here
+extern "C" {
+    void on_receive(read_params params) {}
+    void on_close(close_params params) {}
+    void on_write(write_params params) {}
+    void on_accept(accept_params params) {}
+    void on_message(message_params params) {}
+    void s80_print(const char *fmt, ...) {}
+}
+
+using namespace s90;
+
+template<class Lookup>
+static double measure(const std::vector<fd_t>& events, size_t& hits, Lookup lookup) {
+    auto start = std::chrono::steady_clock::now();
+    for(auto event : events) {
+        if(auto fd = lookup(event)) hits++;
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / events.size();
+}
+
+int main() {
+    for(size_t connections : {10000, 100000}) {
+        std::vector<ptr<iafd>> owners;
+        dict<fd_t, wptr<iafd>> map;
+        fd_table table;
+        // descriptors 0 to 4 are taken by stdio, the event loop and the listening socket
+        for(size_t i = 0; i < connections; i++) {
+            auto fd = static_pointer_cast<iafd>(ptr_new<afd>(nullptr, 0, true));
+            owners.push_back(fd);
+            map[(fd_t)(i + 5)] = fd;
+            table.insert((fd_t)(i + 5), fd);
+        }
+
+        std::mt19937 rng(1);
+        std::vector<fd_t> events(4000000);
+        for(auto& event : events) event = (fd_t)(5 + rng() % connections);
+
+        size_t hits = 0;
+        double map_ns = measure(events, hits, [&map](fd_t fd) -> ptr<iafd> {
+            auto it = map.find(fd);
+            return it == map.end() ? nullptr : it->second.lock();
+        });
+        double table_ns = measure(events, hits, [&table](fd_t fd) -> ptr<iafd> {
+            auto entry = table.find(fd);
+            return entry ? entry->ref.lock() : nullptr;
+        });
+        printf("%6zu connections: std::map %6.1f ns/event, fd_table %5.1f ns/event (%zu found)\n", connections, map_ns, table_ns, hits);
+
+        // a handle taken before the fd got closed and reused must not match the new connection
+        auto handle = table.insert((fd_t)7, owners[2]);
+        table.erase((fd_t)7);
+        table.insert((fd_t)7, owners[0]);
+        if(table.find(handle)) {
+            puts("stale handle matched");
+            return 1;
+        }
+    }
+    return 0;
+}
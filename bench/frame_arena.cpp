@@ -0,0 +1,96 @@
+// Time and global allocations per request of a chain of coroutines shaped like the one of a
+// HTTP request: on_accept -> render -> sql (suspends on I/O) -> http_response -> finalize.
+// Every operator new is counted, so frames taken from frame_arena don't show up.
+//
+// usage (from repository root):
+//   c++ -std=c++23 -O2 -Isrc/90s -o bin/bench_frame_arena bench/frame_arena.cpp src/90s/tracing.cpp && bin/bench_frame_arena [requests]
+// to compare with the plain global allocator, build it on a tree without frame_arena.hpp, leaving out
+// tracing.cpp if the tree predates it as well
+#include "aiopromise.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <queue>
+#include <string>
+
+using namespace s90;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// I/O that completes only once the event loop gets to it
+static std::queue<aiopromise<int>::weak_type> io;
+
+static aiopromise<int> query() {
+    aiopromise<int> result;
+    io.push(result.weak());
+    return result;
+}
+
+static aiopromise<int> sql(int i) {
+    char scratch[200];
+    scratch[0] = i;
+    int rows = co_await query();
+    co_return rows + scratch[0];
+}
+
+static aiopromise<int> finalize(int i) {
+    std::string output(40, 'x');
+    co_return i + (int)output.size();
+}
+
+static aiopromise<int> http_response(int i) {
+    co_return co_await finalize(i) + 1;
+}
+
+static aiopromise<int> render(int i) {
+    int rows = co_await sql(i);
+    char buffer[512];
+    buffer[0] = 1;
+    co_return co_await http_response(rows) + buffer[0];
+}
+
+static aiopromise<nil> on_accept(int i, long long *sum) {
+    *sum += co_await render(i);
+    co_return nil {};
+}
+
+static void serve(int requests, long long *sum) {
+    for(int i = 0; i < requests; i++) {
+        on_accept(i & 63, sum);
+        while(!io.empty()) {
+            auto pending = std::move(io.front());
+            io.pop();
+            if(auto state = pending.lock()) aiopromise(state).resolve(1);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 2000000;
+    long long sum = 0;
+    // warm up, so the freelists are filled the same way a running worker has them
+    serve(1000, &sum);
+
+    allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    serve(requests, &sum);
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d requests: %.1f ns/request, %.2f global allocations/request\n", requests, elapsed / requests, (double)allocations / requests);
+#if __has_include("frame_arena.hpp")
+    const auto& stats = frame_arena::local().stats();
+    printf("frames allocated %zu, reused %zu, cached %zu B\n", stats.allocated, stats.reused, stats.cached_bytes);
+#endif
+    // keeps the chain from being optimized away
+    return sum == 0;
+}
@@ -0,0 +1,146 @@
+// Keep-alive HTTP/1.1 load: every connection sends a request, reads the whole response and sends
+// the next one. Prints req/s, p50/p99 latency and the average response size on the wire, head
+// included, responses need to have Content-Length.
+//
+// usage (from repository root):
+//   cc -O2 -o bin/http_load bench/http_load.c -lpthread
+//   bin/http_load host port path connections seconds [extra header line]
+// i.e. "Accept-Encoding: gzip" as the extra header line gets compressed responses
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONNECTIONS 64
+#define MAX_SAMPLES 1000000
+
+static const char *host, *path, *extra = "";
+static int port;
+static double seconds;
+
+typedef struct {
+    long requests;
+    long long bytes;
+    double *latencies;
+} connection_result;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void *run(void *arg) {
+    connection_result *result = arg;
+    static __thread char buffer[1 << 20];
+    char request[512], head[4096];
+    int one = 1, request_length;
+    struct sockaddr_in address = {0};
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    result->latencies = malloc(sizeof(double) * MAX_SAMPLES);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, host, &address.sin_addr);
+    if(connect(fd, (struct sockaddr*)&address, sizeof(address))) {
+        perror("connect");
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    request_length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n%s%s\r\n", path, extra, *extra ? "\r\n" : "");
+
+    double end = now() + seconds;
+    while(now() < end) {
+        double started = now();
+        long received = 0, expected = -1, head_length = 0;
+        if(write(fd, request, request_length) != request_length) {
+            perror("write");
+            exit(1);
+        }
+        while(expected < 0 || received < expected) {
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if(n <= 0) {
+                perror("read");
+                exit(1);
+            }
+            // the head is kept until the body length is known, the body is just counted
+            if(expected < 0) {
+                long copied = n < (long)sizeof(head) - 1 - head_length ? n : (long)sizeof(head) - 1 - head_length;
+                memcpy(head + head_length, buffer, copied);
+                head_length += copied;
+                head[head_length] = 0;
+                char *head_end = strstr(head, "\r\n\r\n");
+                if(head_end) {
+                    char *length = strcasestr(head, "content-length:");
+                    if(!length) {
+                        fprintf(stderr, "response without content-length\n");
+                        exit(1);
+                    }
+                    expected = (head_end - head) + 4 + atol(length + 15);
+                }
+            }
+            received += n;
+        }
+        result->bytes += received;
+        if(result->requests < MAX_SAMPLES) result->latencies[result->requests] = now() - started;
+        result->requests++;
+    }
+    close(fd);
+    return NULL;
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    pthread_t threads[MAX_CONNECTIONS];
+    connection_result results[MAX_CONNECTIONS] = {0};
+    long total = 0, samples = 0;
+    long long bytes = 0;
+    int connections;
+
+    if(argc < 6) {
+        fprintf(stderr, "usage: %s host port path connections seconds [extra header line]\n", argv[0]);
+        return 1;
+    }
+    host = argv[1];
+    port = atoi(argv[2]);
+    path = argv[3];
+    connections = atoi(argv[4]);
+    seconds = atof(argv[5]);
+    if(argc > 6) extra = argv[6];
+    if(connections < 1 || connections > MAX_CONNECTIONS) {
+        fprintf(stderr, "connections must be 1 to %d\n", MAX_CONNECTIONS);
+        return 1;
+    }
+
+    for(int i = 0; i < connections; i++) pthread_create(&threads[i], NULL, run, &results[i]);
+    for(int i = 0; i < connections; i++) {
+        pthread_join(threads[i], NULL);
+        total += results[i].requests;
+        bytes += results[i].bytes;
+    }
+
+    double *latencies = malloc(sizeof(double) * (total ? total : 1));
+    for(int i = 0; i < connections; i++) {
+        long n = results[i].requests < MAX_SAMPLES ? results[i].requests : MAX_SAMPLES;
+        memcpy(latencies + samples, results[i].latencies, sizeof(double) * n);
+        samples += n;
+    }
+    if(samples == 0) {
+        fprintf(stderr, "no responses\n");
+        return 1;
+    }
+    qsort(latencies, samples, sizeof(double), compare);
+    printf("%s connections=%d: %ld requests, %.0f req/s p50=%.3fms p99=%.3fms %lld B/response\n", path, connections, total,
+        total / seconds, latencies[samples / 2] * 1e3, latencies[samples * 99 / 100] * 1e3, bytes / total);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#!/usr/bin/env sh
+# Load a page of a running single worker server with bench/http_load, 1 and 4 connections, each
+# once without and once with Accept-Encoding: gzip, and print the server CPU time per request
+# along with the peak RSS of the worker. The bytes per response show what compression saves on
+# the wire, /table?unique=1 renders a different body every time so nothing comes from the memo.
+#
+# usage (from repository root), after building bin/http_load as described in bench/http_load.c:
+#   ./90s.sh && WEB_ROOT=bench/pages/ ./90s.sh pages
+#   WEB_ROOT=bench/pages/ bin/90s -p 8080 -c 1 &
+#   sh bench/http_load.sh 8080 /large [seconds]
+#   sh bench/http_load.sh 8080 /table && sh bench/http_load.sh 8080 "/table?unique=1"
+PORT="$1"
+URL_PATH="${2:-/large}"
+SECONDS_PER_RUN="${3:-5}"
+PID=$(pgrep -x 90s | head -n 1)
+TICKS=$(getconf CLK_TCK)
+
+if [ -z "$PID" ]; then
+  echo "no 90s process is running"
+  exit 1
+fi
+
+for CONNECTIONS in 1 4; do
+  for ENCODING in identity gzip; do
+    HEADER=""
+    if [ "$ENCODING" = "gzip" ]; then
+      HEADER="Accept-Encoding: gzip"
+    fi
+    CPU_BEFORE=$(awk '{print $14+$15}' /proc/$PID/stat)
+    OUTPUT=$(bin/http_load 127.0.0.1 "$PORT" "$URL_PATH" $CONNECTIONS "$SECONDS_PER_RUN" "$HEADER") || exit 1
+    CPU_AFTER=$(awk '{print $14+$15}' /proc/$PID/stat)
+    REQUESTS=$(echo "$OUTPUT" | sed 's/.*: \([0-9]*\) requests.*/\1/')
+    echo "$OUTPUT $ENCODING server_cpu=$(awk "BEGIN {printf \"%.3f\", ($CPU_AFTER - $CPU_BEFORE) * 1000 / $TICKS / $REQUESTS}")ms/request"
+  done
+done
+grep VmHWM /proc/$PID/status
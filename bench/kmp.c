@@ -0,0 +1,144 @@
+// Throughput of kmp() of src/80s/algo.c against the byte-wise Knuth-Morris-Pratt scan it replaced,
+// and a randomized check that both return the same match or partial match.
+//
+// usage (from repository root):
+//   cc -O2 -march=native -Isrc -o bin/bench_kmp bench/kmp.c src/80s/algo.c && bin/bench_kmp
+#include <80s/algo.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the previous implementation, to compare against
+static void reference_build_kmp(const char *pattern, size_t pattern_len, int64_t *KMP_T) {
+    int64_t i, j;
+    KMP_T[0] = -1;
+    j = 0;
+    i = 1;
+    while (i < (int64_t)pattern_len) {
+        if (pattern[i] == pattern[j]) {
+            KMP_T[i] = KMP_T[j];
+        } else {
+            KMP_T[i] = j;
+            while (j >= 0 && pattern[i] != pattern[j]) {
+                j = KMP_T[j];
+            }
+        }
+        i++, j++;
+    }
+    KMP_T[i] = j;
+}
+
+static kmp_result reference_kmp(const char* haystack, size_t len, const char* pattern, size_t pattern_len, size_t offset, int64_t *KMP_T) {
+    int64_t j, k, local_kmp_t[258];
+    kmp_result result;
+    result.offset = len;
+    result.length = 0;
+
+    if (len == 0 || pattern_len == 0) {
+        return result;
+    }
+
+    if (pattern_len == 1) {
+        pattern = (const char*)memchr((const void*)(haystack + offset), pattern[0], len - offset);
+        if (pattern) {
+            result.offset = (size_t)(pattern - haystack);
+            result.length = 1;
+        }
+        return result;
+    }
+
+    if(KMP_T == NULL) {
+        KMP_T = local_kmp_t;
+        if(pattern_len > 256) {
+            result.length = 0;
+            result.offset = -1;
+            return result;
+        }
+        reference_build_kmp(pattern, pattern_len, KMP_T);
+    }
+
+    j = (int64_t)offset;
+    k = 0;
+    while (j < (int64_t)len) {
+        if (pattern[k] == haystack[j]) {
+            j++;
+            k++;
+            if (k == (int64_t)pattern_len) {
+                result.offset = j - k;
+                result.length = k;
+                return result;
+            }
+        } else {
+            k = KMP_T[k];
+            if (k < 0) {
+                j++;
+                k++;
+            }
+        }
+    }
+
+    result.offset = j - k;
+    result.length = k;
+    return result;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// short haystacks and patterns over a tiny alphabet, so partial matches at the end are common
+static int check(int iterations) {
+    const char alphabet[] = "ab\r\n";
+    char haystack[64], pattern[8];
+    srand(1);
+    for(int it = 0; it < iterations; it++) {
+        int len = rand() % 64, pattern_len = 1 + rand() % 5, offset = len ? rand() % (len + 1) : 0;
+        for(int i = 0; i < len; i++) haystack[i] = alphabet[rand() % 4];
+        for(int i = 0; i < pattern_len; i++) pattern[i] = alphabet[rand() % 4];
+        kmp_result a = kmp(haystack, len, pattern, pattern_len, offset, NULL);
+        kmp_result b = reference_kmp(haystack, len, pattern, pattern_len, offset, NULL);
+        if(a.offset != b.offset || a.length != b.length) {
+            printf("mismatch len=%d pattern_len=%d offset=%d: %zu/%zu, expected %zu/%zu\n",
+                len, pattern_len, offset, a.offset, a.length, b.offset, b.length);
+            return 0;
+        }
+    }
+    printf("%d randomized inputs match\n", iterations);
+    return 1;
+}
+
+int main(void) {
+    if(!check(3000000)) return 1;
+
+    // request-like text with the delimiter only at the very end, the worst case for both
+    const char *text = "GET /abc HTTP/1.1\nHost: x\n";
+    const char *patterns[] = {"\r\n", "\r\n\r\n", "--boundary-1234567890", "0123456789abcdef0123456789abcdef"};
+    size_t sizes[] = {512, 16384, 1 << 20};
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t size = sizes[s];
+        char *buffer = malloc(size);
+        for(size_t i = 0; i < size; i++) buffer[i] = text[i % strlen(text)];
+        for(size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+            const char *pattern = patterns[p];
+            size_t pattern_len = strlen(pattern);
+            int64_t table[64];
+            memcpy(buffer + size - pattern_len, pattern, pattern_len);
+            build_kmp(pattern, pattern_len, table);
+            size_t repeats = (256u << 20) / size;
+            volatile size_t sink = 0;
+            double start = now();
+            for(size_t r = 0; r < repeats; r++) sink += reference_kmp(buffer, size, pattern, pattern_len, 0, table).offset;
+            double middle = now();
+            for(size_t r = 0; r < repeats; r++) sink += kmp(buffer, size, pattern, pattern_len, 0, table).offset;
+            double end = now();
+            printf("buffer %7zu B, delimiter %2zu B: reference %5.2f GB/s, kmp %5.2f GB/s\n",
+                size, pattern_len, repeats * size / (middle - start) / 1e9, repeats * size / (end - middle) / 1e9);
+        }
+        free(buffer);
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+# Requests per second of HTTP/1.1 keep-alive connections that pipeline `depth` requests at a
+# time: all of them are sent in one write, then all responses are read before the next batch.
+#
+# usage (from repository root):
+#   ./90s.sh && WEB_ROOT=bench/pages/ ./90s.sh pages
+#   WEB_ROOT=bench/pages/ bin/90s -p 8080 -c 1 &
+#   python3 bench/pipeline.py 127.0.0.1 8080 /fast 16 4 3
+# arguments are host, port, path, depth, connections and seconds, /fast answers right away and
+# /io after 2 ms spent on a helper thread
+import socket
+import sys
+import threading
+import time
+
+host, port, path = sys.argv[1], int(sys.argv[2]), sys.argv[3]
+depth, connections, seconds = int(sys.argv[4]), int(sys.argv[5]), float(sys.argv[6])
+batch = ("GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n" % path).encode() * depth
+served = [0] * connections
+
+
+def read_response(sock, buffer):
+    """Read one response with Content-Length, return what's left of the buffer after it"""
+    while True:
+        end = buffer.find(b"\r\n\r\n")
+        if end >= 0:
+            length = 0
+            for line in buffer[:end].decode().lower().split("\r\n"):
+                if line.startswith("content-length:"):
+                    length = int(line.split(":")[1])
+            if len(buffer) >= end + 4 + length:
+                return buffer[end + 4 + length:]
+        data = sock.recv(65536)
+        if not data:
+            raise SystemExit("connection closed")
+        buffer += data
+
+
+def run(index):
+    sock = socket.create_connection((host, port))
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    buffer = b""
+    end = time.time() + seconds
+    while time.time() < end:
+        sock.sendall(batch)
+        for _ in range(depth):
+            buffer = read_response(sock, buffer)
+        served[index] += depth
+    sock.close()
+
+
+threads = [threading.Thread(target=run, args=(i,)) for i in range(connections)]
+started = time.time()
+for thread in threads:
+    thread.start()
+for thread in threads:
+    thread.join()
+print("%s depth=%d connections=%d: %.0f req/s" % (path, depth, connections, sum(served) / (time.time() - started)))
@@ -0,0 +1,79 @@
+// Page lookup of httpd::router against the two std::map lookups it replaced (bare endpoint,
+// then method + " " + endpoint), for 1000 and 5000 routes shaped like /word/word/rN.
+// Every operator new is counted, so allocations per lookup show up as well.
+//
+// usage (from repository root):
+//   c++ -std=c++23 -O2 -Isrc/90s -o bin/bench_router bench/router.cpp src/90s/httpd/router.cpp && bin/bench_router
+#include "httpd/router.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+
+using namespace s90::httpd;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// routes only need to be told apart, nothing is rendered
+static page* fake_page(size_t id) {
+    return (page*)(uintptr_t)id;
+}
+
+int main() {
+    constexpr int lookups = 2000000;
+    const char *words[] = {"api", "v1", "users", "posts", "orders", "items", "admin", "reports", "search", "settings", "billing", "teams"};
+    for(int routes : {1000, 5000}) {
+        router tree;
+        std::map<std::string, page*> previous;
+        std::vector<std::string> paths;
+        for(int i = 0; i < routes; i++) {
+            std::string path = "/";
+            path += words[i % 12];
+            path += "/";
+            path += words[(i / 12) % 12];
+            path += "/r" + std::to_string(i);
+            tree.insert("GET " + path, fake_page(i + 1));
+            previous["GET " + path] = fake_page(i + 1);
+            paths.push_back(path);
+        }
+
+        std::string method = "GET";
+        size_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        size_t allocations_before = allocations;
+        for(int i = 0; i < lookups; i++) {
+            route_match match;
+            if(tree.match(method, paths[i % routes], match)) checksum += (uintptr_t)match.target;
+        }
+        auto middle = std::chrono::steady_clock::now();
+        size_t router_allocations = allocations - allocations_before;
+        for(int i = 0; i < lookups; i++) {
+            const auto& path = paths[i % routes];
+            auto it = previous.find(path);
+            if(it == previous.end()) it = previous.find(method + " " + path);
+            if(it != previous.end()) checksum -= (uintptr_t)it->second;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        printf("%d routes: router %.1f ns/lookup (%zu allocations), std::map %.1f ns/lookup\n", routes,
+            std::chrono::duration<double, std::nano>(middle - start).count() / lookups, router_allocations,
+            std::chrono::duration<double, std::nano>(end - middle).count() / lookups);
+        // both found the same pages
+        if(checksum != 0) {
+            puts("lookups differ");
+            return 1;
+        }
+    }
+    return 0;
+}
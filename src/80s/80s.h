@@ -29,6 +29,8 @@ extern "C" {
 #define S80_MB_WRITE 3
 #define S80_MB_CLOSE 4
 #define S80_MB_MESSAGE 5
+#define S80_MB_FILE 6
+#define S80_MB_FILE_ERROR 7
 
 #ifdef _MSC_VER
 #define BUFSIZE 16384
@@ -105,6 +107,23 @@ extern "C" {
 #error unsupported platform
 #endif
 
+#ifdef UNIX_BASED
+    #include <sys/uio.h>
+    #include <limits.h>
+    typedef struct iovec s80_iovec;
+#else
+    typedef struct s80_iovec_ {
+        void *iov_base;
+        size_t iov_len;
+    } s80_iovec;
+#endif
+
+#ifdef IOV_MAX
+    #define S80_IOV_MAX IOV_MAX
+#else
+    #define S80_IOV_MAX 1024
+#endif
+
 #define fd_to_void(fd) ((void*)(intptr_t)(fd))
 #define int_to_void(fd) ((void*)(intptr_t)(fd))
 #define void_to_fd(ptr) ((fd_t)(intptr_t)(ptr))
@@ -289,6 +308,8 @@ int is_fd_ready(struct ready_params_ params);
 
 fd_t s80_connect(void *ctx, fd_t elfd, const char *addr, int port, int is_udp);
 int s80_write(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const char *data, size_t offset, size_t len);
+int s80_writev(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const s80_iovec *iov, int iovcnt);
+int s80_sendfile(void *ctx, fd_t elfd, fd_t childfd, int fdtype, int filefd, uint64_t offset, size_t len);
 int s80_close(void *ctx, fd_t elfd, fd_t childfd, int fdtype, int callback);
 int s80_peername(fd_t fd, char *buf, size_t bufsize, int *port);
 int s80_popen(fd_t elfd, fd_t* pipes_out, const char *command, char *const *args);
@@ -299,6 +320,7 @@ void s80_acquire_mailbox(mailbox *mailbox);
 void s80_release_mailbox(mailbox *mailbox);
 void s80_enable_async(fd_t fd);
 int s80_set_recv_timeout(fd_t fd, int timeout);
+int s80_set_nodelay(fd_t fd, int nodelay);
 
 void resolve_mail(serve_params *params, int id);
 
@@ -13,12 +13,19 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/un.h>
 
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#elif defined(__FreeBSD__) || defined(__APPLE__)
+#include <sys/uio.h>
+#endif
+
 union addr_common {
     struct sockaddr_in6 v6;
     struct sockaddr_in v4;
@@ -171,9 +178,22 @@ fd_t s80_connect(void *ctx, fd_t elfd, const char *addr, int portno, int is_udp)
     return (fd_t)-1;
 }
 
-int s80_write(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const char *data, size_t offset, size_t len) {
+// subscribe for next write availability event, used when OS send buffer is full
+static int s80_wait_writeable(fd_t elfd, fd_t childfd, int fdtype) {
     struct event_t ev;
-    int status;
+    int status = 0;
+#ifdef USE_EPOLL
+    ev.events = EPOLLIN | EPOLLOUT;
+    SET_FD_HOLDER(ev, fdtype, childfd);
+    status = epoll_ctl(elfd, EPOLL_CTL_MOD, childfd, &ev);
+#elif defined(USE_KQUEUE)
+    EV_SET(&ev, childfd, EVFILT_WRITE, fdtype == S80_FD_PIPE ? (EV_ADD | EV_CLEAR) : (EV_ADD | EV_ONESHOT), 0, 0, int_to_void(fdtype));
+    status = kevent(elfd, &ev, 1, NULL, 0, NULL);
+#endif
+    return status;
+}
+
+int s80_write(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const char *data, size_t offset, size_t len) {
     size_t writelen = write(childfd, data + offset, len - offset);
     if (writelen < 0 && errno != EWOULDBLOCK) {
         dbgf(LOG_ERROR, "l_net_write: write failed\n");
@@ -182,15 +202,7 @@ int s80_write(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const char *data,
         // it can happen that we tried to write more than the OS send buffer size is,
         // in this case subscribe for next write availability event
         if (writelen < len) {
-    #ifdef USE_EPOLL
-            ev.events = EPOLLIN | EPOLLOUT;
-            SET_FD_HOLDER(ev, fdtype, childfd);
-            status = epoll_ctl(elfd, EPOLL_CTL_MOD, childfd, &ev);
-    #elif defined(USE_KQUEUE)
-            EV_SET(&ev, childfd, EVFILT_WRITE, fdtype == S80_FD_PIPE ? (EV_ADD | EV_CLEAR) : (EV_ADD | EV_ONESHOT), 0, 0, int_to_void(fdtype));
-            status = kevent(elfd, &ev, 1, NULL, 0, NULL);
-    #endif
-            if (status < 0) {
+            if (s80_wait_writeable(elfd, childfd, fdtype) < 0) {
                 dbgf(LOG_ERROR, "l_net_write: failed to add socket to out poll\n");
                 return -1;
             }
@@ -199,6 +211,71 @@ int s80_write(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const char *data,
     }
 }
 
+int s80_writev(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const s80_iovec *iov, int iovcnt) {
+    size_t len = 0;
+    ssize_t writelen;
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    writelen = writev(childfd, iov, iovcnt);
+    if (writelen < 0) {
+        if (errno != EWOULDBLOCK && errno != EAGAIN) {
+            dbgf(LOG_ERROR, "s80_writev: write failed\n");
+            return -1;
+        }
+        writelen = 0;
+    }
+    if ((size_t)writelen < len) {
+        if (s80_wait_writeable(elfd, childfd, fdtype) < 0) {
+            dbgf(LOG_ERROR, "s80_writev: failed to add socket to out poll\n");
+            return -1;
+        }
+    }
+    return (int)writelen;
+}
+
+int s80_sendfile(void *ctx, fd_t elfd, fd_t childfd, int fdtype, int filefd, uint64_t offset, size_t len) {
+    ssize_t writelen;
+#if defined(__linux__)
+    off_t off = (off_t)offset;
+    writelen = sendfile(childfd, filefd, &off, len);
+#elif defined(__FreeBSD__)
+    off_t sent = 0;
+    writelen = sendfile(filefd, childfd, (off_t)offset, len, NULL, &sent, 0);
+    // partial writes report EAGAIN, but still tell how much was sent
+    if (writelen < 0 && (errno == EWOULDBLOCK || errno == EAGAIN) && sent > 0) writelen = (ssize_t)sent;
+    else if (writelen == 0) writelen = (ssize_t)sent;
+#elif defined(__APPLE__)
+    off_t sent = (off_t)len;
+    writelen = sendfile(filefd, childfd, (off_t)offset, &sent, NULL, 0);
+    if (writelen < 0 && (errno == EWOULDBLOCK || errno == EAGAIN) && sent > 0) writelen = (ssize_t)sent;
+    else if (writelen == 0) writelen = (ssize_t)sent;
+#else
+    char buf[65536];
+    writelen = pread(filefd, buf, len < sizeof(buf) ? len : sizeof(buf), (off_t)offset);
+    if (writelen > 0) writelen = write(childfd, buf, (size_t)writelen);
+#endif
+    if (writelen < 0) {
+        if (errno != EWOULDBLOCK && errno != EAGAIN) {
+            dbgf(LOG_ERROR, "s80_sendfile: write failed\n");
+            return -1;
+        }
+        writelen = 0;
+    } else if (writelen == 0 && len > 0) {
+        // end of file came sooner than expected, the file was truncated meanwhile
+        dbgf(LOG_ERROR, "s80_sendfile: unexpected end of file\n");
+        return -1;
+    }
+    if ((size_t)writelen < len) {
+        if (s80_wait_writeable(elfd, childfd, fdtype) < 0) {
+            dbgf(LOG_ERROR, "s80_sendfile: failed to add socket to out poll\n");
+            return -1;
+        }
+    }
+    return (int)writelen;
+}
+
 int s80_close(void *ctx, fd_t elfd, fd_t childfd, int fdtype, int callback) {
     struct event_t ev;
     struct close_params_ params;
@@ -386,6 +463,10 @@ int s80_set_recv_timeout(fd_t fd, int timeo) {
     return setsockopt ((int)fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
 }
 
+int s80_set_nodelay(fd_t fd, int nodelay) {
+    return setsockopt((int)fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof nodelay);
+}
+
 void s80_acquire_mailbox(mailbox *mailbox) {
     sem_wait(&mailbox->lock);
 }
@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <io.h>
 
 #include <WinSock2.h>
 #include <Ws2TcpIp.h>
@@ -197,22 +198,8 @@ fd_t s80_connect(void *ctx, fd_t elfd, const char *addr, int portno, int is_udp)
     return (fd_t)-1;
 }
 
-int s80_write(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const char *data, size_t offset, size_t len) {
+static int s80_send_buffer(context_holder *cx) {
     int status;
-
-    context_holder *cx = (context_holder*)childfd;
-    // if there was some previous buffer, free it, although this shouldn't happen
-    if(cx->send->wsaBuf.buf != NULL) {
-        free(cx->send->wsaBuf.buf);
-        cx->send->wsaBuf.buf = NULL;
-        cx->send->wsaBuf.len = 0;
-    }
-    // create a new throw-away buffer and fill it with contents to be sent
-    // we gotta do it this way, as directly sending data buffer
-    // doesn't guarantee it wouldn't get GC-ed in meantime
-    cx->send->wsaBuf.buf = (char*)calloc(len - offset, 1);
-    cx->send->wsaBuf.len = len - offset;
-    memcpy(cx->send->wsaBuf.buf, data + offset, len - offset);
     // wsa send the stuff, if it's too large it later produces cx->send->ol event
     if(cx->fdtype == S80_FD_PIPE) {
         status = WriteFile(cx->fd, cx->send->wsaBuf.buf, cx->send->wsaBuf.len, NULL, &cx->send->ol) == FALSE ? FALSE : TRUE;
@@ -228,13 +215,71 @@ int s80_write(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const char *data,
     } else {
         // in this case payload was small enough and got sent immediately, so clean-up
         // the throw-away buffers safely here
+        status = (int)cx->send->wsaBuf.len;
+        free(cx->send->wsaBuf.buf);
+        cx->send->wsaBuf.buf = NULL;
+        cx->send->wsaBuf.len = 0;
+        return status;
+    }
+}
+
+static void s80_release_send_buffer(context_holder *cx) {
+    // if there was some previous buffer, free it, although this shouldn't happen
+    if(cx->send->wsaBuf.buf != NULL) {
         free(cx->send->wsaBuf.buf);
         cx->send->wsaBuf.buf = NULL;
         cx->send->wsaBuf.len = 0;
-        return len - offset;
     }
 }
 
+int s80_write(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const char *data, size_t offset, size_t len) {
+    context_holder *cx = (context_holder*)childfd;
+    s80_release_send_buffer(cx);
+    // create a new throw-away buffer and fill it with contents to be sent
+    // we gotta do it this way, as directly sending data buffer
+    // doesn't guarantee it wouldn't get GC-ed in meantime
+    cx->send->wsaBuf.buf = (char*)calloc(len - offset, 1);
+    cx->send->wsaBuf.len = len - offset;
+    memcpy(cx->send->wsaBuf.buf, data + offset, len - offset);
+    return s80_send_buffer(cx);
+}
+
+int s80_writev(void *ctx, fd_t elfd, fd_t childfd, int fdtype, const s80_iovec *iov, int iovcnt) {
+    context_holder *cx = (context_holder*)childfd;
+    size_t len = 0, offset = 0;
+    int i;
+    s80_release_send_buffer(cx);
+    for(i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    // overlapped send requires the buffer to outlive the call, so gather everything
+    // into a single throw-away buffer the same way s80_write does
+    cx->send->wsaBuf.buf = (char*)calloc(len, 1);
+    cx->send->wsaBuf.len = (ULONG)len;
+    for(i = 0; i < iovcnt; i++) {
+        memcpy(cx->send->wsaBuf.buf + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    return s80_send_buffer(cx);
+}
+
+int s80_sendfile(void *ctx, fd_t elfd, fd_t childfd, int fdtype, int filefd, uint64_t offset, size_t len) {
+    context_holder *cx = (context_holder*)childfd;
+    int readlen;
+    // there is no sendfile with overlapped sockets here, so the file is read into the send buffer
+    if(len > 65536) len = 65536;
+    s80_release_send_buffer(cx);
+    cx->send->wsaBuf.buf = (char*)calloc(len, 1);
+    if(_lseeki64(filefd, (__int64)offset, SEEK_SET) < 0) return -1;
+    readlen = _read(filefd, cx->send->wsaBuf.buf, (unsigned int)len);
+    if(readlen <= 0) {
+        s80_release_send_buffer(cx);
+        return -1;
+    }
+    cx->send->wsaBuf.len = (ULONG)readlen;
+    return s80_send_buffer(cx);
+}
+
 int s80_close(void *ctx, fd_t elfd, fd_t childfd, int fdtype, int callback) {
     int status = 0;
     close_params params;
@@ -487,6 +532,12 @@ int s80_set_recv_timeout(fd_t fd, int timeo) {
     return setsockopt (sfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
 }
 
+int s80_set_nodelay(fd_t fd, int nodelay) {
+    context_holder *cx = (context_holder*)fd;
+    SOCKET sfd = (SOCKET)cx->fd;
+    return setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+}
+
 void s80_acquire_mailbox(mailbox *mailbox) {
     WaitForSingleObject(mailbox->lock, INFINITE);
 }
@@ -22,10 +22,70 @@ void build_kmp(const char *pattern, size_t pattern_len, int64_t *KMP_T) {
     KMP_T[i] = j;
 }
 
+// vectorized search uses first & last byte of the pattern as a filter and compares
+// the rest only for the positions where both match, which is rare for real delimiters
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ALGO_VECTOR_SIZE 32
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ALGO_VECTOR_SIZE 16
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static int algo_ctz(uint32_t mask) {
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+}
+#else
+#define algo_ctz(mask) __builtin_ctz(mask)
+#endif
+
+static const char *find_full(const char *haystack, size_t len, const char *pattern, size_t pattern_len) {
+    size_t i = 0;
+    const char first = pattern[0];
+    const char last = pattern[pattern_len - 1];
+#ifdef ALGO_VECTOR_SIZE
+    uint32_t mask;
+    int bit;
+#if ALGO_VECTOR_SIZE == 32
+    const __m256i vfirst = _mm256_set1_epi8(first);
+    const __m256i vlast = _mm256_set1_epi8(last);
+    for (; i + pattern_len - 1 + ALGO_VECTOR_SIZE <= len; i += ALGO_VECTOR_SIZE) {
+        const __m256i block_first = _mm256_loadu_si256((const __m256i*)(haystack + i));
+        const __m256i block_last = _mm256_loadu_si256((const __m256i*)(haystack + i + pattern_len - 1));
+        mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, vfirst), _mm256_cmpeq_epi8(block_last, vlast)));
+#else
+    const __m128i vfirst = _mm_set1_epi8(first);
+    const __m128i vlast = _mm_set1_epi8(last);
+    for (; i + pattern_len - 1 + ALGO_VECTOR_SIZE <= len; i += ALGO_VECTOR_SIZE) {
+        const __m128i block_first = _mm_loadu_si128((const __m128i*)(haystack + i));
+        const __m128i block_last = _mm_loadu_si128((const __m128i*)(haystack + i + pattern_len - 1));
+        mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, vfirst), _mm_cmpeq_epi8(block_last, vlast)));
+#endif
+        while (mask) {
+            bit = algo_ctz(mask);
+            if (pattern_len == 2 || !memcmp(haystack + i + bit + 1, pattern + 1, pattern_len - 2)) {
+                return haystack + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + pattern_len <= len; i++) {
+        if (haystack[i] == first && haystack[i + pattern_len - 1] == last && !memcmp(haystack + i + 1, pattern + 1, pattern_len - 2)) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
 kmp_result kmp(const char* haystack, size_t len, const char* pattern, size_t pattern_len, size_t offset, int64_t *KMP_T) {
-    int64_t i, j, k, local_kmp_t[258];
+    size_t i;
+    const char *found;
     kmp_result result;
-    int match = 0;
     result.offset = len;
     result.length = 0;
 
@@ -33,6 +93,11 @@ kmp_result kmp(const char* haystack, size_t len, const char* pattern, size_t pat
         return result;
     }
 
+    if (offset >= len) {
+        result.offset = offset;
+        return result;
+    }
+
     // if pattern is single character, we can afford to just use memchr for this
     if (pattern_len == 1) {
         pattern = (const char*)memchr((const void*)(haystack + offset), pattern[0], len - offset);
@@ -43,39 +108,26 @@ kmp_result kmp(const char* haystack, size_t len, const char* pattern, size_t pat
         return result;
     }
 
-    if(KMP_T == NULL) {
-        KMP_T = local_kmp_t;
-        if(pattern_len > 256) {
-            result.length = 0;
-            result.offset = -1;
-            return result;
-        }
-        build_kmp(pattern, pattern_len, KMP_T);
+    // prebuilt KMP table is not needed anymore, it is kept in the signature for compatibility
+    (void)KMP_T;
+
+    found = find_full(haystack + offset, len - offset, pattern, pattern_len);
+    if (found) {
+        result.offset = (size_t)(found - haystack);
+        result.length = pattern_len;
+        return result;
     }
-    
-    j = (int64_t)offset;
-    k = 0;
-    while (j < (int64_t)len) {
-        if (pattern[k] == haystack[j]) {
-            j++;
-            k++;
-            if (k == (int64_t)pattern_len) {
-                result.offset = j - k;
-                result.length = k;
-                return result;
-            }
-        } else if (j == len) {
-            break;
-        } else {
-            k = KMP_T[k];
-            if (k < 0) {
-                j++;
-                k++;
-            }
+
+    // no full match, so report the longest suffix of haystack that is a prefix of the pattern,
+    // so the search can be resumed once more data arrives
+    i = len - offset >= pattern_len ? len - pattern_len + 1 : offset;
+    for (; i < len; i++) {
+        if (haystack[i] == pattern[0] && !memcmp(haystack + i, pattern, len - i)) {
+            result.offset = i;
+            result.length = len - i;
+            return result;
         }
     }
 
-    result.offset = j - k;
-    result.length = k;
     return result;
-}
\ No newline at end of file
+}
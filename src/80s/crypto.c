@@ -10,6 +10,12 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <errno.h>
+#include <time.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 
 #ifdef _WIN32
 #include <windows.h>
@@ -19,6 +25,10 @@
 #pragma comment (lib, "crypt32.lib")
 #endif
 
+#else
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #endif
 
 #ifdef USE_KTLS
@@ -40,6 +50,9 @@ struct ssl_nb_context {
     SSL *ssl;
     BIO *rdbio;
     BIO *wrbio;
+    int handshake_done;
+    // client session cache key, see ssl_client_session_key
+    char *session_key;
     #ifdef USE_KTLS
     fd_t elfd;
     fd_t fd;
@@ -262,6 +275,283 @@ int crypto_from64(const char *data, size_t len, dynstr *output_str, const char *
     return -1;
 }
 
+// process-wide TLS session state shared by all workers, so that a returning
+// client can resume its session regardless of which worker accepts it
+#define SSL_CACHE_SERVER_SLOTS 4096
+#define SSL_CACHE_CLIENT_SLOTS 512
+#define SSL_SESSION_ID_CONTEXT "80s"
+
+struct ssl_cache_entry {
+    unsigned char *key;
+    size_t key_len;
+    unsigned char *data;
+    size_t data_len;
+    time_t expire;
+};
+
+struct ssl_ticket_key {
+    int valid;
+    time_t created;
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+};
+
+#ifdef _WIN32
+static SRWLOCK ssl_shared_lock = SRWLOCK_INIT;
+#define ssl_shared_acquire() AcquireSRWLockExclusive(&ssl_shared_lock)
+#define ssl_shared_release() ReleaseSRWLockExclusive(&ssl_shared_lock)
+#else
+static pthread_mutex_t ssl_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+#define ssl_shared_acquire() pthread_mutex_lock(&ssl_shared_lock)
+#define ssl_shared_release() pthread_mutex_unlock(&ssl_shared_lock)
+#endif
+
+static struct ssl_cache_entry ssl_server_cache[SSL_CACHE_SERVER_SLOTS];
+static struct ssl_cache_entry ssl_client_cache[SSL_CACHE_CLIENT_SLOTS];
+static struct ssl_ticket_key ssl_ticket_keys[2];
+static int ssl_ticket_rotation = 3600;
+static struct crypto_ssl_stats ssl_stats;
+
+static size_t ssl_cache_slot(const unsigned char *key, size_t key_len, size_t slots) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for(i = 0; i < key_len; i++) {
+        hash ^= key[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)(hash % slots);
+}
+
+static void ssl_cache_clear_entry(struct ssl_cache_entry *entry) {
+    if(entry->key) free(entry->key);
+    memset(entry, 0, sizeof(struct ssl_cache_entry));
+}
+
+static void ssl_cache_put(struct ssl_cache_entry *table, size_t slots, const unsigned char *key, size_t key_len, SSL_SESSION *session) {
+    struct ssl_cache_entry *entry;
+    unsigned char *buffer, *p;
+    int data_len = i2d_SSL_SESSION(session, NULL);
+    if(data_len <= 0 || key_len == 0) return;
+    // key and serialized session share a single allocation
+    buffer = (unsigned char*)malloc(key_len + (size_t)data_len);
+    if(!buffer) return;
+    memcpy(buffer, key, key_len);
+    p = buffer + key_len;
+    if(i2d_SSL_SESSION(session, &p) != data_len) {
+        free(buffer);
+        return;
+    }
+    ssl_shared_acquire();
+    entry = table + ssl_cache_slot(key, key_len, slots);
+    // colliding entries are simply evicted, keeping the cache bounded
+    ssl_cache_clear_entry(entry);
+    entry->key = buffer;
+    entry->key_len = key_len;
+    entry->data = buffer + key_len;
+    entry->data_len = (size_t)data_len;
+    entry->expire = (time_t)(SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session));
+    ssl_shared_release();
+}
+
+static SSL_SESSION *ssl_cache_get(struct ssl_cache_entry *table, size_t slots, const unsigned char *key, size_t key_len) {
+    struct ssl_cache_entry *entry;
+    const unsigned char *p;
+    SSL_SESSION *session = NULL;
+    if(key_len == 0) return NULL;
+    ssl_shared_acquire();
+    entry = table + ssl_cache_slot(key, key_len, slots);
+    if(entry->key && entry->key_len == key_len && !memcmp(entry->key, key, key_len)) {
+        if(entry->expire <= time(NULL)) {
+            ssl_cache_clear_entry(entry);
+        } else {
+            p = entry->data;
+            session = d2i_SSL_SESSION(NULL, &p, (long)entry->data_len);
+        }
+    }
+    ssl_shared_release();
+    return session;
+}
+
+static void ssl_cache_remove(struct ssl_cache_entry *table, size_t slots, const unsigned char *key, size_t key_len) {
+    struct ssl_cache_entry *entry;
+    if(key_len == 0) return;
+    ssl_shared_acquire();
+    entry = table + ssl_cache_slot(key, key_len, slots);
+    if(entry->key && entry->key_len == key_len && !memcmp(entry->key, key, key_len)) {
+        ssl_cache_clear_entry(entry);
+    }
+    ssl_shared_release();
+}
+
+static int ssl_server_new_session(SSL *ssl, SSL_SESSION *session) {
+    unsigned int id_len = 0;
+    const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+    ssl_cache_put(ssl_server_cache, SSL_CACHE_SERVER_SLOTS, id, id_len, session);
+    // we keep serialized copy, so OpenSSL retains the ownership
+    return 0;
+}
+
+static SSL_SESSION *ssl_server_get_session(SSL *ssl, const unsigned char *id, int id_len, int *copy) {
+    SSL_SESSION *session = ssl_cache_get(ssl_server_cache, SSL_CACHE_SERVER_SLOTS, id, id_len > 0 ? (size_t)id_len : 0);
+    *copy = 0;
+    ssl_shared_acquire();
+    if(session) ssl_stats.cache_hits++;
+    else ssl_stats.cache_misses++;
+    ssl_shared_release();
+    return session;
+}
+
+static void ssl_server_remove_session(SSL_CTX *ctx, SSL_SESSION *session) {
+    unsigned int id_len = 0;
+    const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+    ssl_cache_remove(ssl_server_cache, SSL_CACHE_SERVER_SLOTS, id, id_len);
+}
+
+static int ssl_client_new_session(SSL *ssl, SSL_SESSION *session) {
+    struct ssl_nb_context *ctx = (struct ssl_nb_context*)SSL_get_ex_data(ssl, 0);
+    if(ctx && ctx->session_key && SSL_SESSION_is_resumable(session)) {
+        ssl_cache_put(ssl_client_cache, SSL_CACHE_CLIENT_SLOTS, (const unsigned char*)ctx->session_key, strlen(ctx->session_key), session);
+    }
+    return 0;
+}
+
+// client sessions are shared only between connections to the same host and port made with
+// equally configured client contexts, identity of the context is the hash of its configuration
+// (rather than its address), so that contexts of other workers created the same way match too
+static char *ssl_client_session_key(SSL_CTX *ssl_ctx, const char *host, fd_t childfd) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    unsigned port = 0;
+    size_t key_len = strlen(host) + 32;
+    char *key;
+    memset(&addr, 0, sizeof(addr));
+    if(getpeername((sock_t)childfd, (struct sockaddr*)&addr, &addr_len) == 0) {
+        if(addr.ss_family == AF_INET) port = ntohs(((struct sockaddr_in*)&addr)->sin_port);
+        else if(addr.ss_family == AF_INET6) port = ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+    }
+    key = (char*)malloc(key_len);
+    if(!key) return NULL;
+    snprintf(key, key_len, "%016llx/%s:%u", (unsigned long long)(uintptr_t)SSL_CTX_get_app_data(ssl_ctx), host, port);
+    return key;
+}
+
+// must be called with ssl_shared_lock held
+static int ssl_ticket_keys_refresh(time_t now) {
+    struct ssl_ticket_key next;
+    if(ssl_ticket_keys[0].valid && now - ssl_ticket_keys[0].created < ssl_ticket_rotation) {
+        return 0;
+    }
+    if(
+        RAND_bytes(next.name, sizeof(next.name)) != 1
+        || RAND_bytes(next.aes_key, sizeof(next.aes_key)) != 1
+        || RAND_bytes(next.hmac_key, sizeof(next.hmac_key)) != 1
+    ) {
+        return ssl_ticket_keys[0].valid ? 0 : -1;
+    }
+    next.valid = 1;
+    next.created = now;
+    // previous key is kept around so tickets issued just before rotation still decrypt
+    ssl_ticket_keys[1] = ssl_ticket_keys[0];
+    ssl_ticket_keys[0] = next;
+    OPENSSL_cleanse(&next, sizeof(next));
+    ssl_stats.ticket_rotations++;
+    return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ssl_ticket_key_callback(SSL *ssl, unsigned char key_name[16], unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *hmac_ctx, int enc) {
+#else
+static int ssl_ticket_key_callback(SSL *ssl, unsigned char key_name[16], unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *hmac_ctx, int enc) {
+#endif
+    struct ssl_ticket_key key;
+    int i, result = 0;
+    const EVP_CIPHER *cipher = EVP_aes_256_cbc();
+
+    memset(&key, 0, sizeof(key));
+    ssl_shared_acquire();
+    if(ssl_ticket_keys_refresh(time(NULL)) < 0) {
+        ssl_shared_release();
+        return -1;
+    }
+    if(enc) {
+        key = ssl_ticket_keys[0];
+        result = 1;
+    } else {
+        for(i = 0; i < 2; i++) {
+            if(ssl_ticket_keys[i].valid && !memcmp(ssl_ticket_keys[i].name, key_name, 16)) {
+                key = ssl_ticket_keys[i];
+                // ticket encrypted with previous key is accepted, but renewed
+                result = i == 0 ? 1 : 2;
+                break;
+            }
+        }
+    }
+    ssl_shared_release();
+
+    if(result == 0) {
+        // unknown key, fall back to full handshake
+        return 0;
+    }
+
+    if(enc) {
+        memcpy(key_name, key.name, 16);
+        if(RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) != 1 || !EVP_EncryptInit_ex(cipher_ctx, cipher, NULL, key.aes_key, iv)) {
+            result = -1;
+        }
+    } else if(!EVP_DecryptInit_ex(cipher_ctx, cipher, NULL, key.aes_key, iv)) {
+        result = -1;
+    }
+
+    if(result > 0) {
+    #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        OSSL_PARAM params[3];
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key));
+        params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0);
+        params[2] = OSSL_PARAM_construct_end();
+        if(!EVP_MAC_CTX_set_params(hmac_ctx, params)) {
+            result = -1;
+        }
+    #else
+        if(!HMAC_Init_ex(hmac_ctx, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), NULL)) {
+            result = -1;
+        }
+    #endif
+    }
+
+    OPENSSL_cleanse(&key, sizeof(key));
+    return result;
+}
+
+static void ssl_stats_handshake(int server, int resumed) {
+    ssl_shared_acquire();
+    if(server) {
+        ssl_stats.server_handshakes++;
+        if(resumed) ssl_stats.server_resumptions++;
+    } else {
+        ssl_stats.client_handshakes++;
+        if(resumed) ssl_stats.client_resumptions++;
+    }
+    ssl_shared_release();
+}
+
+int crypto_ssl_get_stats(struct crypto_ssl_stats *output_stats) {
+    if(!output_stats) return -1;
+    ssl_shared_acquire();
+    memcpy(output_stats, &ssl_stats, sizeof(struct crypto_ssl_stats));
+    ssl_shared_release();
+    return 0;
+}
+
+int crypto_ssl_set_ticket_rotation(int seconds) {
+    if(seconds <= 0) return -1;
+    ssl_shared_acquire();
+    ssl_ticket_rotation = seconds;
+    ssl_shared_release();
+    return 0;
+}
+
 int crypto_ssl_new_server(const char *pubkey, const char *privkey, void **output_ctx, const char **output_error_message) {
     int status;
 
@@ -304,6 +594,16 @@ int crypto_ssl_new_server(const char *pubkey, const char *privkey, void **output
             *output_error_message = "device doesn't support cipher mode";
         return -1;
     }
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char*)SSL_SESSION_ID_CONTEXT, sizeof(SSL_SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx, ssl_server_new_session);
+    SSL_CTX_sess_set_get_cb(ctx, ssl_server_get_session);
+    SSL_CTX_sess_set_remove_cb(ctx, ssl_server_remove_session);
+    #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ssl_ticket_key_callback);
+    #else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, ssl_ticket_key_callback);
+    #endif
     #ifdef USE_KTLS
     SSL_CTX_set_keylog_callback(ctx, ssl_secret_callback);
     #endif
@@ -313,6 +613,11 @@ int crypto_ssl_new_server(const char *pubkey, const char *privkey, void **output
 
 int crypto_ssl_new_client(const char *ca_file, const char *ca_path, const char *pubkey, const char *privkey, void **output_ctx, const char **output_error_message) {
     int status;
+    const char *config[4] = {ca_file, ca_path, pubkey, privkey};
+    // FNV-1a of the configuration, identifies the context in client session cache keys
+    uint64_t identity = 14695981039346656037ULL;
+    size_t i;
+    const char *c;
 
     SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
     if(!ctx) {
@@ -402,6 +707,17 @@ int crypto_ssl_new_client(const char *ca_file, const char *ca_path, const char *
             *output_error_message = "device doesn't support cipher mode";
         return -1;
     }
+    for(i = 0; i < 4; i++) {
+        for(c = config[i]; c && *c; c++) {
+            identity ^= (unsigned char)*c;
+            identity *= 1099511628211ULL;
+        }
+        identity ^= 0xFF;
+        identity *= 1099511628211ULL;
+    }
+    SSL_CTX_set_app_data(ctx, (void*)(uintptr_t)identity);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, ssl_client_new_session);
     #ifdef USE_KTLS
     SSL_CTX_set_keylog_callback(ctx, ssl_secret_callback);
     #endif
@@ -441,6 +757,7 @@ int crypto_ssl_bio_new(void *ssl_ctxt, fd_t elfd, fd_t childfd, int do_ktls, voi
 
 int crypto_ssl_bio_new_connect(void *ssl_ctxt, const char *hostport, fd_t elfd, fd_t childfd, int do_ktls, void **output_bio_ctx, const char **output_error_message) {
     struct ssl_nb_context *ctx = (struct ssl_nb_context*)calloc(1, sizeof(struct ssl_nb_context));
+    SSL_SESSION *session;
     if(!ctx) {
         if(output_error_message)
             *output_error_message = "failed to allocate ssl_nb_context";
@@ -466,6 +783,13 @@ int crypto_ssl_bio_new_connect(void *ssl_ctxt, const char *hostport, fd_t elfd,
         SSL_set_verify(ctx->ssl, SSL_VERIFY_PEER, NULL);
         SSL_set1_host(ctx->ssl, hostport);
         SSL_set_tlsext_host_name(ctx->ssl, hostport);
+        // attempt to resume previous session with the same host, possibly established by other worker
+        ctx->session_key = ssl_client_session_key(ssl_ctx, hostport, childfd);
+        session = ctx->session_key ? ssl_cache_get(ssl_client_cache, SSL_CACHE_CLIENT_SLOTS, (const unsigned char*)ctx->session_key, strlen(ctx->session_key)) : NULL;
+        if(session) {
+            SSL_set_session(ctx->ssl, session);
+            SSL_SESSION_free(session);
+        }
     }
 
     *output_bio_ctx = (void*)ctx;
@@ -476,8 +800,10 @@ int crypto_ssl_bio_release(void *bio_ctx, int flags) {
     struct ssl_nb_context* ctx = (struct ssl_nb_context*)bio_ctx;
     if(flags & 1)
         SSL_free(ctx->ssl);
-    if(flags & 2)
+    if(flags & 2) {
+        if(ctx->session_key) free(ctx->session_key);
         free(ctx);
+    }
     return 0;
 }
 
@@ -526,6 +852,10 @@ int crypto_ssl_accept(void *bio_ctx, int *output_ok, const char **output_error_m
     int n = SSL_accept(ctx->ssl);
     int err = SSL_get_error(ctx->ssl, n);
     if(err == SSL_ERROR_NONE) {
+        if(!ctx->handshake_done) {
+            ctx->handshake_done = 1;
+            ssl_stats_handshake(1, SSL_session_reused(ctx->ssl));
+        }
         if(output_ok) *output_ok = 0;
         return 0;
     } else if(err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
@@ -546,6 +876,10 @@ int crypto_ssl_connect(void *bio_ctx, int *output_ok, const char **output_error_
     int n = SSL_do_handshake(ctx->ssl);
     int err = SSL_get_error(ctx->ssl, n);
     if(err == SSL_ERROR_NONE) {
+        if(!ctx->handshake_done) {
+            ctx->handshake_done = 1;
+            ssl_stats_handshake(0, SSL_session_reused(ctx->ssl));
+        }
         if(output_ok) *output_ok = 0;
         return 0;
     } else if(err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
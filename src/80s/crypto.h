@@ -6,6 +6,16 @@
 extern "C" {
 #endif
 
+struct crypto_ssl_stats {
+    uint64_t server_handshakes;
+    uint64_t server_resumptions;
+    uint64_t client_handshakes;
+    uint64_t client_resumptions;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t ticket_rotations;
+};
+
 int crypto_init();
 
 int crypto_sha1(const char *data, size_t len, unsigned char *out_buffer, size_t out_length);
@@ -20,6 +30,8 @@ int crypto_from64(const char *data, size_t len, dynstr *output_str, const char *
 int crypto_ssl_new_server(const char *pubkey, const char *privkey, void **output_ctx, const char **output_error_message);
 int crypto_ssl_new_client(const char *ca_file, const char *ca_path, const char *pubkey, const char *privkey, void **output_ctx, const char **output_error_message);
 int crypto_ssl_release(void *ssl_ctx);
+int crypto_ssl_get_stats(struct crypto_ssl_stats *output_stats);
+int crypto_ssl_set_ticket_rotation(int seconds);
 
 int crypto_ssl_bio_new(void *ssl_ctxt, fd_t elfd, fd_t childfd, int do_ktls, void **output_bio_ctx, const char **output_error_message);
 int crypto_ssl_bio_new_connect(void *ssl_ctxt, const char *hostport, fd_t elfd, fd_t childfd, int do_ktls, void **output_bio_ctx, const char **output_error_message);
@@ -0,0 +1,241 @@
+#include "fileio.h"
+
+#include <string.h>
+#include <limits.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// initial read buffer for files whose size can't be determined upfront (pipes, procfs, ...)
+#define FILEIO_CHUNK 16384
+
+typedef struct fileio_job_ {
+    reload_context *reload;
+    int worker_id;
+    int op;
+    int request;
+    char *path;
+    char *data;
+    size_t size;
+    struct fileio_job_ *next;
+} fileio_job;
+
+#ifdef _WIN32
+static SRWLOCK fileio_lock = SRWLOCK_INIT;
+#define fileio_acquire() AcquireSRWLockExclusive(&fileio_lock)
+#define fileio_release() ReleaseSRWLockExclusive(&fileio_lock)
+#else
+static pthread_mutex_t fileio_lock = PTHREAD_MUTEX_INITIALIZER;
+#define fileio_acquire() pthread_mutex_lock(&fileio_lock)
+#define fileio_release() pthread_mutex_unlock(&fileio_lock)
+#endif
+
+static fileio_job *fileio_head = NULL, *fileio_tail = NULL;
+static int fileio_threads = 0;
+static int fileio_request_id = 0;
+
+static void fileio_complete(fileio_job *job, int type, char *data, size_t size) {
+    mailbox_message msg;
+    mailbox *mb = job->reload->mailboxes + job->worker_id;
+    msg.sender_id = job->worker_id;
+    msg.sender_elfd = mb->elfd;
+    msg.sender_fd = void_to_fd(int_to_void(job->request));
+    msg.receiver_fd = void_to_fd(NULL);
+    msg.type = type;
+    msg.size = size;
+    msg.message = data;
+    if(s80_mail(mb, &msg) < 0) {
+        free(data);
+    }
+}
+
+static void fileio_fail(fileio_job *job, const char *error) {
+    size_t len = strlen(error);
+    char *data = (char*)malloc(len + 1);
+    if(!data) return;
+    memcpy(data, error, len + 1);
+    fileio_complete(job, S80_MB_FILE_ERROR, data, len);
+}
+
+static void fileio_read(fileio_job *job) {
+    FILE *f = fopen(job->path, "rb");
+    char *buf, *tmp;
+    long size;
+    size_t capacity, length = 0, n;
+
+    if(!f) {
+        fileio_fail(job, "failed to open file");
+        return;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    // read one byte more than expected, so regular files finish in a single pass
+    capacity = size > 0 ? (size_t)size + 1 : FILEIO_CHUNK;
+    buf = (char*)malloc(capacity);
+    if(!buf) {
+        fclose(f);
+        fileio_fail(job, "failed to allocate memory");
+        return;
+    }
+
+    for(;;) {
+        n = fread(buf + length, 1, capacity - length, f);
+        length += n;
+        if(length < capacity) break;
+        tmp = (char*)realloc(buf, capacity * 2);
+        if(!tmp) {
+            free(buf);
+            fclose(f);
+            fileio_fail(job, "failed to allocate memory");
+            return;
+        }
+        buf = tmp;
+        capacity *= 2;
+    }
+
+    if(ferror(f)) {
+        free(buf);
+        fclose(f);
+        fileio_fail(job, "failed to read file");
+        return;
+    }
+
+    fclose(f);
+    fileio_complete(job, S80_MB_FILE, buf, length);
+}
+
+static void fileio_write(fileio_job *job) {
+    FILE *f = fopen(job->path, job->op == FILEIO_APPEND ? "ab" : "wb");
+    char *empty;
+    int ok;
+
+    if(!f) {
+        fileio_fail(job, "failed to open file");
+        return;
+    }
+
+    ok = fwrite(job->data, 1, job->size, f) == job->size;
+    ok = fclose(f) == 0 && ok;
+    if(!ok) {
+        fileio_fail(job, "failed to write file");
+        return;
+    }
+
+    empty = (char*)calloc(1, sizeof(char));
+    if(!empty) return;
+    fileio_complete(job, S80_MB_FILE, empty, 0);
+}
+
+// helper threads drain the queue and exit once it's empty, so no thread
+// outlives the work and nothing is left running across reloads
+#ifdef _WIN32
+static DWORD WINAPI fileio_run(LPVOID arg) {
+#else
+static void *fileio_run(void *arg) {
+#endif
+    fileio_job *job;
+    for(;;) {
+        fileio_acquire();
+        job = fileio_head;
+        if(!job) {
+            fileio_threads--;
+            fileio_release();
+            break;
+        }
+        fileio_head = job->next;
+        if(!fileio_head) fileio_tail = NULL;
+        fileio_release();
+
+        if(job->op == FILEIO_READ) {
+            fileio_read(job);
+        } else {
+            fileio_write(job);
+        }
+
+        free(job);
+    }
+    return 0;
+}
+
+static int fileio_spawn(void) {
+#ifdef _WIN32
+    HANDLE handle = CreateThread(NULL, 1 << 17, fileio_run, NULL, 0, NULL);
+    if(!handle) return -1;
+    CloseHandle(handle);
+    return 0;
+#else
+    pthread_t handle;
+    pthread_attr_t attr;
+    int status;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    status = pthread_create(&handle, &attr, fileio_run, NULL);
+    pthread_attr_destroy(&attr);
+    return status == 0 ? 0 : -1;
+#endif
+}
+
+int fileio_submit(reload_context *reload, int worker_id, int op, const char *path, const char *data, size_t len, void **output_request, const char **output_error_message) {
+    size_t path_len = strlen(path);
+    fileio_job *job;
+    int request;
+
+    if(worker_id < 0 || worker_id >= reload->workers || op < FILEIO_READ || op > FILEIO_APPEND) {
+        if(output_error_message)
+            *output_error_message = "invalid worker or operation";
+        return -1;
+    }
+
+    if(op == FILEIO_READ) len = 0;
+
+    // job, path and data share a single allocation
+    job = (fileio_job*)malloc(sizeof(fileio_job) + path_len + 1 + len);
+    if(!job) {
+        if(output_error_message)
+            *output_error_message = "failed to allocate memory";
+        return -1;
+    }
+
+    job->reload = reload;
+    job->worker_id = worker_id;
+    job->op = op;
+    job->path = (char*)(job + 1);
+    job->data = job->path + path_len + 1;
+    job->size = len;
+    job->next = NULL;
+    memcpy(job->path, path, path_len + 1);
+    if(len > 0) memcpy(job->data, data, len);
+
+    fileio_acquire();
+    // keep handles positive and non-zero, so they never collide with NILFD
+    fileio_request_id = fileio_request_id == INT_MAX ? 1 : fileio_request_id + 1;
+    request = job->request = fileio_request_id;
+    if(fileio_tail) {
+        fileio_tail->next = job;
+    } else {
+        fileio_head = job;
+    }
+    fileio_tail = job;
+    if(fileio_threads < FILEIO_MAX_THREADS) {
+        if(fileio_spawn() == 0) {
+            fileio_threads++;
+        } else if(fileio_threads == 0) {
+            // nobody would ever pick the job up
+            fileio_head = fileio_tail = NULL;
+            fileio_release();
+            free(job);
+            if(output_error_message)
+                *output_error_message = "failed to start file thread";
+            return -1;
+        }
+    }
+    fileio_release();
+
+    *output_request = int_to_void(request);
+    return 0;
+}
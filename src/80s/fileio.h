@@ -0,0 +1,23 @@
+#ifndef __80S_FILEIO_H__
+#define __80S_FILEIO_H__
+#include "80s.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FILEIO_READ 0
+#define FILEIO_WRITE 1
+#define FILEIO_APPEND 2
+
+// maximum number of helper threads performing blocking file operations
+#define FILEIO_MAX_THREADS 4
+
+// performs the operation on a helper thread and mails the completion back to worker_id
+// as S80_MB_FILE (file contents for reads) or S80_MB_FILE_ERROR (error message) with
+// sender_fd set to the request handle returned in output_request
+int fileio_submit(reload_context *reload, int worker_id, int op, const char *path, const char *data, size_t len, void **output_request, const char **output_error_message);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
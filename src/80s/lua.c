@@ -185,6 +185,12 @@ static void refresh_lua(lua_State *L, fd_t elfd, node_id *id, const char *entryp
     lua_pushinteger(L, S80_MB_MESSAGE);
     lua_setglobal(L, "S80_MB_MESSAGE");
 
+    lua_pushinteger(L, S80_MB_FILE);
+    lua_setglobal(L, "S80_MB_FILE");
+
+    lua_pushinteger(L, S80_MB_FILE_ERROR);
+    lua_setglobal(L, "S80_MB_FILE_ERROR");
+
     lua_pushlightuserdata(L, (void *)reload);
     lua_setglobal(L, "S80_RELOAD");
 
@@ -1,5 +1,6 @@
 #include "lua_codec.h"
 #include "dynstr.h"
+#include "zstream.h"
 #include <ctype.h>
 #include <lauxlib.h>
 #include <stdint.h>
@@ -770,6 +771,88 @@ static int l_codec_html_encode(lua_State *L) {
     return 1;
 }
 
+static int l_codec_deflate_stream(lua_State *L) {
+    int args = lua_gettop(L);
+    int mode, format, level = -1;
+    size_t max_output = 0;
+    const char *mode_str, *format_str;
+    const char *error_message = NULL;
+    zstream *stream = NULL;
+    if(args < 2 || lua_type(L, 1) != LUA_TSTRING || lua_type(L, 2) != LUA_TSTRING) {
+        return luaL_error(L, "expecting 2 to 4 arguments: mode (string), format (string), level (integer|nil), max output (integer|nil)");
+    }
+    mode_str = lua_tostring(L, 1);
+    format_str = lua_tostring(L, 2);
+    if(!strcmp(mode_str, "deflate")) mode = ZSTREAM_DEFLATE;
+    else if(!strcmp(mode_str, "inflate")) mode = ZSTREAM_INFLATE;
+    else return luaL_error(L, "mode must be either deflate or inflate");
+    if(!strcmp(format_str, "gzip")) format = ZSTREAM_FORMAT_GZIP;
+    else if(!strcmp(format_str, "zlib")) format = ZSTREAM_FORMAT_ZLIB;
+    else if(!strcmp(format_str, "raw")) format = ZSTREAM_FORMAT_RAW;
+    else return luaL_error(L, "format must be one of gzip, zlib, raw");
+    if(args >= 3 && lua_type(L, 3) == LUA_TNUMBER) level = (int)lua_tointeger(L, 3);
+    if(args >= 4 && lua_type(L, 4) == LUA_TNUMBER) {
+        lua_Integer limit = lua_tointeger(L, 4);
+        // 0 means no cap, a negative one would turn into a huge size_t and silently mean the same
+        if(limit < 0) return luaL_error(L, "max output must be 0 (no cap) or positive");
+        max_output = (size_t)limit;
+    }
+    if(zstream_new(mode, format, level, max_output, &stream, &error_message) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, error_message);
+        return 2;
+    }
+    lua_pushlightuserdata(L, (void*)stream);
+    return 1;
+}
+
+static int l_codec_deflate_update(lua_State *L) {
+    int args = lua_gettop(L);
+    int flush = ZSTREAM_NO_FLUSH, result;
+    size_t len;
+    char buffer[16384];
+    dynstr str;
+    const char *data, *flush_str;
+    const char *error_message = NULL;
+    if(args < 2 || lua_type(L, 1) != LUA_TLIGHTUSERDATA || lua_type(L, 2) != LUA_TSTRING) {
+        return luaL_error(L, "expecting 2 or 3 arguments: stream (lightuserdata), data (string), flush (string|nil)");
+    }
+    data = lua_tolstring(L, 2, &len);
+    if(args >= 3 && lua_type(L, 3) == LUA_TSTRING) {
+        flush_str = lua_tostring(L, 3);
+        if(!strcmp(flush_str, "sync")) flush = ZSTREAM_SYNC_FLUSH;
+        else if(!strcmp(flush_str, "finish")) flush = ZSTREAM_FINISH;
+    }
+    dynstr_init(&str, buffer, sizeof(buffer));
+    result = zstream_update((zstream*)lua_touserdata(L, 1), data, len, flush, &str, &error_message);
+    if(result < 0) {
+        dynstr_release(&str);
+        lua_pushnil(L);
+        lua_pushstring(L, error_message);
+        return 2;
+    }
+    lua_pushlstring(L, str.ptr, str.length);
+    lua_pushboolean(L, result > 0);
+    dynstr_release(&str);
+    return 2;
+}
+
+static int l_codec_deflate_reset(lua_State *L) {
+    if(lua_gettop(L) != 1 || lua_type(L, 1) != LUA_TLIGHTUSERDATA) {
+        return luaL_error(L, "expecting 1 argument: stream (lightuserdata)");
+    }
+    lua_pushboolean(L, zstream_reset((zstream*)lua_touserdata(L, 1)) == 0);
+    return 1;
+}
+
+static int l_codec_deflate_release(lua_State *L) {
+    if(lua_gettop(L) != 1 || lua_type(L, 1) != LUA_TLIGHTUSERDATA) {
+        return luaL_error(L, "expecting 1 argument: stream (lightuserdata)");
+    }
+    zstream_release((zstream*)lua_touserdata(L, 1));
+    return 0;
+}
+
 int luaopen_codec(lua_State *L) {
     int i;
     const luaL_Reg netlib[] = {
@@ -781,6 +864,10 @@ int luaopen_codec(lua_State *L) {
         {"url_decode", l_codec_url_decode},
         {"mysql_encode", l_codec_mysql_encode},
         {"html_encode", l_codec_html_encode},
+        {"deflate_stream", l_codec_deflate_stream},
+        {"deflate_update", l_codec_deflate_update},
+        {"deflate_reset", l_codec_deflate_reset},
+        {"deflate_release", l_codec_deflate_release},
         {NULL, NULL}};
 #if LUA_VERSION_NUM > 501
     luaL_newlib(L, netlib);
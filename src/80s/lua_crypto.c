@@ -204,10 +204,9 @@ static int l_crypto_ssl_bio_new_connect(lua_State *L) {
     const char *hostport = lua_type(L, 2) == LUA_TNIL ? NULL : lua_tostring(L, 2);
     fd_t elfd = (fd_t)0, childfd = (fd_t)0;
     int do_ktls = lua_gettop(L) == 5 && lua_type(L, 5) == LUA_TBOOLEAN ? lua_toboolean(L, 5) : 0;
-    #ifdef USE_KTLS
+    // the socket is needed even without KTLS, its peer port is part of the client session cache key
     elfd = void_to_fd(lua_touserdata(L, 3));
     childfd = void_to_fd(lua_touserdata(L, 4));
-    #endif
     void *bio_ctx = NULL;
     int status = crypto_ssl_bio_new_connect(ssl_ctx, hostport, elfd, childfd, do_ktls, &bio_ctx, NULL);
     if(status < 0) return 0;
@@ -347,6 +346,35 @@ static int l_crypto_ssl_requests_io(lua_State *L) {
     return 1;
 }
 
+static int l_crypto_ssl_stats(lua_State *L) {
+    struct crypto_ssl_stats stats;
+    crypto_ssl_get_stats(&stats);
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, (lua_Integer)stats.server_handshakes);
+    lua_setfield(L, -2, "server_handshakes");
+    lua_pushinteger(L, (lua_Integer)stats.server_resumptions);
+    lua_setfield(L, -2, "server_resumptions");
+    lua_pushinteger(L, (lua_Integer)stats.client_handshakes);
+    lua_setfield(L, -2, "client_handshakes");
+    lua_pushinteger(L, (lua_Integer)stats.client_resumptions);
+    lua_setfield(L, -2, "client_resumptions");
+    lua_pushinteger(L, (lua_Integer)stats.cache_hits);
+    lua_setfield(L, -2, "cache_hits");
+    lua_pushinteger(L, (lua_Integer)stats.cache_misses);
+    lua_setfield(L, -2, "cache_misses");
+    lua_pushinteger(L, (lua_Integer)stats.ticket_rotations);
+    lua_setfield(L, -2, "ticket_rotations");
+    return 1;
+}
+
+static int l_crypto_ssl_ticket_rotation(lua_State *L) {
+    if(lua_gettop(L) != 1 || lua_type(L, 1) != LUA_TNUMBER) {
+        return luaL_error(L, "expecting 1 argument: seconds (integer)");
+    }
+    lua_pushboolean(L, crypto_ssl_set_ticket_rotation((int)lua_tointeger(L, 1)) == 0);
+    return 1;
+}
+
 static int l_crypto_random(lua_State *L) {
     if(lua_gettop(L) != 1 || lua_type(L, 1) != LUA_TNUMBER) {
         return luaL_error(L, "expecting 1 argument: length (integer)");
@@ -409,6 +437,8 @@ int luaopen_crypto(lua_State *L) {
         {"ssl_read", l_crypto_ssl_read},
         {"ssl_write", l_crypto_ssl_write},
         {"ssl_requests_io", l_crypto_ssl_requests_io},
+        {"ssl_stats", l_crypto_ssl_stats},
+        {"ssl_ticket_rotation", l_crypto_ssl_ticket_rotation},
         {"rsa_sha256", l_crypto_rsa_sha256},
         {NULL, NULL}};
     crypto_init();
@@ -2,6 +2,7 @@
 #include "lua_net.h"
 #include "algo.h"
 #include "dynstr.h"
+#include "fileio.h"
 #include <lauxlib.h>
 #include <lualib.h>
 
@@ -186,6 +187,46 @@ static int l_net_readfile(lua_State *L) {
     return 0;
 }
 
+static int l_net_readfile_async(lua_State *L) {
+    if(lua_gettop(L) != 3 || lua_type(L, 1) != LUA_TLIGHTUSERDATA || lua_type(L, 2) != LUA_TNUMBER || lua_type(L, 3) != LUA_TSTRING) {
+        return luaL_error(L, "expecting 3 arguments: reload context (lightuserdata), worker id (integer), file name (string)");
+    }
+    void *request;
+    const char *error = NULL;
+    reload_context *reload = (reload_context*)lua_touserdata(L, 1);
+    int worker_id = (int)lua_tointeger(L, 2);
+    const char *name = lua_tostring(L, 3);
+    if(fileio_submit(reload, worker_id, FILEIO_READ, name, NULL, 0, &request, &error) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, error);
+        return 2;
+    }
+    lua_pushlightuserdata(L, request);
+    return 1;
+}
+
+static int l_net_writefile_async(lua_State *L) {
+    if(lua_gettop(L) != 5 || lua_type(L, 1) != LUA_TLIGHTUSERDATA || lua_type(L, 2) != LUA_TNUMBER || lua_type(L, 3) != LUA_TSTRING || lua_type(L, 4) != LUA_TSTRING || lua_type(L, 5) != LUA_TSTRING) {
+        return luaL_error(L, "expecting 5 arguments: reload context (lightuserdata), worker id (integer), file name (string), data (string), mode (string)");
+    }
+    void *request;
+    size_t len;
+    const char *error = NULL;
+    reload_context *reload = (reload_context*)lua_touserdata(L, 1);
+    int worker_id = (int)lua_tointeger(L, 2);
+    const char *name = lua_tostring(L, 3);
+    const char *data = lua_tolstring(L, 4, &len);
+    const char *mode = lua_tostring(L, 5);
+    int op = strchr(mode, 'a') ? FILEIO_APPEND : FILEIO_WRITE;
+    if(fileio_submit(reload, worker_id, op, name, data, len, &request, &error) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, error);
+        return 2;
+    }
+    lua_pushlightuserdata(L, request);
+    return 1;
+}
+
 static int l_net_reload(lua_State *L) {
     const char *entrypoint;
     reload_context *reload;
@@ -708,6 +749,8 @@ int luaopen_net(lua_State *L) {
         {"quit", l_net_quit},
         {"listdir", l_net_listdir},
         {"readfile", l_net_readfile},
+        {"readfile_async", l_net_readfile_async},
+        {"writefile_async", l_net_writefile_async},
         {"inotify_init", l_net_inotify_init},
         {"inotify_add", l_net_inotify_add},
         {"inotify_remove", l_net_inotify_remove},
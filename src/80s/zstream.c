@@ -0,0 +1,219 @@
+#include "zstream.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#if defined(_MSC_VER)
+#define ZSTREAM_THREAD_LOCAL __declspec(thread)
+#else
+#define ZSTREAM_THREAD_LOCAL __thread
+#endif
+
+// size of a single output step, output dynstr is grown by at least this much
+#define ZSTREAM_CHUNK 16384
+
+struct zstream_ {
+    int mode;
+    int format;
+    int level;
+    int finished;
+    size_t max_output;
+    size_t total_output;
+    z_stream stream;
+    struct zstream_ *next;
+};
+
+// idle streams are kept per worker thread, so zlib state (window, hash tables)
+// is allocated once and only reset between uses
+static ZSTREAM_THREAD_LOCAL zstream *zstream_pool[2][3];
+static ZSTREAM_THREAD_LOCAL int zstream_pool_size[2][3];
+
+static int zstream_window_bits(int format) {
+    switch(format) {
+        case ZSTREAM_FORMAT_ZLIB:
+            return 15;
+        case ZSTREAM_FORMAT_RAW:
+            return -15;
+        default:
+            return 15 | 16;
+    }
+}
+
+static void zstream_end(zstream *stream) {
+    if(stream->mode == ZSTREAM_DEFLATE) {
+        deflateEnd(&stream->stream);
+    } else {
+        inflateEnd(&stream->stream);
+    }
+    free(stream);
+}
+
+int zstream_new(int mode, int format, int level, size_t max_output, zstream **output_stream, const char **output_error_message) {
+    zstream *stream;
+    int status;
+
+    if((mode != ZSTREAM_DEFLATE && mode != ZSTREAM_INFLATE) || format < ZSTREAM_FORMAT_GZIP || format > ZSTREAM_FORMAT_RAW) {
+        if(output_error_message)
+            *output_error_message = "invalid stream mode or format";
+        return -1;
+    }
+
+    if(level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+        if(output_error_message)
+            *output_error_message = "compression level must be between -1 and 9";
+        return -1;
+    }
+
+    stream = zstream_pool[mode][format];
+    if(stream) {
+        zstream_pool[mode][format] = stream->next;
+        zstream_pool_size[mode][format]--;
+        stream->next = NULL;
+        if(mode == ZSTREAM_DEFLATE && stream->level != level) {
+            // stream is freshly reset and has no pending input, so this can't fail with Z_BUF_ERROR
+            if(deflateParams(&stream->stream, level, Z_DEFAULT_STRATEGY) != Z_OK) {
+                zstream_end(stream);
+                stream = NULL;
+            }
+        }
+    }
+
+    if(!stream) {
+        stream = (zstream*)calloc(1, sizeof(zstream));
+        if(!stream) {
+            if(output_error_message)
+                *output_error_message = "failed to allocate zstream";
+            return -1;
+        }
+        stream->stream.zalloc = Z_NULL;
+        stream->stream.zfree = Z_NULL;
+        stream->stream.opaque = Z_NULL;
+        if(mode == ZSTREAM_DEFLATE) {
+            status = deflateInit2(&stream->stream, level, Z_DEFLATED, zstream_window_bits(format), 8, Z_DEFAULT_STRATEGY);
+        } else {
+            status = inflateInit2(&stream->stream, zstream_window_bits(format));
+        }
+        if(status != Z_OK) {
+            free(stream);
+            if(output_error_message)
+                *output_error_message = "failed to initialize zlib stream";
+            return -1;
+        }
+    }
+
+    stream->mode = mode;
+    stream->format = format;
+    stream->level = level;
+    stream->finished = 0;
+    stream->max_output = max_output;
+    stream->total_output = 0;
+    *output_stream = stream;
+    return 0;
+}
+
+int zstream_update(zstream *stream, const char *data, size_t len, int flush, dynstr *output_str, const char **output_error_message) {
+    int status, zflush;
+    size_t produced;
+
+    if(stream->finished) {
+        if(len == 0) return 1;
+        if(output_error_message)
+            *output_error_message = "stream is already finished";
+        return -1;
+    }
+
+    if(stream->mode == ZSTREAM_DEFLATE) {
+        zflush = flush == ZSTREAM_FINISH ? Z_FINISH : (flush == ZSTREAM_SYNC_FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+    } else {
+        // inflate with Z_FINISH expects whole output to fit at once, so never use it
+        zflush = flush == ZSTREAM_SYNC_FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    }
+
+    stream->stream.next_in = (Bytef*)data;
+    stream->stream.avail_in = (uInt)len;
+
+    for(;;) {
+        if(!dynstr_check(output_str, ZSTREAM_CHUNK)) {
+            if(output_error_message)
+                *output_error_message = "failed to allocate output buffer";
+            return -1;
+        }
+        stream->stream.next_out = (Bytef*)(output_str->ptr + output_str->length);
+        stream->stream.avail_out = ZSTREAM_CHUNK;
+
+        if(stream->mode == ZSTREAM_DEFLATE) {
+            status = deflate(&stream->stream, zflush);
+        } else {
+            status = inflate(&stream->stream, zflush);
+        }
+
+        produced = ZSTREAM_CHUNK - stream->stream.avail_out;
+        output_str->length += produced;
+        stream->total_output += produced;
+
+        if(stream->max_output > 0 && stream->total_output > stream->max_output) {
+            if(output_error_message)
+                *output_error_message = "output limit exceeded";
+            return -1;
+        }
+
+        if(status == Z_STREAM_END) {
+            stream->finished = 1;
+            break;
+        } else if(status == Z_BUF_ERROR) {
+            // no progress was possible, i.e. more input is required
+            break;
+        } else if(status != Z_OK) {
+            if(output_error_message)
+                *output_error_message = status == Z_DATA_ERROR ? "invalid or corrupted data" : "zlib stream error";
+            return -1;
+        }
+
+        // as long as output is full, there might be more pending
+        if(stream->stream.avail_out > 0 && stream->stream.avail_in == 0 && zflush != Z_FINISH) {
+            break;
+        }
+    }
+
+    if(flush == ZSTREAM_FINISH && !stream->finished) {
+        if(output_error_message)
+            *output_error_message = "unexpected end of stream";
+        return -1;
+    }
+
+    return stream->finished;
+}
+
+int zstream_reset(zstream *stream) {
+    int status;
+    if(stream->mode == ZSTREAM_DEFLATE) {
+        status = deflateReset(&stream->stream);
+    } else {
+        status = inflateReset(&stream->stream);
+    }
+    stream->finished = 0;
+    stream->total_output = 0;
+    return status == Z_OK ? 0 : -1;
+}
+
+int zstream_is_finished(const zstream *stream) {
+    return stream->finished;
+}
+
+size_t zstream_total_output(const zstream *stream) {
+    return stream->total_output;
+}
+
+void zstream_release(zstream *stream) {
+    int mode, format;
+    if(!stream) return;
+    mode = stream->mode;
+    format = stream->format;
+    if(zstream_pool_size[mode][format] >= ZSTREAM_POOL_SIZE || zstream_reset(stream) < 0) {
+        zstream_end(stream);
+        return;
+    }
+    stream->next = zstream_pool[mode][format];
+    zstream_pool[mode][format] = stream;
+    zstream_pool_size[mode][format]++;
+}
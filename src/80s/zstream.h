@@ -0,0 +1,35 @@
+#ifndef __80S_ZSTREAM_H__
+#define __80S_ZSTREAM_H__
+#include "80s.h"
+#include "dynstr.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZSTREAM_DEFLATE 0
+#define ZSTREAM_INFLATE 1
+
+#define ZSTREAM_FORMAT_GZIP 0
+#define ZSTREAM_FORMAT_ZLIB 1
+#define ZSTREAM_FORMAT_RAW 2
+
+#define ZSTREAM_NO_FLUSH 0
+#define ZSTREAM_SYNC_FLUSH 1
+#define ZSTREAM_FINISH 2
+
+// maximum number of idle streams kept per worker for each mode & format
+#define ZSTREAM_POOL_SIZE 16
+
+typedef struct zstream_ zstream;
+
+int zstream_new(int mode, int format, int level, size_t max_output, zstream **output_stream, const char **output_error_message);
+int zstream_update(zstream *stream, const char *data, size_t len, int flush, dynstr *output_str, const char **output_error_message);
+int zstream_reset(zstream *stream);
+int zstream_is_finished(const zstream *stream);
+size_t zstream_total_output(const zstream *stream);
+void zstream_release(zstream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
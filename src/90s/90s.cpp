@@ -4,6 +4,7 @@
 #include "afd.hpp"
 #include "context.hpp"
 #include "httpd/server.hpp"
+#include "lib/blockingqueue.h"
 
 #ifdef BUILD_WITH_S3
 #include <aws/core/Aws.h>
@@ -1,9 +1,27 @@
 #include "afd.hpp"
 #include <80s/algo.h>
 #include <80s/crypto.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#define FILE_CLOSE(file) _close(file)
+#else
+#include <unistd.h>
+#define FILE_CLOSE(file) ::close(file)
+#endif
 
 namespace s90 {
 
+    // smallest capacity the recv buffer is grown to
+    constexpr size_t read_min_capacity = 16384;
+    // fully consumed recv buffers above this capacity are released instead of reused
+    constexpr size_t read_shrink_threshold = 1024 * 1024;
+    // small writes are appended to the last queued segment up to this size instead of queueing new ones
+    constexpr size_t write_coalesce_limit = 16384;
+
     afd::afd(context *ctx, fd_t elfd, fd_t fd, int fdtype) : ctx(ctx), elfd(elfd), fd(fd), fd_type(fdtype) {
     
     }
@@ -19,6 +37,22 @@ namespace s90 {
             ssl_status = ssl_state::none;
         }
         close(false);
+        // nothing may be left pending, cancel hooks of the promises refer to this object
+        handle_failure();
+    }
+
+    afd::file_region::~file_region() {
+        FILE_CLOSE(file);
+    }
+
+    void afd::cancellable(aiopromise<read_arg>& promise) {
+        // there is no telling where in the stream a cancelled read would have ended,
+        // so the only safe way out is to drop the connection, which fails all other reads too
+        promise.on_cancel({true, ""}, [this]() {
+            has_error = true;
+            close(true);
+            on_close();
+        });
     }
 
     void afd::on_accept() {
@@ -64,7 +98,12 @@ namespace s90 {
             if(data.size() > 0) [[likely]] {
                 // extend the read buffer with new data and clear the current data so future
                 // loops won't extend it again
-                read_buffer.insert(read_buffer.end(), data.begin(), data.end());
+                if(!buffer_append(data)) [[unlikely]] {
+                    dbgf(LOG_ERROR, "%s; recv buffer limit of %zu bytes exceeded, closing\n", name().c_str(), read_limit);
+                    has_error = true;
+                    close(true);
+                    return;
+                }
                 data = data.substr(data.size());
             }
 
@@ -86,6 +125,7 @@ namespace s90 {
                         arg = window;
                         window = window.substr(window.size());
                         read_commands.pop();
+                        read_pinned = true;
                         if(auto p = command_promise.lock())
                             aiopromise(p).resolve({false, std::move(arg)});
                         iterate = false;
@@ -100,69 +140,31 @@ namespace s90 {
                             arg = window.substr(0, command_n);
                             window = window.substr(command_n);
                             read_commands.pop();
+                            read_pinned = true;
                             if(auto p = command_promise.lock())
                                 aiopromise(p).resolve({false, std::move(arg)});
                         }
                         break;
                     case read_command_type::until: [[likely]]
-                        // until is fulfilled until a delimiter appears, this implemenation makes use of specially optimized partial
-                        // search based on Knuth-Morris-Pratt algorithm, so it's O(n)
-                        if(delim_state.match > 0) {
-                            uint64_t rem = command_delim_length - delim_state.match;
-                            size_t data_length = delim_state.offset + rem > window.length() ? window.length() : delim_state.offset + rem;
-
-                            part = kmp(
-                                window.data(),
-                                data_length,
-                                it.delimiter.c_str() + delim_state.match,
-                                command_delim_length - delim_state.match,
-                                delim_state.offset,
-                                it.pattern_ref ? it.pattern_ref : it.pattern.data()
-                            );
-                            
-                            if(part.length < rem) {
-                                delim_state.match = 0;
-                                part = kmp(
-                                    window.data(), 
-                                    window.length(), 
-                                    it.delimiter.c_str() + delim_state.match, 
-                                    command_delim_length - delim_state.match,
-                                    delim_state.offset,
-                                    it.pattern_ref ? it.pattern_ref : it.pattern.data()
-                                );
-                            }
-                        } else {
-                            part = kmp(window.data(), window.length(), it.delimiter.c_str() + delim_state.match, command_delim_length - delim_state.match, delim_state.offset, it.pattern_ref ? it.pattern_ref : it.pattern.data());
-                        }
-                        if(part.length == command_delim_length || (part.offset == delim_state.offset && part.length + delim_state.match == command_delim_length)) {
-                            dbgf(LOG_DEBUG, "%s; 1/Read until, offset: %zu, match: %zu, rem: %zu -> new offset: %zu, found length: %zu\n", name().c_str(), delim_state.offset, delim_state.match, command_delim_length - delim_state.match, part.offset, part.length);
-                            delim_state.match = 0;
-                            delim_state.offset = part.offset + part.length;
-                            read_offset += delim_state.offset;
-
-                            arg = window.substr(0, delim_state.offset - command_delim_length);
-                            window = window.substr(delim_state.offset);
+                        // until is fulfilled until a delimiter appears, this implemenation makes use of vectorized partial
+                        // search (see algo.c), that also reports delimiter prefix at the end of the window; the next search
+                        // resumes at that prefix, so a delimiter split across reads is found once the rest arrives
+                        part = kmp(window.data(), window.length(), it.delimiter.c_str(), command_delim_length, delim_state.offset, it.pattern_ref ? it.pattern_ref : it.pattern.data());
+                        if(part.length == command_delim_length) {
+                            dbgf(LOG_DEBUG, "%s; Read until, offset: %zu -> found at: %zu\n", name().c_str(), delim_state.offset, part.offset);
                             delim_state.offset = 0;
+                            read_offset += part.offset + part.length;
+
+                            arg = window.substr(0, part.offset);
+                            window = window.substr(part.offset + part.length);
                             read_commands.pop();
+                            read_pinned = true;
                             if(auto p = command_promise.lock())
                                 aiopromise(p).resolve({false, std::move(arg)});
-                        } else if(part.offset == delim_state.offset + delim_state.match && part.length > 0) [[unlikely]] {
-                            dbgf(LOG_DEBUG, "%s; 2/Read until, offset: %zu, match: %zu, rem: %zu -> new offset: %zu, found length: %zu\n", name().c_str(), delim_state.offset, delim_state.match, command_delim_length - delim_state.match, part.offset, part.length);
-                            delim_state.match += part.length;
-                            delim_state.offset = part.offset + part.length;
-                            iterate = false;
-                        } else [[likely]] {
-                            dbgf(LOG_DEBUG, "%s; 3/Read until, offset: %zu, match: %zu, rem: %zu -> new offset: %zu, found length: %zu\n", name().c_str(), delim_state.offset, delim_state.match, command_delim_length - delim_state.match, part.offset, part.length);
-                            //delim_state.match = 0;
-                            //delim_state.offset = part.offset;
-                            size_t to_add = part.offset == window.length() - part.length ? part.length : 0;
-                            if(delim_state.match == 0 || (delim_state.match > 0 && part.offset == delim_state.offset)) {
-                                delim_state.match += to_add;
-                                delim_state.offset = part.offset + to_add;
-                            } else {
-                                delim_state.match = to_add;
-                                delim_state.offset = part.offset + delim_state.match;
-                            }
+                        } else {
+                            dbgf(LOG_DEBUG, "%s; Read until, offset: %zu -> resume at: %zu, partial: %zu\n", name().c_str(), delim_state.offset, part.offset, part.length);
+                            // without a partial match kmp reports the end of the window
+                            delim_state.offset = part.offset;
                             iterate = false;
                         }
                         break;
@@ -170,10 +172,15 @@ namespace s90 {
             }
 
             if(read_offset == read_buffer.size() || (!buffering && read_commands.empty())) [[unlikely]] {
-                // if everything was executed, clear the read buffer
-                dbgf(LOG_DEBUG, "%s; reset read offset to 0\n", name().c_str());
-                read_offset = 0;
-                read_buffer.clear();
+                // if everything was executed, clear the read buffer, unless the last result still
+                // points into it, in which case it gets reset on the next read
+                if(read_pinned) {
+                    read_offset = read_buffer.size();
+                } else {
+                    dbgf(LOG_DEBUG, "%s; reset read offset to 0\n", name().c_str());
+                    read_offset = 0;
+                    read_buffer.clear();
+                }
                 break;
             }
 
@@ -184,12 +191,64 @@ namespace s90 {
         } while(!cycle);
     }
 
+    bool afd::buffer_append(std::string_view data) {
+        size_t unread = read_buffer.size() - read_offset;
+        if(unread == 0 && !read_pinned) {
+            read_offset = 0;
+            read_buffer.clear();
+        }
+        if(unread + data.size() > read_limit) [[unlikely]] {
+            return false;
+        }
+        if(read_buffer.capacity() - read_buffer.size() < data.size()) {
+            size_t required = unread + data.size();
+            if(!read_pinned && read_offset > 0 && required <= read_buffer.capacity() / 2) {
+                // plenty of space is taken by already consumed data, move the unread rest to the front
+                std::memmove(read_buffer.data(), read_buffer.data() + read_offset, unread);
+                read_buffer.resize(unread);
+                read_offset = 0;
+            } else {
+                // otherwise move the unread rest to a new buffer, if there is read_n waiting, make it
+                // large enough for it right away so large bodies don't get copied over and over, with room
+                // for one more read, as the one that completes the body usually brings the next request too
+                size_t capacity = std::max(required * 2, read_min_capacity);
+                if(!read_commands.empty() && read_commands.front().type == read_command_type::n && read_commands.front().n > required) {
+                    capacity = read_commands.front().n + std::max(data.size(), read_min_capacity);
+                }
+                std::vector<char> next;
+                next.reserve(std::min(capacity, read_limit));
+                next.insert(next.end(), read_buffer.begin() + read_offset, read_buffer.end());
+                if(read_pinned) {
+                    // views from the last read still point into the old buffer, keep it alive
+                    read_retired.emplace_back(std::move(read_buffer));
+                }
+                read_buffer = std::move(next);
+                read_offset = 0;
+            }
+        }
+        read_buffer.insert(read_buffer.end(), data.begin(), data.end());
+        return true;
+    }
+
+    void afd::buffer_release() {
+        read_pinned = false;
+        if(!read_retired.empty()) read_retired.clear();
+        if(read_offset == read_buffer.size()) {
+            read_offset = 0;
+            if(read_buffer.capacity() > read_shrink_threshold) {
+                std::vector<char>().swap(read_buffer);
+            } else {
+                read_buffer.clear();
+            }
+        }
+    }
+
     void afd::on_write(size_t written_bytes) {
         if(is_closed()) [[unlikely]] return;
         for(;;) {
 
             int do_write = written_bytes == 0;
-            write_back_offset += written_bytes;
+            write_consume(written_bytes);
             
             // make sure we iterate over every promise to check the fullfilment
             while(!write_back_buffer_info.empty()) {
@@ -213,10 +272,12 @@ namespace s90 {
                 }
             }
             
-            if(write_back_offset < write_back_buffer.size() && do_write) [[likely]] {
+            if(write_queued > 0 && do_write) [[likely]] {
                 // perform any outstanding writes
                 auto [ok, _] = perform_write();
-                if(ok < 0) {
+                if(ok <= 0) {
+                    // nothing went out (EAGAIN), the socket is already armed for writability,
+                    // the next writable event gets us back here
                     break;
                 } else {
                     written_bytes = (size_t)ok;
@@ -226,9 +287,26 @@ namespace s90 {
             }
         }
 
-        if(write_back_buffer_info.size() == 0) [[unlikely]] {
-            write_back_buffer.clear();
-            write_back_offset = 0;
+        // release anyone waiting for the queue to drain
+        while(!write_waiters.empty() && write_queued <= write_low_watermark && !is_closed()) {
+            auto waiter = write_waiters.front();
+            write_waiters.pop();
+            if(auto p = waiter.lock())
+                aiopromise(p).resolve(true);
+        }
+    }
+
+    void afd::write_consume(size_t written_bytes) {
+        write_queued -= std::min(written_bytes, write_queued);
+        while(!write_segments.empty()) {
+            auto& segment = write_segments.front();
+            size_t remaining = segment.size();
+            if(written_bytes < remaining) {
+                segment.offset += written_bytes;
+                break;
+            }
+            written_bytes -= remaining;
+            write_segments.pop_front();
         }
     }
 
@@ -280,8 +358,14 @@ namespace s90 {
             if(auto p = item.promise.lock())
                 aiopromise(p).resolve(false);
         }
-        write_back_offset = 0;
-        write_back_buffer.clear();
+        while(!write_waiters.empty()) {
+            auto item = write_waiters.front();
+            write_waiters.pop();
+            if(auto p = item.lock())
+                aiopromise(p).resolve(false);
+        }
+        write_queued = 0;
+        write_segments.clear();
         read_buffer.clear();
     }
 
@@ -309,6 +393,8 @@ namespace s90 {
         if(is_closed()) [[unlikely]] {
             promise.resolve({true, ""});
         } else {
+            buffer_release();
+            cancellable(promise);
             read_commands.emplace(read_command(promise.weak(), read_command_type::any, 0, "", {}));
             if(read_buffer.size() > 0 && read_commands.size() == 1)
                 on_data("", true); // force the cycle if there is any previous remaining data to be read
@@ -318,10 +404,22 @@ namespace s90 {
 
     aiopromise<read_arg> afd::read_n(size_t n_bytes) {
         auto promise = aiopromise<read_arg>();
-        if(is_closed()) [[unlikely]] {
+        if(is_closed() || n_bytes > read_limit) [[unlikely]] {
             promise.resolve({true, ""});
         } else {
             dbgf(LOG_DEBUG, "%s; Insert READ %zu bytes command (%zu, %zu | %zu)\n", name().c_str(), n_bytes, read_buffer.size(), read_offset, read_commands.size());
+            buffer_release();
+            size_t unread = read_buffer.size() - read_offset;
+            if(read_commands.empty() && unread > 0 && unread >= n_bytes) [[likely]] {
+                // already buffered, resolve right away without queueing the command, so the
+                // promise never has to allocate its shared state
+                std::string_view arg(read_buffer.data() + read_offset, n_bytes);
+                read_offset += n_bytes;
+                read_pinned = true;
+                promise.resolve({false, arg});
+                return promise;
+            }
+            cancellable(promise);
             read_commands.emplace(read_command(promise.weak(), read_command_type::n, n_bytes, "", {}));
             if(read_buffer.size() > 0 && read_commands.size() == 1)
                 on_data("", true); // force the cycle if there is any previous remaining data to be read
@@ -336,6 +434,8 @@ namespace s90 {
         } else {
             std::vector<int64_t> pattern(delim.size() + 2, 0);
             build_kmp(delim.data(), delim.length(), pattern.data());
+            buffer_release();
+            cancellable(promise);
             read_commands.emplace(read_command(
                 promise.weak(), read_command_type::until, 0, std::move(delim), std::move(pattern)
             ));
@@ -350,6 +450,8 @@ namespace s90 {
         if(is_closed()) [[unlikely]] {
             promise.resolve({true, ""});
         } else {
+            buffer_release();
+            cancellable(promise);
             read_commands.emplace(read_command(
                 promise.weak(), read_command_type::until, 0, std::move(delim), {}, pattern_ref
             ));
@@ -360,52 +462,73 @@ namespace s90 {
     }
 
     std::tuple<int, bool> afd::perform_write() {
-        size_t buffer_size = write_back_buffer.size();
-        size_t to_write = buffer_size - write_back_offset;
-        int ok = s80_write(ctx, elfd, fd, fd_type, write_back_buffer.data(), write_back_offset, buffer_size);
-        if(ok < 0) {
-            closed = close_state::closing;
-            //close(true);
-            return std::make_tuple(ok, false);
-        } else [[likely]] {
-            return std::make_tuple(ok, (size_t)ok == to_write);
+        s80_iovec iov[S80_IOV_MAX];
+        size_t total = 0;
+        auto it = write_segments.begin();
+        // flush everything in batches of IOV_MAX until either the queue or the OS send buffer is full,
+        // anything that was written is consumed later by on_write
+        while(it != write_segments.end() && total < INT_MAX / 2) {
+            int ok = 0;
+            size_t batch = 0;
+            if(it->file) {
+                // file segments are sent on their own, the buffers around them are gathered as usual
+                batch = std::min(it->size(), (size_t)INT_MAX / 2);
+                ok = s80_sendfile(ctx, elfd, fd, fd_type, it->file->file, it->file->start + it->offset, batch);
+                it++;
+            } else {
+                int iovcnt = 0;
+                for(; it != write_segments.end() && !it->file && iovcnt < S80_IOV_MAX; it++) {
+                    auto view = it->view();
+                    if(view.empty()) continue;
+                    iov[iovcnt].iov_base = (void*)view.data();
+                    iov[iovcnt].iov_len = view.size();
+                    batch += view.size();
+                    iovcnt++;
+                }
+                if(iovcnt == 0) continue;
+                ok = s80_writev(ctx, elfd, fd, fd_type, iov, iovcnt);
+            }
+            if(ok < 0) {
+                closed = close_state::closing;
+                //close(true);
+                return std::make_tuple(ok, false);
+            }
+            total += (size_t)ok;
+            if((size_t)ok < batch) break;
         }
+        return std::make_tuple((int)total, total == write_queued);
     }
 
     std::string_view afd::get_data() {
         return std::string_view(read_buffer.data(), read_buffer.size());
     }
 
-    aiopromise<bool> afd::write(std::string_view data, bool layers) {
-        std::vector<char> encoded;
-        aiopromise<bool> promise = aiopromise<bool>();
+    void afd::set_read_limit(size_t limit) {
+        read_limit = limit;
+    }
 
-        if(layers && (ssl_status == ssl_state::client_ready || ssl_status == ssl_state::server_ready)) {
-            dbgf(LOG_INFO, "SSL encode\n");
-            char buf[4000];
-            int ssl_write = crypto_ssl_write(ssl_bio, data.data(), data.length());
-            dbgf(LOG_INFO, "SSL write (%zu -> %d)\n", data.length(), ssl_write);
-            while(ssl_write >= 0) {
-                int ssl_read = crypto_ssl_bio_read(ssl_bio, buf, sizeof(buf));
-                dbgf(LOG_INFO, "SSL write - chunk %d\n", ssl_read);
-                if(ssl_read > 0) {
-                    encoded.insert(encoded.end(), buf, buf + ssl_read);
-                } else {
-                    break;
-                }
+    std::string afd::ssl_encode(std::string_view data) {
+        std::string encoded;
+        dbgf(LOG_INFO, "SSL encode\n");
+        char buf[4000];
+        int ssl_write = crypto_ssl_write(ssl_bio, data.data(), data.length());
+        dbgf(LOG_INFO, "SSL write (%zu -> %d)\n", data.length(), ssl_write);
+        while(ssl_write >= 0) {
+            int ssl_read = crypto_ssl_bio_read(ssl_bio, buf, sizeof(buf));
+            dbgf(LOG_INFO, "SSL write - chunk %d\n", ssl_read);
+            if(ssl_read > 0) {
+                encoded.append(buf, buf + ssl_read);
+            } else {
+                break;
             }
-            data = std::string_view(encoded.data(), encoded.data() + encoded.size());
         }
-        
-        if(is_closed()) [[unlikely]] {
-            dbgf(LOG_INFO, "Tried to write to closed FD (%s)!\n", name().c_str());
-            promise.resolve(false);
-            return promise;
-        }
-        
-        // extend the write buffer with string view and add new promise to the queue
-        write_back_buffer.insert(write_back_buffer.end(), data.begin(), data.end());
-        write_back_buffer_info.emplace(back_buffer(promise.weak(), data.size(), 0));
+        return encoded;
+    }
+
+    aiopromise<bool> afd::enqueue_write(size_t length) {
+        aiopromise<bool> promise = aiopromise<bool>();
+        write_queued += length;
+        write_back_buffer_info.emplace(back_buffer(promise.weak(), length, 0));
         
         if(write_back_buffer_info.size() == 1) [[likely]] {
             // if the item we added is the only single item in the queue, force the write immediately
@@ -414,18 +537,142 @@ namespace s90 {
                 // on_write is triggered only when socket becomes available again, but not when we send
                 // new data right away, so force call on_write in here with sent length
                 on_write((size_t)ok);
+            } else if(length == 0 && ok == 0) {
+                on_write(0);
             }
+        }
+        return promise;
+    }
+
+    aiopromise<bool> afd::write(std::string_view data, bool layers) {
+        if(layers && (ssl_status == ssl_state::client_ready || ssl_status == ssl_state::server_ready)) {
+            return write(ssl_encode(data), false);
+        }
+        
+        if(is_closed()) [[unlikely]] {
+            dbgf(LOG_INFO, "Tried to write to closed FD (%s)!\n", name().c_str());
+            aiopromise<bool> promise = aiopromise<bool>();
+            promise.resolve(false);
             return promise;
+        }
+        
+        // caller keeps the ownership of data, so it has to be copied, small writes are merged
+        // into the last queued segment so they don't end up as separate iovecs
+        if(!write_segments.empty() && write_segments.back().appendable(data.size(), write_coalesce_limit)) {
+            write_segments.back().owned.append(data);
         } else {
-            return promise;
+            write_segments.emplace_back(write_segment { std::string(data), nullptr, 0 });
+        }
+        return enqueue_write(data.size());
+    }
+
+    aiopromise<bool> afd::write(std::string&& data, bool layers) {
+        if(layers && (ssl_status == ssl_state::client_ready || ssl_status == ssl_state::server_ready)) {
+            return write(ssl_encode(data), false);
+        }
+
+        if(data.size() < write_coalesce_limit / 4 || is_closed()) {
+            // merging small buffers is cheaper than queueing them separately
+            return write(std::string_view(data), false);
+        }
+
+        size_t length = data.size();
+        write_segments.emplace_back(write_segment { std::move(data), nullptr, 0 });
+        return enqueue_write(length);
+    }
+
+    aiopromise<bool> afd::write(ptr<const std::string> data, bool layers) {
+        if(!data || (layers && (ssl_status == ssl_state::client_ready || ssl_status == ssl_state::server_ready))) {
+            return write(data ? std::string_view(*data) : std::string_view(), layers);
+        }
+
+        if(data->size() < write_coalesce_limit / 4 || is_closed()) {
+            return write(std::string_view(*data), false);
         }
+
+        size_t length = data->size();
+        write_segments.emplace_back(write_segment { std::string(), std::move(data), 0 });
+        return enqueue_write(length);
+    }
+
+    aiopromise<bool> afd::write(std::vector<std::string>&& segments, bool layers) {
+        if(layers && (ssl_status == ssl_state::client_ready || ssl_status == ssl_state::server_ready)) {
+            std::string encoded;
+            for(const auto& data : segments) encoded += ssl_encode(data);
+            return write(std::move(encoded), false);
+        }
+
+        if(is_closed()) [[unlikely]] {
+            return write(std::string_view(), false);
+        }
+
+        // large buffers are queued as they are, small ones are merged so they don't end up as separate iovecs,
+        // then it's all written with one writev as far as the socket takes it
+        size_t length = 0;
+        for(auto& data : segments) {
+            if(data.empty()) continue;
+            length += data.size();
+            if(data.size() < write_coalesce_limit / 4 && !write_segments.empty() && write_segments.back().appendable(data.size(), write_coalesce_limit)) {
+                write_segments.back().owned.append(data);
+            } else {
+                write_segments.emplace_back(write_segment { std::move(data), nullptr, 0 });
+            }
+        }
+        return enqueue_write(length);
+    }
+
+    aiopromise<bool> afd::write_file(int file, uint64_t offset, size_t length, bool layers) {
+        auto region = ptr_new<file_region>(file, offset, length);
+        if(is_closed() || length == 0) {
+            return write(std::string_view(), false);
+        }
+
+        if(layers && (ssl_status == ssl_state::client_ready || ssl_status == ssl_state::server_ready)) {
+            // TLS needs the contents in user space anyway, so the file is read as it is
+            std::string contents(length, '\0');
+            size_t read = 0;
+            while(read < length) {
+#ifdef _WIN32
+                int n = _lseeki64(file, (__int64)(offset + read), SEEK_SET) < 0 ? -1 : _read(file, contents.data() + read, (unsigned int)std::min(length - read, (size_t)INT_MAX));
+#else
+                auto n = pread(file, contents.data() + read, length - read, (off_t)(offset + read));
+#endif
+                if(n <= 0) {
+                    aiopromise<bool> promise = aiopromise<bool>();
+                    promise.resolve(false);
+                    return promise;
+                }
+                read += (size_t)n;
+            }
+            return write(std::move(contents), layers);
+        }
+
+        write_segments.emplace_back(write_segment { std::string(), nullptr, 0, std::move(region) });
+        return enqueue_write(length);
+    }
+
+    aiopromise<bool> afd::wait_writable() {
+        aiopromise<bool> promise = aiopromise<bool>();
+        if(is_closed()) [[unlikely]] {
+            promise.resolve(false);
+        } else if(write_queued < write_high_watermark) [[likely]] {
+            promise.resolve(true);
+        } else {
+            write_waiters.emplace(promise.weak());
+        }
+        return promise;
+    }
+
+    void afd::set_write_watermarks(size_t low, size_t high) {
+        write_low_watermark = std::min(low, high);
+        write_high_watermark = high;
     }
 
     fd_meminfo afd::usage() const {
         return {
             {read_buffer.size(), read_buffer.capacity(), read_offset},
             {read_commands.size(), read_commands.size(), 0},
-            {write_back_buffer.size(), write_back_buffer.capacity(), write_back_offset},
+            {write_queued, write_queued, 0},
             {write_back_buffer_info.size(), write_back_buffer_info.size(), 0}
         };
     }
@@ -477,7 +724,9 @@ namespace s90 {
             }
 
             if(crypto_ssl_is_init_finished(ssl_bio)) {
-                ssl_cycle(read_buffer);
+                std::vector<char> decoded;
+                ssl_cycle(decoded);
+                buffer_append(std::string_view(decoded.data(), decoded.size()));
                 ssl_status = ssl_state::client_ready;
                 co_return {false, ""};
             }
@@ -495,7 +744,9 @@ namespace s90 {
                 crypto_ssl_bio_write(ssl_bio, arg.data.data(), arg.data.length());
             }
         }
-        ssl_cycle(read_buffer);
+        std::vector<char> decoded;
+        ssl_cycle(decoded);
+        buffer_append(std::string_view(decoded.data(), decoded.size()));
         ssl_status = ssl_state::client_ready;
         co_return {false, ""};
     }
@@ -547,7 +798,9 @@ namespace s90 {
                 }
             }
         }
-        ssl_cycle(read_buffer);
+        std::vector<char> decoded;
+        ssl_cycle(decoded);
+        buffer_append(std::string_view(decoded.data(), decoded.size()));
         ssl_status = ssl_state::server_ready;
         co_return {false, ""};
     }
@@ -606,6 +859,10 @@ namespace s90 {
         return s80_set_recv_timeout(fd, timeo);
     }
 
+    int afd::set_nodelay(bool nodelay) {
+        return s80_set_nodelay(fd, nodelay ? 1 : 0);
+    }
+
     
     void afd::set_remote_addr(const std::string& ip, int port) {
         remote_ip = ip;
@@ -3,6 +3,7 @@
 #include "aiopromise.hpp"
 #include "util/aiolock.hpp"
 
+#include <deque>
 #include <list>
 #include <queue>
 #include <string>
@@ -14,6 +15,15 @@ namespace s90 {
 
     class context;
 
+    /// @brief Default hard limit of unread data buffered per file descriptor
+    constexpr size_t default_read_limit = 64 * 1024 * 1024;
+
+    /// @brief Default amount of queued outgoing data above which wait_writable suspends
+    constexpr size_t default_write_high_watermark = 1024 * 1024;
+
+    /// @brief Default amount of queued outgoing data at which suspended wait_writable resumes
+    constexpr size_t default_write_low_watermark = 256 * 1024;
+
     enum class close_state {
         open,
         closing,
@@ -96,6 +106,51 @@ namespace s90 {
         /// @return true on success
         virtual aiopromise<bool> write(std::string_view data, bool layers = true) = 0;
 
+        /// @brief Write data to the file descriptor, taking ownership of the buffer so it's sent without copying
+        /// @param data data to be written
+        /// @param layers if true, apply additional layers such as TLS
+        /// @return true on success
+        virtual aiopromise<bool> write(std::string&& data, bool layers = true) = 0;
+
+        /// @brief Write shared buffer to the file descriptor without copying, buffer is kept alive until it's sent
+        /// @param data data to be written
+        /// @param layers if true, apply additional layers such as TLS
+        /// @return true on success
+        virtual aiopromise<bool> write(ptr<const std::string> data, bool layers = true) = 0;
+
+        /// @brief Write several buffers at once without joining them, they go out in a single gather write
+        /// @param segments buffers to be written in order, ownership is taken so they're sent without copying
+        /// @param layers if true, apply additional layers such as TLS
+        /// @return true on success
+        virtual aiopromise<bool> write(std::vector<std::string>&& segments, bool layers = true) = 0;
+
+        /// @brief Write part of a file, the kernel sends it straight from the page cache where it can (sendfile),
+        /// with TLS it's read and encoded instead
+        /// @param file open file, ownership is taken and it gets closed once it's sent
+        /// @param offset offset within the file
+        /// @param length number of bytes to be written
+        /// @param layers if true, apply additional layers such as TLS
+        /// @return true on success
+        virtual aiopromise<bool> write_file(int file, uint64_t offset, size_t length, bool layers = true) = 0;
+
+        /// @brief Write C string to the file descriptor
+        /// @param data data to be written
+        /// @param layers if true, apply additional layers such as TLS
+        /// @return true on success
+        aiopromise<bool> write(const char *data, bool layers = true) {
+            return write(std::string_view(data), layers);
+        }
+
+        /// @brief Wait until write queue has room, resolves right away if less than high watermark
+        /// is queued, otherwise once the queue drains down to low watermark
+        /// @return true if writeable, false if fd was closed
+        virtual aiopromise<bool> wait_writable() = 0;
+
+        /// @brief Set write queue watermarks used by wait_writable
+        /// @param low low watermark in bytes
+        /// @param high high watermark in bytes
+        virtual void set_write_watermarks(size_t low, size_t high) = 0;
+
         /// @brief Get memory usage information
         /// @return memory usage
         virtual fd_meminfo usage() const = 0;
@@ -189,9 +244,18 @@ namespace s90 {
         /// @return 0 if success, < 0 if error
         virtual int set_timeout(int timeout) = 0;
 
+        /// @brief Send small writes right away instead of waiting for the previous ones to be acknowledged (Nagle)
+        /// @param nodelay true to disable Nagle's algorithm
+        /// @return 0 if success, < 0 if error
+        virtual int set_nodelay(bool nodelay) = 0;
+
         /// @brief Get raw data in recv buffer
         /// @return raw data
         virtual std::string_view get_data() = 0;
+
+        /// @brief Set hard limit of unread data kept in the recv buffer, exceeding it closes the fd
+        /// @param limit limit in bytes
+        virtual void set_read_limit(size_t limit) = 0;
     };
 
     class afd : public iafd {
@@ -241,22 +305,55 @@ namespace s90 {
             server_ready
         };
 
+        /// @brief Part of a file queued for writing, the file is closed with the last reference
+        struct file_region {
+            int file;
+            uint64_t start;
+            size_t length;
+            ~file_region();
+        };
+
+        struct write_segment {
+            std::string owned;
+            ptr<const std::string> shared;
+            size_t offset = 0;
+            ptr<file_region> file = nullptr;
+
+            std::string_view view() const {
+                return std::string_view(shared ? *shared : owned).substr(offset);
+            }
+
+            size_t size() const {
+                return file ? file->length - offset : view().size();
+            }
+
+            bool appendable(size_t length, size_t limit) const {
+                return !shared && !file && owned.size() + length <= limit;
+            }
+        };
+
         struct kmp_state {
-            int offset = 0,
-                match = 0,
-                pivot = 0;
+            // where the delimiter search of the pending read_until resumes in the unread data
+            size_t offset = 0;
         };
 
-        size_t write_back_offset = 0;
         void *ssl_bio = NULL;
         ssl_state ssl_status = ssl_state::none;
-        std::vector<char> write_back_buffer;
+        size_t write_queued = 0;
+        size_t write_low_watermark = default_write_low_watermark;
+        size_t write_high_watermark = default_write_high_watermark;
+        std::deque<write_segment> write_segments;
         std::queue<back_buffer> write_back_buffer_info;
+        std::queue<aiopromise<bool>::weak_type> write_waiters;
         util::aiolock internal_lock;
 
         size_t read_offset = 0;
+        size_t read_limit = default_read_limit;
+        bool read_pinned = false;
         kmp_state delim_state;
         std::vector<char> read_buffer;
+        // buffers replaced while views into them were still handed out, kept until the next read
+        std::vector<std::vector<char>> read_retired;
         std::queue<read_command> read_commands;
         std::function<void()> on_command_queue_empty;
         dict<std::string, std::string> ud;
@@ -266,8 +363,14 @@ namespace s90 {
         bool was_accepted_ = false;
 
         void handle_failure();
+        void cancellable(aiopromise<read_arg>& promise);
         void ssl_cycle(std::vector<char>& decoded);
+        bool buffer_append(std::string_view data);
+        void buffer_release();
         std::tuple<int, bool> perform_write();
+        std::string ssl_encode(std::string_view data);
+        aiopromise<bool> enqueue_write(size_t length);
+        void write_consume(size_t written_bytes);
 
     public:
         afd(context *ctx, fd_t elfd, fd_t fd, int fdtype);
@@ -288,7 +391,14 @@ namespace s90 {
         aiopromise<read_arg> read_n(size_t n_bytes) override;
         aiopromise<read_arg> read_until(std::string&& delim) override;
         aiopromise<read_arg> read_until(std::string&& delim, int64_t *pattern_ref) override;
+        using iafd::write;
         aiopromise<bool> write(std::string_view data, bool layers = true) override;
+        aiopromise<bool> write(std::string&& data, bool layers = true) override;
+        aiopromise<bool> write(ptr<const std::string> data, bool layers = true) override;
+        aiopromise<bool> write(std::vector<std::string>&& segments, bool layers = true) override;
+        aiopromise<bool> write_file(int file, uint64_t offset, size_t length, bool layers = true) override;
+        aiopromise<bool> wait_writable() override;
+        void set_write_watermarks(size_t low, size_t high) override;
         fd_meminfo usage() const override;
         std::string name() const override;
         void set_name(std::string_view name) override;
@@ -309,10 +419,12 @@ namespace s90 {
         std::tuple<std::string, int> remote_addr() const override;
 
         int set_timeout(int timeout) override;
+        int set_nodelay(bool nodelay) override;
 
         void set_remote_addr(const std::string& ip, int port) override;
 
         std::string_view get_data() override;
+        void set_read_limit(size_t limit) override;
     };
 
 }
\ No newline at end of file
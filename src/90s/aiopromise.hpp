@@ -1,10 +1,14 @@
 #pragma once
 #include "shared.hpp"
+#include "frame_arena.hpp"
+#include "tracing.hpp"
 #include <optional>
 #include <functional>
 #include <memory>
 #include <coroutine>
 #include <exception>
+#include <vector>
+#include <type_traits>
 
 namespace s90 {
 
@@ -19,122 +23,456 @@ namespace s90 {
     template<typename T>
     class aiopromise;
 
+    /// @brief Source of cancellation, everything subscribed to it gets cancelled at once, see aiopromise::cancel_on
+    class cancellation {
+        bool cancelled = false;
+        size_t next_id = 0;
+        std::vector<std::pair<size_t, std::function<void()>>> subscribers;
+    public:
+        /// @brief Called once the last subscriber unsubscribes, so whoever fires the token can forget it
+        std::function<void()> on_idle;
+
+        bool is_cancelled() const {
+            return cancelled;
+        }
+
+        /// @brief Call the function once cancelled, right away if it is cancelled already
+        /// @param fn function
+        /// @return subscription id for unsubscribe
+        size_t subscribe(std::function<void()> fn) {
+            if(cancelled) {
+                fn();
+                return 0;
+            }
+            subscribers.emplace_back(++next_id, std::move(fn));
+            return next_id;
+        }
+
+        /// @brief Drop a subscription that's no longer of use, i.e. of a promise that resolved
+        /// @param id subscription id
+        void unsubscribe(size_t id) {
+            if(cancelled) return;
+            std::erase_if(subscribers, [id](const auto& subscriber) { return subscriber.first == id; });
+            if(subscribers.empty() && on_idle) {
+                auto fn = std::move(on_idle);
+                on_idle = nullptr;
+                fn();
+            }
+        }
+
+        void cancel() {
+            if(cancelled) return;
+            cancelled = true;
+            on_idle = nullptr;
+            auto current = std::move(subscribers);
+            subscribers.clear();
+            for(auto& [_, fn] : current) fn();
+        }
+    };
+
+    /// @brief Type independent part of the promise state, lifetime and cancellation
+    struct aiopromise_state_base {
+        unsigned refs = 0;
+        unsigned weak_refs = 0;
+        /// @brief promise was resolved, any later resolution is ignored
+        bool settled = false;
+        /// @brief state the coroutine owning this state is currently suspended on
+        aiopromise_state_base *awaiting = nullptr;
+        /// @brief hook of the resolving side that aborts the pending operation
+        std::function<void()> canceller;
+        /// @brief hook dropping subscriptions to cancellation tokens once they can't matter anymore
+        std::function<void()> unsubscribe;
+        void (*dispose)(aiopromise_state_base*) = nullptr;
+        void (*clear)(aiopromise_state_base*) = nullptr;
+
+        void release() {
+            if(--refs > 0) return;
+            forget_tokens();
+            if(weak_refs == 0) {
+                dispose(this);
+            } else {
+                // nobody can observe the result anymore, don't keep it alive for the weak references
+                canceller = nullptr;
+                clear(this);
+            }
+        }
+
+        void release_weak() {
+            if(--weak_refs == 0 && refs == 0) dispose(this);
+        }
+
+        /// @brief Unsubscribe from cancellation tokens, called once settled
+        void forget_tokens() {
+            if(!unsubscribe) return;
+            auto fn = std::move(unsubscribe);
+            unsubscribe = nullptr;
+            fn();
+        }
+
+        /// @brief Abort the pending operation and whatever the owning coroutine waits for
+        void cancel() {
+            refs++;
+            auto fn = std::move(canceller);
+            canceller = nullptr;
+            if(fn) fn();
+            if(awaiting) awaiting->cancel();
+            release();
+        }
+    };
+
+    /// @brief State shared between a pending promise and whoever is going to resolve it. It is
+    /// reference counted intrusively and never crosses threads, so the counters are plain integers.
+    /// Coroutines returning aiopromise embed it in their own frame, other promises allocate it
+    /// only once they are actually about to wait (see aiopromise::weak)
     template<typename T>
-    struct aiopromise_state {
+    struct aiopromise_state : public aiopromise_state_base {
         bool has_result = false;
         T result;
         std::coroutine_handle<> coro_callback = nullptr;
         std::exception_ptr exception = nullptr;
+
+        aiopromise_state() {
+            dispose = [](aiopromise_state_base *state) {
+                delete static_cast<aiopromise_state<T>*>(state);
+            };
+            clear = [](aiopromise_state_base *state) {
+                auto self = static_cast<aiopromise_state<T>*>(state);
+                self->result = T();
+                self->exception = nullptr;
+                self->coro_callback = nullptr;
+            };
+        }
+
+        void resolve(T&& value) {
+            if(settle(std::move(value))) resume();
+        }
+
+        /// @brief Store the result without resuming the waiting coroutine yet
+        /// @param value result
+        /// @return false if the promise was settled already
+        bool settle(T&& value) {
+            if(settled) return false;
+            settled = true;
+            canceller = nullptr;
+            result = std::move(value);
+            has_result = true;
+            forget_tokens();
+            return true;
+        }
+
+        void resume() {
+            if(coro_callback) {
+                auto cb = coro_callback;
+                coro_callback = nullptr;
+                if(tracing::enabled()) [[unlikely]] {
+                    // resumed coroutine switches to its own span, the resuming side gets its own back
+                    auto ctx = tracing::current();
+                    cb();
+                    tracing::current() = ctx;
+                } else {
+                    cb();
+                }
+            }
+        }
+    };
+
+    /// @brief Strong reference to aiopromise state
+    template<typename T>
+    class aiopromise_ref {
+        aiopromise_state<T> *s = nullptr;
+    public:
+        aiopromise_ref() {}
+        explicit aiopromise_ref(aiopromise_state<T> *state) : s(state) { if(s) s->refs++; }
+        aiopromise_ref(const aiopromise_ref& other) : aiopromise_ref(other.s) {}
+        aiopromise_ref(aiopromise_ref&& other) noexcept : s(other.s) { other.s = nullptr; }
+        ~aiopromise_ref() { if(s) s->release(); }
+
+        aiopromise_ref& operator=(aiopromise_ref other) noexcept {
+            std::swap(s, other.s);
+            return *this;
+        }
+
+        aiopromise_state<T>* get() const { return s; }
+        aiopromise_state<T>* operator->() const { return s; }
+        explicit operator bool() const { return s != nullptr; }
+    };
+
+    /// @brief Weak reference to aiopromise state, used by the resolving side, so promises
+    /// nobody waits for anymore are not kept alive
+    template<typename T>
+    class aiopromise_weak {
+        aiopromise_state<T> *s = nullptr;
+    public:
+        aiopromise_weak() {}
+        explicit aiopromise_weak(aiopromise_state<T> *state) : s(state) { if(s) s->weak_refs++; }
+        aiopromise_weak(const aiopromise_weak& other) : aiopromise_weak(other.s) {}
+        aiopromise_weak(aiopromise_weak&& other) noexcept : s(other.s) { other.s = nullptr; }
+        ~aiopromise_weak() { if(s) s->release_weak(); }
+
+        aiopromise_weak& operator=(aiopromise_weak other) noexcept {
+            std::swap(s, other.s);
+            return *this;
+        }
+
+        /// @brief Obtain a strong reference
+        /// @return reference, empty if the promise is gone already
+        aiopromise_ref<T> lock() const {
+            if(s && s->refs > 0) return aiopromise_ref<T>(s);
+            return aiopromise_ref<T>();
+        }
+
+        bool expired() const { return !s || s->refs == 0; }
     };
 
     template<typename T>
     class aiopromise {
     public:
-        using weak_type = wptr<aiopromise_state<T>>;
-        using shared_type = ptr<aiopromise_state<T>>;
+        using weak_type = aiopromise_weak<T>;
+        using shared_type = aiopromise_ref<T>;
 
-        struct promise_type {
-            ptr<aiopromise_state<T>> state;
+        struct promise_type : public aiopromise_state<T> {
+            /// @brief span of the caller, restored whenever the coroutine suspends, so the caller
+            /// continues in its own span after the coroutine returns the control for the first time
+            tracing::span_context trace_origin;
 
-            promise_type() : state(ptr_new<aiopromise_state<T>>()) {}
-            promise_type(const shared_type& c) : state(c) {}
+            promise_type() {
+                if(tracing::enabled()) [[unlikely]] trace_origin = tracing::current();
+                // reference held by the running coroutine, released at the final suspend point
+                this->refs = 1;
+                this->dispose = [](aiopromise_state_base *state) {
+                    auto self = static_cast<promise_type*>(static_cast<aiopromise_state<T>*>(state));
+                    std::coroutine_handle<promise_type>::from_promise(*self).destroy();
+                };
+            }
+
+            static void *operator new(size_t size) {
+                return frame_arena::local().allocate(size);
+            }
+
+            static void operator delete(void *ptr, size_t size) {
+                frame_arena::local().deallocate(ptr, size);
+            }
+
+            struct final_awaiter {
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept {
+                    // frame stays suspended as long as the result can still be read, last reference destroys it
+                    handle.promise().release();
+                }
+                void await_resume() const noexcept {}
+            };
 
             aiopromise<T> get_return_object() {
-                return aiopromise<T>(*this);
+                return aiopromise<T>(shared_type(this));
             }
 
             std::suspend_never initial_suspend() {
                 return {};
             }
 
-            std::suspend_never final_suspend() noexcept {
-                return {}; 
+            final_awaiter final_suspend() noexcept {
+                return {};
             }
 
             std::suspend_always yield_value(T&& value) {
-                state->result = std::move(value);
-                state->has_result = true;
+                this->result = std::move(value);
+                this->has_result = true;
                 return {};
             }
 
             void return_value(T&& value) {
-                state->result = std::move(value);
-                state->has_result = true;
-                if(state->coro_callback) {
-                    auto cb = std::move(state->coro_callback);
-                    state->coro_callback = nullptr;
-                    cb();
-                }
+                this->resolve(std::move(value));
             }
 
-            void unhandled_exception() const noexcept {
-                state->exception = std::current_exception();
+            void unhandled_exception() noexcept {
+                if(this->settled) return;
+                this->settled = true;
+                this->canceller = nullptr;
+                this->forget_tokens();
+                this->exception = std::current_exception();
                 try {
-                    if(state->exception) {
-                        std::rethrow_exception(state->exception);
+                    if(this->exception) {
+                        std::rethrow_exception(this->exception);
                     }
                 } catch(const std::exception& ex) {
                     printf("captured: %s\n", ex.what());
                 }
-                if(state->coro_callback) {
-                    auto cb = std::move(state->coro_callback);
-                    state->coro_callback = nullptr;
-                    cb();
-                }
+                this->resume();
             }
         };
 
-        promise_type p;
-
         aiopromise() { }
-        aiopromise(const promise_type& p) : p(p) { }
         aiopromise(const weak_type& w) : p(w.lock()) {}
         aiopromise(const shared_type& w) : p(w) {}
-        ~aiopromise() { 
-            
+        aiopromise(shared_type&& w) : p(std::move(w)) {}
+        aiopromise(aiopromise&& other) : p(std::move(other.p)), ready(std::move(other.ready)) {}
+        aiopromise(const aiopromise& other) : p(other.share()), ready(other.ready) {}
+
+        aiopromise& operator=(aiopromise&& other) {
+            p = std::move(other.p);
+            ready = std::move(other.ready);
+            return *this;
         }
 
-        ptr<aiopromise_state<T>> state() const {
-            return p.state;
+        aiopromise& operator=(const aiopromise& other) {
+            p = other.share();
+            ready = other.ready;
+            return *this;
+        }
+
+        shared_type state() const {
+            return p;
         }
 
         void resolve(T&& value) {
-            auto s = state();
-            s->result = std::move(value);
-            s->has_result = true;
-            if(s->coro_callback) {
-                auto cb = std::move(s->coro_callback);
-                s->coro_callback = nullptr;
-                cb();
+            if(p) {
+                p->resolve(std::move(value));
+            } else if(!ready) {
+                // nobody can be waiting yet, keep the value inline
+                ready.emplace(std::move(value));
+            }
+        }
+
+        /// @brief Check if the promise was resolved already, promises resolve only once
+        /// @return true if resolved
+        bool is_settled() const {
+            return ready.has_value() || (p && p->settled);
+        }
+
+        /// @brief Register how to abort the pending operation, used by whoever resolves the promise
+        /// @param value value to resolve the promise with, unless cleanup resolves it on its own
+        /// @param cleanup code releasing resources held by the operation
+        void on_cancel(T&& value, std::function<void()> cleanup = {}) {
+            materialize();
+            auto state = p.get();
+            state->canceller = [state, value = std::move(value), cleanup = std::move(cleanup)]() mutable {
+                if(cleanup) cleanup();
+                state->resolve(std::move(value));
+            };
+        }
+
+        /// @brief Cancel the promise, waiting coroutine continues right away with the value and the cancellation
+        /// is passed down to the operation, or to whatever the coroutine behind this promise is waiting for
+        /// @param value value to resolve the promise with
+        void cancel(T&& value) {
+            if(!p) {
+                resolve(std::move(value));
+                return;
             }
+            if(p->settled) return;
+            auto state = p;
+            auto fn = std::move(state->canceller);
+            state->canceller = nullptr;
+            state->settle(std::move(value));
+            // the operation is aborted before the waiting coroutine continues, the coroutine may
+            // drop the last reference to whatever the cleanup refers to
+            if(fn) fn();
+            if(state->awaiting) state->awaiting->cancel();
+            state->resume();
+        }
+
+        /// @brief Cancel the promise once the token gets cancelled
+        /// @param token cancellation token, i.e. icontext::deadline
+        /// @param value value to resolve the promise with, i.e. an error
+        /// @return self
+        aiopromise& cancel_on(const ptr<cancellation>& token, T&& value) {
+            if(is_settled()) return *this;
+            auto id = token->subscribe([w = weak(), value = std::move(value)]() mutable {
+                if(auto state = w.lock()) aiopromise(state).cancel(std::move(value));
+            });
+            if(id == 0) return *this;
+            // once settled, the token has nothing to cancel here anymore and may be dropped early
+            auto previous = std::move(p->unsubscribe);
+            p->unsubscribe = [token, id, previous = std::move(previous)]() {
+                token->unsubscribe(id);
+                if(previous) previous();
+            };
+            return *this;
         }
 
         bool has_exception() const {
-            return state()->exception != nullptr;
+            return p && p->exception != nullptr;
         }
 
-        std::exception_ptr&& exception() const {
-            return std::move(state()->exception);
+        std::exception_ptr exception() const {
+            if(!p) return nullptr;
+            return std::move(p->exception);
         }
 
         bool await_ready() const {
-            return state()->has_result;
+            return ready.has_value() || (p && p->has_result);
         }
 
-        void await_suspend(std::coroutine_handle<> resume) {
-            state()->coro_callback = resume;
+        template<typename P>
+        void await_suspend(std::coroutine_handle<P> resume) {
+            materialize();
+            p->coro_callback = resume;
+            if constexpr(std::is_base_of_v<aiopromise_state_base, P>) {
+                // remember what the coroutine waits for, so cancelling it can be passed down
+                waiter = &resume.promise();
+                waiter->awaiting = p.get();
+            }
+            if(tracing::enabled()) [[unlikely]] {
+                auto& ctx = tracing::current();
+                trace = ctx;
+                traced = true;
+                if constexpr(requires { resume.promise().trace_origin; }) {
+                    ctx = resume.promise().trace_origin;
+                }
+            }
         }
 
-        T&& await_resume() const {
-            auto s = state();
-            s->has_result = false;
-            return std::move(s->result);
+        T&& await_resume() {
+            if(waiter) {
+                waiter->awaiting = nullptr;
+                waiter = nullptr;
+            }
+            if(traced) [[unlikely]] {
+                tracing::current() = trace;
+                traced = false;
+            }
+            if(ready) {
+                return std::move(*ready);
+            }
+            p->has_result = false;
+            return std::move(p->result);
+        }
+
+        weak_type weak() const {
+            materialize();
+            return weak_type(p.get());
         }
 
-        wptr<aiopromise_state<T>> weak() const {
-            return p.state;
+    private:
+        mutable shared_type p;
+        mutable std::optional<T> ready;
+        aiopromise_state_base *waiter = nullptr;
+        tracing::span_context trace;
+        bool traced = false;
+
+        /// @brief Allocate the shared state, from now on the promise can be resolved from elsewhere
+        void materialize() const {
+            if(p) return;
+            p = shared_type(new aiopromise_state<T>());
+            if(ready) {
+                p->result = std::move(*ready);
+                p->has_result = true;
+                p->settled = true;
+                ready.reset();
+            }
         }
 
+        shared_type share() const {
+            // copies of a promise that is still pending must resolve together
+            if(!ready) materialize();
+            return p;
+        }
     };
 
-}
\ No newline at end of file
+    template<typename T>
+    aiopromise(const aiopromise_ref<T>&) -> aiopromise<T>;
+
+    template<typename T>
+    aiopromise(const aiopromise_weak<T>&) -> aiopromise<T>;
+
+}
@@ -0,0 +1,271 @@
+#include "connection_pool.hpp"
+#include <algorithm>
+
+namespace s90 {
+
+    pooled_connection::pooled_connection(wptr<connection_pool> owner, ptr<iafd> conn, bool was_reused)
+        : owner(std::move(owner)), conn(std::move(conn)), was_reused(was_reused) {}
+
+    pooled_connection::pooled_connection(pooled_connection&& other) noexcept
+        : owner(std::move(other.owner)), conn(std::move(other.conn)), broken(other.broken), was_reused(other.was_reused),
+          error(other.error), error_message(std::move(other.error_message)) {
+        other.conn = nullptr;
+    }
+
+    pooled_connection& pooled_connection::operator=(pooled_connection&& other) noexcept {
+        if(this != &other) {
+            release();
+            owner = std::move(other.owner);
+            conn = std::move(other.conn);
+            other.conn = nullptr;
+            broken = other.broken;
+            was_reused = other.was_reused;
+            error = other.error;
+            error_message = std::move(other.error_message);
+        }
+        return *this;
+    }
+
+    pooled_connection::~pooled_connection() {
+        release();
+    }
+
+    pooled_connection pooled_connection::with_error(std::string message) {
+        pooled_connection result;
+        result.error = true;
+        result.error_message = std::move(message);
+        return result;
+    }
+
+    void pooled_connection::release() {
+        if(!conn) return;
+        auto fd = std::move(conn);
+        conn = nullptr;
+        if(auto pool = owner.lock()) {
+            pool->give_back(fd, broken);
+        } else if(broken) {
+            fd->close();
+        }
+        owner.reset();
+    }
+
+    void pooled_connection::invalidate() {
+        broken = true;
+    }
+
+    connection_pool::connection_pool(std::string key, connection_factory factory, pool_options options, health_check checker)
+        : key(std::move(key)), factory(std::move(factory)), checker(std::move(checker)), options(options) {
+        if(this->options.max_connections == 0) this->options.max_connections = 1;
+        if(this->options.max_concurrency == 0) this->options.max_concurrency = 1;
+    }
+
+    connection_pool::~connection_pool() {
+        close();
+    }
+
+    aiopromise<pooled_connection> connection_pool::checkout() {
+        auto self = shared_from_this();
+        bool woken = false;
+        while(!closed) {
+            std::erase_if(waiters, [](const aiopromise<bool>::weak_type& w) {
+                auto p = w.lock();
+                return !p || p->settled;
+            });
+            // checkouts that were already waiting go first, newcomers can't jump the queue
+            if(woken || waiters.empty()) {
+                auto e = pick();
+                // a busy connection is shared only if there is no room for another one
+                if(e && (e->active == 0 || entries.size() >= options.max_connections)) {
+                    bool was_reused = e->uses > 0;
+                    e->active++;
+                    e->uses++;
+                    e->last_used = clock::now();
+                    if(was_reused) counters.reused++;
+                    co_return pooled_connection(weak_from_this(), e->fd, was_reused);
+                }
+                if(entries.size() < options.max_connections) {
+                    co_return co_await open();
+                }
+            }
+            if(options.max_waiters > 0 && waiters.size() >= options.max_waiters) {
+                co_return pooled_connection::with_error(errors::POOL_FULL);
+            }
+            aiopromise<bool> turn;
+            // cancelled checkout fails right away and is skipped once its turn comes
+            turn.on_cancel(false);
+            if(woken) {
+                waiters.push_front(turn.weak());
+            } else {
+                waiters.push_back(turn.weak());
+            }
+            if(!co_await turn) {
+                co_return pooled_connection::with_error(closed ? errors::POOL_CLOSED : errors::TIMEOUT);
+            }
+            woken = true;
+        }
+        co_return pooled_connection::with_error(errors::POOL_CLOSED);
+    }
+
+    ptr<connection_pool::entry> connection_pool::pick() {
+        prune();
+        ptr<entry> best;
+        for(auto& e : entries) {
+            if(e->connecting || e->checking || e->active >= options.max_concurrency) continue;
+            // least busy first, most recently used among equals, so the surplus connections
+            // stay idle and get evicted eventually
+            if(!best || e->active < best->active || (e->active == best->active && e->last_used > best->last_used)) {
+                best = e;
+            }
+        }
+        return best;
+    }
+
+    ptr<connection_pool::entry> connection_pool::find(const ptr<iafd>& fd) const {
+        for(auto& e : entries) {
+            if(e->fd == fd) return e;
+        }
+        return nullptr;
+    }
+
+    void connection_pool::remove(const ptr<entry>& e) {
+        auto it = std::find(entries.begin(), entries.end(), e);
+        if(it != entries.end()) entries.erase(it);
+        if(e->fd && !e->fd->is_closed()) e->fd->close();
+    }
+
+    void connection_pool::prune() {
+        std::erase_if(entries, [](const ptr<entry>& e) {
+            return !e->connecting && (!e->fd || e->fd->is_closed() || e->fd->is_error());
+        });
+    }
+
+    void connection_pool::wake() {
+        while(!waiters.empty()) {
+            auto first = waiters.front();
+            waiters.pop_front();
+            if(auto p = first.lock(); p && !p->settled) {
+                aiopromise(p).resolve(true);
+                return;
+            }
+        }
+    }
+
+    void connection_pool::give_back(const ptr<iafd>& fd, bool broken) {
+        auto e = find(fd);
+        if(!e) {
+            // pool was closed or the connection dropped meanwhile
+            if(!fd->is_closed()) fd->close();
+            return;
+        }
+        if(e->active > 0) e->active--;
+        e->last_used = clock::now();
+        if(broken || fd->is_closed() || fd->is_error()) {
+            if(broken) counters.discarded++;
+            remove(e);
+        }
+        wake();
+    }
+
+    aiopromise<pooled_connection> connection_pool::open() {
+        auto self = shared_from_this();
+        auto e = ptr_new<entry>();
+        e->connecting = true;
+        entries.push_back(e);
+        auto result = co_await factory();
+        e->connecting = false;
+        if(!result || closed) {
+            if(result && !result.fd->is_closed()) result.fd->close();
+            remove(e);
+            // the slot is free again, let the next waiter try on its own
+            wake();
+            if(closed) co_return pooled_connection::with_error(errors::POOL_CLOSED);
+            co_return pooled_connection::with_error(result.error_message.empty() ? "failed to connect" : result.error_message);
+        }
+        counters.created++;
+        e->fd = result.fd;
+        e->active = 1;
+        e->uses = 1;
+        e->last_used = e->last_checked = clock::now();
+        if(options.max_concurrency > 1) wake();
+        co_return pooled_connection(weak_from_this(), e->fd, false);
+    }
+
+    aiopromise<nil> connection_pool::replenish() {
+        auto self = shared_from_this();
+        while(!closed && entries.size() < options.min_connections) {
+            // lease is returned right away, so the connection ends up idle in the pool
+            auto conn = co_await open();
+            if(!conn) break;
+        }
+        co_return nil {};
+    }
+
+    aiopromise<nil> connection_pool::check(ptr<entry> e) {
+        auto self = shared_from_this();
+        e->checking = true;
+        bool ok = co_await checker(e->fd);
+        e->checking = false;
+        e->last_checked = clock::now();
+        if(!ok) {
+            counters.discarded++;
+            remove(e);
+        }
+        wake();
+        co_return nil {};
+    }
+
+    void connection_pool::maintain() {
+        if(closed) return;
+        prune();
+        auto now = clock::now();
+        auto idle_timeout = std::chrono::seconds(options.idle_timeout);
+        auto check_interval = std::chrono::seconds(options.health_check_interval);
+        // health checks may finish synchronously and modify the entries
+        auto current = entries;
+        size_t open_count = current.size();
+        for(auto& e : current) {
+            if(e->connecting || e->checking || e->active > 0) continue;
+            if(open_count > options.min_connections && now - e->last_used >= idle_timeout) {
+                counters.evicted++;
+                open_count--;
+                remove(e);
+            } else if(checker && options.health_check_interval > 0 && now - e->last_checked >= check_interval) {
+                check(e);
+            }
+        }
+        if(entries.size() < options.min_connections) {
+            replenish();
+        }
+    }
+
+    void connection_pool::close() {
+        if(closed) return;
+        closed = true;
+        auto current = std::move(entries);
+        entries.clear();
+        for(auto& e : current) {
+            if(e->fd && !e->fd->is_closed()) e->fd->close();
+        }
+        while(!waiters.empty()) {
+            auto first = waiters.front();
+            waiters.pop_front();
+            if(auto p = first.lock()) {
+                aiopromise(p).resolve(false);
+            }
+        }
+    }
+
+    pool_stats connection_pool::stats() const {
+        pool_stats result = counters;
+        result.open = entries.size();
+        for(auto& e : entries) {
+            if(e->connecting) result.connecting++;
+            else if(e->active > 0) result.busy++;
+        }
+        for(auto& w : waiters) {
+            if(!w.expired()) result.waiting++;
+        }
+        return result;
+    }
+
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include "shared.hpp"
+#include "afd.hpp"
+#include "aiopromise.hpp"
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+namespace s90 {
+
+    struct connect_result {
+        bool error;
+        ptr<iafd> fd;
+        std::string error_message;
+
+        explicit operator bool() const {
+            return !error && fd;
+        }
+
+        ptr<iafd>& operator*() {
+            return fd;
+        }
+
+        ptr<iafd> operator->() const {
+            return fd;
+        }
+    };
+
+    struct pool_options {
+        /// @brief connections kept open even when nobody uses them
+        size_t min_connections = 0;
+        /// @brief maximum of open connections, further checkouts wait for one to be returned
+        size_t max_connections = 8;
+        /// @brief how many leases a single connection can serve at once, more than 1 only makes
+        /// sense for protocols that can multiplex requests over one connection
+        size_t max_concurrency = 1;
+        /// @brief maximum of waiting checkouts, 0 means no limit
+        size_t max_waiters = 0;
+        /// @brief idle connections above min_connections are closed after this many seconds
+        int idle_timeout = 60;
+        /// @brief idle connections are health checked this often in seconds, 0 disables checks
+        int health_check_interval = 30;
+    };
+
+    struct pool_stats {
+        /// @brief connections that are open or being opened
+        size_t open = 0;
+        /// @brief connections being opened
+        size_t connecting = 0;
+        /// @brief connections with at least one lease
+        size_t busy = 0;
+        /// @brief checkouts waiting for a connection
+        size_t waiting = 0;
+        /// @brief connections opened so far
+        size_t created = 0;
+        /// @brief checkouts served by an already open connection
+        size_t reused = 0;
+        /// @brief connections closed for being idle for too long
+        size_t evicted = 0;
+        /// @brief connections closed because they failed a health check or were invalidated
+        size_t discarded = 0;
+    };
+
+    class connection_pool;
+
+    /// @brief Connection borrowed from a pool, it goes back to the pool once the lease is destroyed
+    class pooled_connection {
+        friend class connection_pool;
+
+        wptr<connection_pool> owner;
+        ptr<iafd> conn;
+        bool broken = false;
+        bool was_reused = false;
+
+        pooled_connection(wptr<connection_pool> owner, ptr<iafd> conn, bool was_reused);
+    public:
+        bool error = false;
+        std::string error_message;
+
+        pooled_connection() {}
+        pooled_connection(const pooled_connection&) = delete;
+        pooled_connection(pooled_connection&& other) noexcept;
+        pooled_connection& operator=(const pooled_connection&) = delete;
+        pooled_connection& operator=(pooled_connection&& other) noexcept;
+        ~pooled_connection();
+
+        static pooled_connection with_error(std::string message);
+
+        /// @brief Return the connection to the pool before the lease goes out of scope
+        void release();
+
+        /// @brief Mark connection as unusable, i.e. after a protocol error left the stream in an unknown
+        /// state, it gets closed instead of being returned to the pool
+        void invalidate();
+
+        /// @brief Check if the connection served some other lease before
+        /// @return true if the connection was reused
+        bool reused() const {
+            return was_reused;
+        }
+
+        explicit operator bool() const {
+            return !error && conn;
+        }
+
+        ptr<iafd>& operator*() {
+            return conn;
+        }
+
+        ptr<iafd> operator->() const {
+            return conn;
+        }
+    };
+
+    using connection_factory = std::function<aiopromise<connect_result>()>;
+    using health_check = std::function<aiopromise<bool>(ptr<iafd>)>;
+
+    /// @brief Pool of connections to a single upstream. Checkouts get the least busy open connection,
+    /// new connections are opened only when all of the existing ones are busy and the limit wasn't
+    /// reached yet, otherwise checkouts wait in FIFO order for a connection to be returned.
+    /// Pools are meant to be obtained from icontext::get_pool, which also drives maintain()
+    class connection_pool : public std::enable_shared_from_this<connection_pool> {
+        friend class pooled_connection;
+        using clock = std::chrono::steady_clock;
+
+        struct entry {
+            ptr<iafd> fd;
+            size_t active = 0;
+            size_t uses = 0;
+            bool connecting = false;
+            bool checking = false;
+            clock::time_point last_used;
+            clock::time_point last_checked;
+        };
+
+        std::string key;
+        connection_factory factory;
+        health_check checker;
+        pool_options options;
+        std::vector<ptr<entry>> entries;
+        std::deque<aiopromise<bool>::weak_type> waiters;
+        pool_stats counters;
+        bool closed = false;
+
+        ptr<entry> pick();
+        ptr<entry> find(const ptr<iafd>& fd) const;
+        void remove(const ptr<entry>& e);
+        void prune();
+        void wake();
+        void give_back(const ptr<iafd>& fd, bool broken);
+        aiopromise<pooled_connection> open();
+        aiopromise<nil> replenish();
+        aiopromise<nil> check(ptr<entry> e);
+
+    public:
+        connection_pool(std::string key, connection_factory factory, pool_options options = {}, health_check checker = {});
+        ~connection_pool();
+
+        /// @brief Borrow a connection
+        /// @return lease, check it for errors before use
+        aiopromise<pooled_connection> checkout();
+
+        /// @brief Drop dead and long idle connections, run health checks and open connections up to
+        /// min_connections, supposed to be called periodically
+        void maintain();
+
+        /// @brief Close all connections and fail all waiting checkouts
+        void close();
+
+        const std::string& name() const {
+            return key;
+        }
+
+        const pool_options& get_options() const {
+            return options;
+        }
+
+        pool_stats stats() const;
+    };
+
+}
@@ -84,19 +84,11 @@ namespace s90 {
 
     context::context(node_id *id, reload_context *rctx) : id(id), rld(rctx) {
         machine_id = (id->port + id->id) & 0x3FF;
-        for(int i = 0; i < 4; i++) {
-            std::thread([this](int worker_id) -> void {
-                while(true) {
-                    std::tuple<size_t, std::function<void*(void*)>, void*> task;
-                    tasks.wait_dequeue(task);
-                    auto [task_id, fn, arg] = task;
-                    dbgf(LOG_DEBUG, "[%d]++ received a new task: %zu\n", worker_id, task_id);
-                    void* result = fn(arg);
- 
-                    dbgf(LOG_DEBUG, "[%d]+| finished a new task: %zu\n", worker_id, task_id);
-                    create_completion_message(rld, elfd, worker_id, task_id, result);
-                }
-            }, id->id).detach();
+
+        // TRACE_FILE=/tmp/90s-trace makes every worker record spans and write them to /tmp/90s-trace.<worker>.json
+        if(const char *TRACE_FILE = getenv("TRACE_FILE"); TRACE_FILE && *TRACE_FILE) {
+            trace_file = std::string(TRACE_FILE) + "." + std::to_string(id->id) + ".json";
+            tracing::enable();
         }
 
         if(id->id == 0) {
@@ -136,6 +128,13 @@ namespace s90 {
     }
 
     context::~context() {
+        export_trace();
+        // tokens may outlive the context in promises that are still around
+        for(auto& [_, token] : deadlines) token->on_idle = nullptr;
+        for(auto& [k, pool] : pools) {
+            pool->close();
+        }
+        pools.clear();
         for(auto& [k ,v] : ssl_contexts) {
             crypto_ssl_release(v);
         }
@@ -161,12 +160,12 @@ namespace s90 {
     }
 
     void context::on_receive(read_params params) {
-        auto it = fds.find(params.childfd);
-        if(it != fds.end()) [[likely]] {
-            if(auto fd = it->second.lock()) [[likely]] {
+        auto entry = fds.find(params.childfd);
+        if(entry) [[likely]] {
+            if(auto fd = entry->ref.lock()) [[likely]] {
                 fd->on_data(std::string_view(params.buf, params.readlen));
             } else {
-                fds.erase(it);
+                fds.erase(params.childfd);
             }
         } else {
             accept_params acc;
@@ -177,52 +176,75 @@ namespace s90 {
             acc.parentfd = (fd_t)0;
             acc.addrlen = 0;
             this->on_accept(acc);
-            it = fds.find(params.childfd);
-            if(it != fds.end()) [[likely]] {
-                if(auto fd = it->second.lock()) [[likely]] {
+            entry = fds.find(params.childfd);
+            if(entry) [[likely]] {
+                if(auto fd = entry->ref.lock()) [[likely]] {
                     fd->on_data(std::string_view(params.buf, params.readlen));
                 } else {
-                    fds.erase(it);
+                    fds.erase(params.childfd);
                 }
             }
         }
     }
 
     void context::on_close(close_params params) {
-        auto it = fds.find(params.childfd);
-        if(it != fds.end()) [[likely]] {
-            if(auto fd = it->second.lock()) [[likely]] {
+        auto entry = fds.find(params.childfd);
+        if(entry) [[likely]] {
+            if(auto fd = entry->ref.lock()) [[likely]] {
                 auto named = named_fds.find(fd->name());
                 if(named != named_fds.end())
                     named_fds.erase(named);
-                fds.erase(it);
+                fds.erase(params.childfd);
                 fd->on_close();
+                auto connect_it = connect_promises.find(params.childfd);
+                if(connect_it != connect_promises.end()) {
+                    // closed before ever becoming writable, connect failed
+                    auto promise = std::move(connect_it->second.second);
+                    connect_promises.erase(connect_it);
+                    promise.resolve(nullptr);
+                }
             } else {
-                fds.erase(it);
+                fds.erase(params.childfd);
             }
         }
     }
 
     void context::on_write(write_params params) {
-        auto it = fds.find(params.childfd);
-        if(it != fds.end()) [[likely]] {
-            if(auto fd = it->second.lock()) [[likely]] {
+        auto entry = fds.find(params.childfd);
+        if(entry) [[likely]] {
+            if(auto fd = entry->ref.lock()) [[likely]] {
                 fd->on_write((size_t)params.written);
                 auto connect_it = connect_promises.find(params.childfd);
                 if(connect_it != connect_promises.end()) {
-                    connect_it->second.resolve(std::move(static_pointer_cast<iafd>(fd)));
+                    // only the generation tells, fd->on_write may have resumed coroutines that inserted into
+                    // the table meanwhile, which can move the slots and leave `entry` dangling
+                    if(!fds.find(connect_it->second.first)) [[unlikely]] {
+                        // the fd of the connect got closed unnoticed and reused since, it never connected
+                        auto promise = std::move(connect_it->second.second);
+                        connect_promises.erase(connect_it);
+                        promise.resolve(nullptr);
+                        return;
+                    }
+#ifndef _WIN32
+                    // failed connect is reported as writable too, the close that follows resolves the promise
+                    int err = 0;
+                    socklen_t err_len = sizeof(err);
+                    if(getsockopt((int)params.childfd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0) return;
+#endif
+                    auto promise = std::move(connect_it->second.second);
                     connect_promises.erase(connect_it);
+                    promise.resolve(std::move(static_pointer_cast<iafd>(fd)));
                 }
             } else {
-                fds.erase(it);
+                fds.erase(params.childfd);
             }
         }
     }
 
     void context::on_accept(accept_params params) {
-        auto it = fds.find(params.childfd);
-        if(it != fds.end()) [[unlikely]] {
-            if(auto fd = it->second.lock()) {
+        auto entry = fds.find(params.childfd);
+        if(entry) [[unlikely]] {
+            if(auto fd = entry->ref.lock()) {
                 if(!fd->was_accepted()) {
                     set_fd_remote(params, fd);
                     fd->on_accept();
@@ -231,11 +253,11 @@ namespace s90 {
                     }
                 }
             } else {
-                fds.erase(it);
+                fds.erase(params.childfd);
             }
         } else {
             auto fd = ptr_new<afd>(this, params.elfd, params.childfd, params.fdtype);
-            fds.insert(std::make_pair(params.childfd, fd));
+            fds.insert(params.childfd, fd);
             if(!fd->was_accepted()) {
                 set_fd_remote(params, fd);
                 fd->on_accept();
@@ -258,11 +280,13 @@ namespace s90 {
             if(it != task_promises.end()) {
                 if(auto prom = it->second.lock()) [[likely]] {
                     dbgf(LOG_DEBUG, "[%d] |- found & locked!\n",  id->id);
-                    aiopromise(prom).resolve(std::move(result));
                     task_promises.erase(it);
+                    if(!task_spans.empty()) [[unlikely]] task_spans.erase(task);
+                    aiopromise(prom).resolve(std::move(result));
                 } else {
                     dbgf(LOG_DEBUG, "[%d] |- found unawaited!\n",  id->id);
                     task_promises.erase(it);
+                    if(!task_spans.empty()) [[unlikely]] task_spans.erase(task);
                 }
             }
         } else if(*msg == MSG_ACTOR) {
@@ -347,7 +371,7 @@ namespace s90 {
             };
         } else if(protocol == proto::udp) {
             auto p = static_pointer_cast<iafd>(ptr_new<afd>(this, elfd, fd, S80_FD_SOCKET));
-            this->fds[fd] = p;
+            this->fds.insert(fd, p);
             result = {
                 false,
                 std::move(p),
@@ -357,33 +381,13 @@ namespace s90 {
             // TCP requires on_Write to be called beforehand to make sure we're connected
             aiopromise<ptr<iafd>> promise;
             auto p = static_pointer_cast<iafd>(ptr_new<afd>(this, elfd, fd, S80_FD_SOCKET));
-            this->fds[fd] = p;
-            connect_promises[fd] = promise;
+            auto handle = this->fds.insert(fd, p);
+            promise.on_cancel(nullptr, [conn = wptr<iafd>(p)]() {
+                if(auto c = conn.lock()) c->close(true);
+            });
+            connect_promises[fd] = {handle, promise};
             if(protocol == proto::tls) {
-                std::string address_copy = host_name;
-                std::string ssl_error;
-                bool ok = false;
-                auto p = co_await promise;
-                auto ssl_context = new_ssl_client_context();
-                if(ssl_context) {
-                    auto ssl_connect = co_await p->enable_client_ssl(*ssl_context, address_copy);
-                    if(!ssl_connect.error) {
-                        ok = true;
-                    } else {
-                        ssl_error = ssl_connect.error_message;
-                        p->close();
-                        p.reset();
-                    }
-                }
-                if(!ok) {
-                    result = {
-                        true,
-                        static_pointer_cast<iafd>(ptr_new<afd>(this, elfd, true)),
-                        ssl_error
-                    };
-                } else {
-                    result = {false, std::move(p), ""};
-                }
+                result = co_await upgrade_to_tls(co_await promise, host_name);
             } else {
                 p = co_await promise;
                 bool is_error = !p;
@@ -421,6 +425,162 @@ namespace s90 {
         co_return std::move(result);
     }
 
+    aiopromise<connect_result> context::upgrade_to_tls(ptr<iafd> fd, std::string host_name) {
+        std::string ssl_error = "failed to connect";
+        if(fd) {
+            auto ssl_context = new_ssl_client_context();
+            if(ssl_context) {
+                auto ssl_connect = co_await fd->enable_client_ssl(*ssl_context, host_name);
+                if(!ssl_connect.error) {
+                    co_return {false, std::move(fd), ""};
+                }
+                ssl_error = ssl_connect.error_message;
+            } else {
+                ssl_error = ssl_context.error();
+            }
+            fd->close();
+        }
+        co_return {
+            true,
+            static_pointer_cast<iafd>(ptr_new<afd>(this, elfd, true)),
+            ssl_error
+        };
+    }
+
+    struct connect_race {
+        std::vector<aiopromise<connect_result>> attempts;
+        std::vector<std::string> keys;
+        std::optional<connect_result> winner;
+        size_t winner_index = 0;
+        size_t started = 0;
+        size_t finished = 0;
+        bool delay_elapsed = false;
+        std::string last_error = "failed to connect";
+        aiopromise<nil>::weak_type waiter;
+
+        void notify() {
+            if(auto p = waiter.lock()) {
+                waiter = {};
+                aiopromise(p).resolve(nil {});
+            }
+        }
+    };
+
+    aiopromise<nil> context::connect_attempt(ptr<connect_race> race, size_t index, std::string target, int port) {
+        auto attempt = connect(target, dns_type::A, port, proto::tcp);
+        attempt.cancel_on(deadline(connect_attempt_timeout), {true, nullptr, errors::TIMEOUT});
+        race->attempts[index] = attempt;
+        auto result = co_await attempt;
+        race->finished++;
+        if(race->winner) {
+            // lost the race
+            if(result) result.fd->close();
+            co_return nil {};
+        }
+        if(result) {
+            failed_addresses.erase(race->keys[index]);
+            race->winner = std::move(result);
+            race->winner_index = index;
+        } else {
+            failed_addresses[race->keys[index]] = current_tick + address_failure_memory;
+            race->last_error = result.error_message;
+        }
+        race->notify();
+        co_return nil {};
+    }
+
+    aiopromise<connect_result> context::connect_any(const std::string& host_name, const std::vector<std::string>& addresses, int port, proto protocol) {
+        std::string host = host_name;
+        std::vector<std::string> v6, v4, order;
+        for(auto& addr : addresses) {
+            std::string_view ip = addr;
+            if(ip.starts_with("v6:")) ip.remove_prefix(3);
+            if(ip.find(':') != std::string_view::npos) {
+                v6.emplace_back("v6:" + std::string(ip));
+            } else {
+                v4.emplace_back(ip);
+            }
+        }
+        // alternate the families starting with IPv6, addresses that failed recently go last
+        for(size_t i = 0; i < std::max(v6.size(), v4.size()); i++) {
+            if(i < v6.size()) order.emplace_back(std::move(v6[i]));
+            if(i < v4.size()) order.emplace_back(std::move(v4[i]));
+        }
+        auto race = ptr_new<connect_race>();
+        for(auto& addr : order) {
+            race->keys.emplace_back(addr + ":" + std::to_string(port));
+        }
+        std::vector<size_t> indices(order.size());
+        for(size_t i = 0; i < indices.size(); i++) indices[i] = i;
+        std::stable_partition(indices.begin(), indices.end(), [this, &race](size_t i) {
+            auto it = failed_addresses.find(race->keys[i]);
+            return it == failed_addresses.end() || it->second <= current_tick;
+        });
+        std::vector<std::string> targets, keys;
+        for(auto i : indices) {
+            targets.emplace_back(host + "@" + order[i]);
+            keys.emplace_back(std::move(race->keys[i]));
+        }
+        race->keys = std::move(keys);
+        race->attempts.resize(targets.size());
+
+        while(!race->winner && race->finished < targets.size()) {
+            // next attempt starts once all the running ones failed, or the previous one didn't make it in time
+            if(race->started < targets.size() && (race->started == race->finished || race->delay_elapsed)) {
+                race->delay_elapsed = false;
+                size_t index = race->started++;
+                if(race->started < targets.size()) {
+                    deadline(connect_attempt_delay)->subscribe([race, started = race->started]() {
+                        if(race->started != started || race->winner) return;
+                        race->delay_elapsed = true;
+                        race->notify();
+                    });
+                }
+                connect_attempt(race, index, targets[index], port);
+                continue;
+            }
+            aiopromise<nil> wake;
+            wake.on_cancel(nil {}, [race]() {
+                for(size_t i = 0; i < race->started; i++) {
+                    race->attempts[i].cancel({true, nullptr, errors::TIMEOUT});
+                }
+            });
+            race->waiter = wake.weak();
+            co_await wake;
+        }
+
+        for(size_t i = 0; i < race->started; i++) {
+            if(race->attempts[i].is_settled()) continue;
+            // started before the winner and still not connected, don't prefer it next time
+            if(race->winner && i < race->winner_index) {
+                failed_addresses[race->keys[i]] = current_tick + address_failure_memory;
+            }
+            race->attempts[i].cancel({true, nullptr, "cancelled"});
+        }
+
+        if(!race->winner) {
+            co_return {
+                true,
+                static_pointer_cast<iafd>(ptr_new<afd>(this, elfd, true)),
+                targets.empty() ? errors::INVALID_ADDRESS : race->last_error
+            };
+        }
+
+        auto result = std::move(*race->winner);
+        if(protocol == proto::tls) {
+            co_return std::move(co_await upgrade_to_tls(result.fd, host));
+        }
+        co_return std::move(result);
+    }
+
+    ptr<connection_pool> context::get_pool(const std::string& key, connection_factory factory, pool_options options, health_check checker) {
+        auto it = pools.find(key);
+        if(it != pools.end()) return it->second;
+        auto pool = ptr_new<connection_pool>(key, std::move(factory), options, std::move(checker));
+        pools.emplace(key, pool);
+        return pool;
+    }
+
     ptr<sql::isql> context::new_sql_instance(const std::string& type) {
         if(type != "mysql") return nullptr;
         return static_pointer_cast<sql::isql>(ptr_new<sql::mysql>(this));
@@ -437,7 +597,7 @@ namespace s90 {
         this->init_callback = init_callback;
     }
 
-    const dict<fd_t, wptr<iafd>>& context::get_fds() const {
+    const fd_table& context::get_fds() const {
         return fds;
     }
 
@@ -527,11 +687,31 @@ namespace s90 {
         return http_cl;
     }
 
-    aiopromise<void*> context::exec_async(std::function<void*(void*)> callback, void* ref) {
+    aiopromise<void*> context::exec_async(std::move_only_function<void*(void*)> callback, void* ref, task_priority priority) {
         aiopromise<void*> prom;
-        size_t task = task_id++;
-        task_promises[task] = prom.weak();
-        tasks.enqueue(std::make_tuple(task, callback, ref));
+        task_spec spec;
+        spec.task_id = task_id++;
+        spec.worker_id = get_node_id().id;
+        task_promises[spec.task_id] = prom.weak();
+        if(tracing::enabled()) [[unlikely]] {
+            // ends once the result is mailed back, so it covers waiting in the queue too
+            task_spans[spec.task_id] = tracing::span::detached("exec_async");
+        }
+        // the task carries its owner, so the result gets mailed back to this worker no matter
+        // which pool thread ends up running it
+        task_pool::instance().submit(priority, [rld = rld, elfd = elfd, spec, callback = std::move(callback), ref]() mutable {
+            void *result = nullptr;
+            try {
+                result = callback(ref);
+            } catch(std::exception& ex) {
+                dbgf(LOG_ERROR, "[%d] task %zu failed: %s\n", spec.worker_id, spec.task_id, ex.what());
+            } catch(...) {
+                // whatever was thrown, the owner still has to be told the task is over
+                dbgf(LOG_ERROR, "[%d] task %zu failed with unknown exception\n", spec.worker_id, spec.task_id);
+            }
+            dbgf(LOG_DEBUG, "[%d]+| finished a task: %zu\n", spec.worker_id, spec.task_id);
+            create_completion_message(rld, elfd, spec.worker_id, spec.task_id, result);
+        });
         return prom;
     }
 
@@ -613,7 +793,7 @@ namespace s90 {
                     auto conn = co_await connect(ip, dns_type::A, port, proto::tcp, ip + ":" + std::to_string(port));
                     if(conn) {
                         together = std::format("POST /90s/internal/forward HTTP/1.1\r\nSignature: {}\r\nFrom: {}\r\nTo: {}\r\nType: {}\r\nContent-Length: {}\r\nConnection: keep-alive\r\n\r\n{}", sig, from, to, type, message.length(), message);
-                        if(!co_await conn->write(together)) {
+                        if(!co_await conn->write(std::move(together))) {
                             co_return std::unexpected(errors::WRITE_ERROR);
                         } else {
                             co_return true;
@@ -723,6 +903,14 @@ namespace s90 {
             }
         }
 
+        for(auto& [k, pool] : pools) {
+            pool->maintain();
+        }
+
+        if(!trace_file.empty() && current_tick % trace_export_period == 0) {
+            export_trace();
+        }
+
         auto tick_now = current_tick;
 
         std::vector<aiopromise<nil>::weak_type> awaitables;
@@ -736,6 +924,13 @@ namespace s90 {
             }
         }
 
+        std::vector<ptr<cancellation>> expired;
+        while(!deadlines.empty() && deadlines.begin()->first <= tick_now) {
+            expired.emplace_back(std::move(deadlines.begin()->second));
+            expired.back()->on_idle = nullptr;
+            deadlines.erase(deadlines.begin());
+        }
+
         current_tick += tick_period;
 
         for(auto& w : awaitables) {
@@ -745,9 +940,23 @@ namespace s90 {
             }
         }
 
+        for(auto& token : expired) {
+            token->cancel();
+        }
+
         co_return nil {};
     }
 
+    void context::export_trace() {
+        if(trace_file.empty()) return;
+        auto& rec = tracing::recorder::local();
+        if(rec.total() == trace_exported) return;
+        trace_exported = rec.total();
+        if(!rec.export_chrome(trace_file, id->id)) {
+            dbgf(LOG_ERROR, "[%d] Failed to export trace to %s\n", id->id, trace_file.c_str());
+        }
+    }
+
     void context::add_tick_listener(std::function<aiopromise<nil>(void*)> cb, void *self, size_t periodicity) {
         dbgf(LOG_INFO, "%d | Add tick listener (%zu)\n", get_node_id().id, tick_listeners.size());
         tick_listeners.emplace_back(tick_listener_data {
@@ -764,4 +973,14 @@ namespace s90 {
         sleeps.push_back(std::make_pair(current_tick + seconds, prom.weak()));
         return prom;
     }
+
+    ptr<cancellation> context::deadline(int seconds) {
+        auto token = ptr_new<cancellation>();
+        auto it = deadlines.emplace(current_tick + seconds, token);
+        // once every promise waiting for the deadline settles, there is nothing left to time out
+        token->on_idle = [this, it]() {
+            deadlines.erase(it);
+        };
+        return token;
+    }
 }
\ No newline at end of file
@@ -2,12 +2,15 @@
 #include <80s/80s.h>
 #include "shared.hpp"
 #include "afd.hpp"
+#include "fd_table.hpp"
+#include "connection_pool.hpp"
 #include "aiopromise.hpp"
 #include "sql/sql.hpp"
 #include "dns/dns.hpp"
 #include "httpd/client.hpp"
 #include "actors/actor.hpp"
-#include "lib/blockingqueue.h"
+#include "task_pool.hpp"
+#include "tracing.hpp"
 #include <memory>
 #include <expected>
 
@@ -44,24 +47,6 @@ namespace s90 {
         size_t task_id;
     };
 
-    struct connect_result {
-        bool error;
-        ptr<iafd> fd;
-        std::string error_message;
-
-        explicit operator bool() const {
-            return !error && fd;
-        }
-
-        ptr<iafd>& operator*() {
-            return fd;
-        }
-
-        ptr<iafd> operator->() const {
-            return fd;
-        }
-    };
-
     class connection_handler {
     public:
         virtual ~connection_handler() = default;
@@ -81,18 +66,38 @@ namespace s90 {
         /// @param record_type DNS record type
         /// @param port port
         /// @param proto protocol
-        /// @param name socket name, if set, connections are cached and re-retrieved later on
+        /// @param name socket name, if set, a single connection is cached and shared by everyone connecting with the
+        /// same name, for request/response traffic use get_pool instead
         /// @return return an already connected file descriptor
         virtual aiopromise<connect_result> connect(const std::string& addr, dns_type record_type, int port, proto protocol, std::optional<std::string> name = {}, bool disable_local = false) = 0;
 
+        /// @brief Connect to whichever of the resolved addresses answers first (Happy Eyeballs, RFC 8305).
+        /// Attempts are started one by one, IPv6 and IPv4 interleaved, the next one right after the running
+        /// ones failed or once the previous one didn't connect within a tick. Addresses that failed recently
+        /// are tried last, so a dead address costs nothing on later connects
+        /// @param host_name host name, used for TLS
+        /// @param addresses IP addresses, IPv6 ones with or without v6: prefix
+        /// @param port port
+        /// @param protocol proto::tcp or proto::tls
+        /// @return first established connection
+        virtual aiopromise<connect_result> connect_any(const std::string& host_name, const std::vector<std::string>& addresses, int port, proto protocol) = 0;
+
+        /// @brief Get connection pool for an upstream, the pool is created on first use and maintained on every tick
+        /// @param key pool key, everyone using the same key shares the pool, factory and options of the first call apply
+        /// @param factory opens a new connection, i.e. by calling connect without a name
+        /// @param options pool limits
+        /// @param checker health check of idle connections, if not provided, only closed connections are dropped
+        /// @return connection pool
+        virtual ptr<connection_pool> get_pool(const std::string& key, connection_factory factory, pool_options options = {}, health_check checker = {}) = 0;
+
         /// @brief Create a new SQL instance
         /// @param type SQL type, currently only "mysql" is accepted
         /// @return SQL instance
         virtual ptr<sql::isql> new_sql_instance(const std::string& type) = 0;
 
-        /// @brief Get dictionary of all existing file descriptors
+        /// @brief Get table of all existing file descriptors, iterating it yields (fd, wptr<iafd>) pairs
         /// @return file descriptors
-        virtual const dict<fd_t, wptr<iafd>>& get_fds() const = 0;
+        virtual const fd_table& get_fds() const = 0;
 
         /// @brief Quit the application
         virtual void quit() const = 0;
@@ -136,10 +141,12 @@ namespace s90 {
         /// @return HTTP client
         virtual ptr<httpd::ihttp_client> get_http_client() = 0;
 
-        /// @brief Exec asynchronously in a thread pool
-        /// @param function code
+        /// @brief Exec asynchronously in the shared thread pool, result is delivered back to this worker
+        /// @param callback code
+        /// @param ref argument passed to the callback
+        /// @param priority task priority
         /// @return result
-        virtual aiopromise<void*> exec_async(std::function<void*(void*)> callback, void* ref = nullptr) = 0;
+        virtual aiopromise<void*> exec_async(std::move_only_function<void*(void*)> callback, void* ref = nullptr, task_priority priority = task_priority::cpu) = 0;
 
         /// @brief Create a new completable task
         /// @return task
@@ -204,16 +211,24 @@ namespace s90 {
         /// @return promise
         virtual aiopromise<nil> sleep(int seconds) = 0;
 
+        /// @brief Create a deadline that gets cancelled after N seconds, use it with aiopromise::cancel_on
+        /// to put a timeout on any awaited operation
+        /// @param seconds seconds
+        /// @return cancellation token
+        virtual ptr<cancellation> deadline(int seconds) = 0;
+
         template<class T>
-        aiopromise<T> exec_async(std::function<T()> cb) {
+        aiopromise<T> exec_async(std::move_only_function<T()> cb, task_priority priority = task_priority::cpu) {
             struct holder {
                 T value;
             };
             std::shared_ptr<holder> h = std::make_shared<holder>();
-            co_await this->exec_async([h, cb](void *) -> void* {
+            // kept out of the co_await expression, GCC 12 destroys lambda temporaries of it twice
+            std::move_only_function<void*(void*)> task = [h, cb = std::move(cb)](void *) mutable -> void* {
                 h->value = std::move(cb());
                 return nullptr;
-            }, nullptr);
+            };
+            co_await this->exec_async(std::move(task), nullptr, priority);
             co_return std::move(h->value);
         }
     };
@@ -225,11 +240,23 @@ namespace s90 {
         size_t next_run;
     };
 
+    struct connect_race;
+
     class context : public icontext {
+        /// @brief seconds before the next address is tried while the previous attempt is still pending
+        static constexpr int connect_attempt_delay = 1;
+        /// @brief seconds after which a single connect attempt is given up
+        static constexpr int connect_attempt_timeout = 10;
+        /// @brief seconds for which a failed address is tried last
+        static constexpr int address_failure_memory = 60;
+        /// @brief seconds between exports of the recorded spans when tracing is on
+        static constexpr size_t trace_export_period = 5;
+
+
         node_id *id;
         reload_context *rld;
         fd_t elfd;
-        dict<fd_t, wptr<iafd>> fds;
+        fd_table fds;
 
         size_t current_tick = 0;
         size_t last_flush = 0;
@@ -238,10 +265,14 @@ namespace s90 {
         dict<std::string, ptr<iafd>> named_fds;
         dict<std::string, std::queue<aiopromise<connect_result>::weak_type>> named_fd_promises;
         dict<std::string, bool> named_fd_connecting;
+        dict<std::string, ptr<connection_pool>> pools;
+        dict<std::string, size_t> failed_addresses;
 
         std::list<std::pair<size_t, aiopromise<nil>::weak_type>> sleeps;
+        std::multimap<size_t, ptr<cancellation>> deadlines;
 
-        dict<fd_t, aiopromise<ptr<iafd>>> connect_promises;
+        /// @brief connects waiting for the fd to become writable, with handle of the fd they were made for
+        dict<fd_t, std::pair<fd_handle, aiopromise<ptr<iafd>>>> connect_promises;
         dict<std::string, ptr<storable>> stores;
         dict<std::string, void*> ssl_contexts;
         ptr<connection_handler> handler;
@@ -254,17 +285,18 @@ namespace s90 {
 
         size_t task_id = 0;
         uint64_t machine_id = 0;
-        moodycamel::BlockingConcurrentQueue<
-            std::tuple<
-                size_t,
-                std::function<void*(void*)>,
-                void*
-            >
-        > tasks;
+
+        std::string trace_file;
+        size_t trace_exported = 0;
 
         dict<size_t, aiopromise<void*>::weak_type> task_promises;
+        dict<size_t, tracing::span> task_spans;
         dict<std::string, std::weak_ptr<actors::iactor>> actor_storage;
 
+        aiopromise<connect_result> upgrade_to_tls(ptr<iafd> fd, std::string host_name);
+        aiopromise<nil> connect_attempt(ptr<connect_race> race, size_t index, std::string target, int port);
+        void export_trace();
+
     public:
         context(node_id *id, reload_context *reload_ctx);
         ~context();
@@ -286,9 +318,11 @@ namespace s90 {
         void on_init(init_params params);
 
         aiopromise<connect_result> connect(const std::string& addr, dns_type record_type, int port, proto protocol, std::optional<std::string> name = {}, bool disable_local = false) override;
+        aiopromise<connect_result> connect_any(const std::string& host_name, const std::vector<std::string>& addresses, int port, proto protocol) override;
+        ptr<connection_pool> get_pool(const std::string& key, connection_factory factory, pool_options options = {}, health_check checker = {}) override;
         ptr<sql::isql> new_sql_instance(const std::string& type) override;
 
-        const dict<fd_t, wptr<iafd>>& get_fds() const override;
+        const fd_table& get_fds() const override;
         void quit() const override;
         void reload() const override;
 
@@ -304,7 +338,7 @@ namespace s90 {
 
         ptr<httpd::ihttp_client> get_http_client() override;
 
-        aiopromise<void*> exec_async(std::function<void*(void*)> callback, void* ref) override;
+        aiopromise<void*> exec_async(std::move_only_function<void*(void*)> callback, void* ref, task_priority priority) override;
 
         std::shared_ptr<actors::iactor> create_actor() override;
         void destroy_actor(std::shared_ptr<actors::iactor> actor) override;
@@ -326,5 +360,6 @@ namespace s90 {
         void add_tick_listener(std::function<aiopromise<nil>(void*)> cb, void *self, size_t periodicity=0) override;
 
         aiopromise<nil> sleep(int seconds) override;
+        ptr<cancellation> deadline(int seconds) override;
     };
 }
\ No newline at end of file
@@ -110,6 +110,7 @@ namespace s90 {
         }
 
         aiopromise<std::expected<dns_response, std::string>> doh::internal_resolver(present<std::string> name, dns_type type, bool prefer_ipv6, bool mx_treatment) {
+            tracing::span trace("dns::query", name);
             if(likely_ip(name)) co_return dns_response { .records = {name} };
             std::string main_key = std::format("{}_{}", (int)type, name);
             mtx.lock();
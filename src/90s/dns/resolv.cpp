@@ -158,7 +158,8 @@ namespace s90 {
                 // perform the DNS request
                 mtx.unlock();
 
-                auto resp = co_await ctx->exec_async<std::expected<resolv_response, std::string>>([name, type]() -> std::expected<resolv_response, std::string> {
+                // named rather than a temporary of co_await, see icontext::exec_async
+                std::move_only_function<std::expected<resolv_response, std::string>()> lookup = [name, type]() -> std::expected<resolv_response, std::string> {
                     unsigned char buf[65000];
                     resolv_response res;
                     int ttl_min = 0;
@@ -234,7 +235,8 @@ namespace s90 {
                         res.ttl = orm::datetime::now() + ttl_min;
                         return res;
                     }
-                });
+                };
+                auto resp = co_await ctx->exec_async<std::expected<resolv_response, std::string>>(std::move(lookup), task_priority::dns);
 
                 if(!resp) {
                     co_return std::unexpected(std::string(errors::DNS_READ) + "|" + resp.error());
@@ -296,12 +298,14 @@ namespace s90 {
 
 
         aiopromise<std::expected<dns_response, std::string>> resolvdns::query(present<std::string> name, dns_type type, bool prefer_ipv6, bool mx_treatment) {
+            tracing::span trace("dns::query", name);
+            std::function<cache::async_cached<std::expected<dns_response, std::string>>()> factory = [this, name, type, prefer_ipv6, mx_treatment]() -> cache::async_cached<std::expected<dns_response, std::string>> {
+                auto result {co_await internal_resolver(name, type, prefer_ipv6, mx_treatment)};
+                std::shared_ptr<std::expected<dns_response, std::string>> resp = ptr_new<std::expected<dns_response, std::string>>(result);
+                co_return std::move(resp);
+            };
             auto result = co_await cache::async_cache<std::expected<dns_response, std::string>>(
-                ctx, std::format("dns:{}:{}", name, (int)type), 1200, [this, name, type, prefer_ipv6, mx_treatment]() -> cache::async_cached<std::expected<dns_response, std::string>> {
-                    auto result {co_await internal_resolver(name, type, prefer_ipv6, mx_treatment)};
-                    std::shared_ptr<std::expected<dns_response, std::string>> resp = ptr_new<std::expected<dns_response, std::string>>(result);
-                    co_return std::move(resp);
-                });
+                ctx, std::format("dns:{}:{}", name, (int)type), 1200, std::move(factory));
             auto copy = *result;
             co_return std::move(copy);            
         }
@@ -0,0 +1,142 @@
+#pragma once
+#include <80s/80s.h>
+#include "shared.hpp"
+#include "afd.hpp"
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+namespace s90 {
+
+    /// @brief Reference to a table entry that also remembers which incarnation of the fd it was taken for
+    struct fd_handle {
+        fd_t fd;
+        uint32_t generation;
+    };
+
+    /// @brief Table of open file descriptors indexed directly by fd. The kernel always hands out the
+    /// lowest free descriptor, so the table stays dense and lookups are a single array access.
+    /// Every slot carries a generation counter that is bumped whenever the fd gets inserted or erased,
+    /// so stale handles to a reused fd can be told apart. Descriptors too large to be indexed densely
+    /// (i.e. Windows handles) spill into a hash map.
+    class fd_table {
+    public:
+        /// @brief largest fd stored in the dense part
+        static constexpr size_t max_dense = 1 << 20;
+
+        struct slot {
+            wptr<iafd> ref;
+            uint32_t generation = 0;
+            bool used = false;
+        };
+
+        class iterator {
+            const fd_table *table;
+            size_t index;
+            std::unordered_map<uintptr_t, slot>::const_iterator overflow_it;
+
+            void skip() {
+                while(index < table->dense.size() && !table->dense[index].used) index++;
+                if(index == table->dense.size()) {
+                    while(overflow_it != table->overflow.end() && !overflow_it->second.used) overflow_it++;
+                }
+            }
+        public:
+            iterator(const fd_table *table, size_t index, std::unordered_map<uintptr_t, slot>::const_iterator overflow_it)
+                : table(table), index(index), overflow_it(overflow_it) {
+                skip();
+            }
+
+            std::pair<fd_t, const wptr<iafd>&> operator*() const {
+                if(index < table->dense.size()) return { (fd_t)index, table->dense[index].ref };
+                return { (fd_t)overflow_it->first, overflow_it->second.ref };
+            }
+
+            iterator& operator++() {
+                if(index < table->dense.size()) {
+                    index++;
+                } else {
+                    overflow_it++;
+                }
+                skip();
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const {
+                return index == other.index && overflow_it == other.overflow_it;
+            }
+        };
+
+        /// @brief Find live entry for fd
+        /// @param fd file descriptor
+        /// @return entry or nullptr if there is none
+        slot* find(fd_t fd) {
+            uintptr_t index = (uintptr_t)fd;
+            if(index < dense.size()) [[likely]] {
+                auto& entry = dense[index];
+                return entry.used ? &entry : nullptr;
+            } else if(index < max_dense) {
+                return nullptr;
+            }
+            auto it = overflow.find(index);
+            return it != overflow.end() && it->second.used ? &it->second : nullptr;
+        }
+
+        /// @brief Find entry only if fd wasn't reused since the handle was taken
+        /// @param handle fd handle
+        /// @return entry or nullptr
+        slot* find(fd_handle handle) {
+            auto entry = find(handle.fd);
+            return entry && entry->generation == handle.generation ? entry : nullptr;
+        }
+
+        /// @brief Insert or replace an entry
+        /// @param fd file descriptor
+        /// @param ref fd object
+        /// @return handle of the new entry
+        fd_handle insert(fd_t fd, wptr<iafd> ref) {
+            auto& entry = at(fd);
+            if(!entry.used) count++;
+            entry.ref = std::move(ref);
+            entry.used = true;
+            entry.generation++;
+            return { fd, entry.generation };
+        }
+
+        /// @brief Remove an entry, handles taken for it become stale
+        /// @param fd file descriptor
+        void erase(fd_t fd) {
+            if(auto entry = find(fd)) {
+                entry->ref.reset();
+                entry->used = false;
+                entry->generation++;
+                count--;
+            }
+        }
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        iterator begin() const { return iterator(this, 0, overflow.begin()); }
+        iterator end() const { return iterator(this, dense.size(), overflow.end()); }
+
+    private:
+        std::vector<slot> dense;
+        std::unordered_map<uintptr_t, slot> overflow;
+        size_t count = 0;
+
+        slot& at(fd_t fd) {
+            uintptr_t index = (uintptr_t)fd;
+            if(index < max_dense) [[likely]] {
+                if(index >= dense.size()) {
+                    dense.resize(std::min(std::max((size_t)index + 1, dense.size() * 2), max_dense));
+                }
+                return dense[index];
+            }
+            return overflow[index];
+        }
+    };
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <new>
+
+namespace s90 {
+
+    struct frame_arena_stats {
+        /// @brief frames that had to be requested from the global allocator
+        size_t allocated = 0;
+        /// @brief frames served from the freelist
+        size_t reused = 0;
+        /// @brief bytes currently kept in the freelists
+        size_t cached_bytes = 0;
+    };
+
+    /// @brief Per-worker freelist of coroutine frames. Frames are grouped into size classes and
+    /// returned blocks are kept for the next coroutine of the same class, so a request running
+    /// through the same chain of coroutines over and over stops hitting the global allocator.
+    /// Blocks are plain global allocations, so it doesn't matter which thread or shared object
+    /// eventually releases them
+    class frame_arena {
+    public:
+        static constexpr size_t granularity = 64;
+        static constexpr size_t max_frame_size = 4096;
+        static constexpr size_t max_cached_bytes = 4 << 20;
+
+        ~frame_arena() {
+            destroyed = true;
+            for(auto& head : free_lists) {
+                while(head) {
+                    auto next = head->next;
+                    ::operator delete(head);
+                    head = next;
+                }
+            }
+        }
+
+        void *allocate(size_t size) {
+            if(size > max_frame_size || destroyed) [[unlikely]] {
+                counters.allocated++;
+                return ::operator new(size);
+            }
+            size_t index = (size - 1) / granularity;
+            if(auto head = free_lists[index]) [[likely]] {
+                free_lists[index] = head->next;
+                counters.reused++;
+                counters.cached_bytes -= (index + 1) * granularity;
+                return head;
+            }
+            counters.allocated++;
+            return ::operator new((index + 1) * granularity);
+        }
+
+        void deallocate(void *ptr, size_t size) {
+            size_t index = (size - 1) / granularity;
+            if(size > max_frame_size || destroyed || counters.cached_bytes + (index + 1) * granularity > max_cached_bytes) [[unlikely]] {
+                ::operator delete(ptr);
+                return;
+            }
+            auto head = static_cast<block*>(ptr);
+            head->next = free_lists[index];
+            free_lists[index] = head;
+            counters.cached_bytes += (index + 1) * granularity;
+        }
+
+        const frame_arena_stats& stats() const {
+            return counters;
+        }
+
+        /// @brief Get arena of the current thread
+        /// @return arena
+        static frame_arena& local() {
+            static thread_local frame_arena arena;
+            return arena;
+        }
+
+    private:
+        struct block {
+            block *next;
+        };
+
+        block *free_lists[max_frame_size / granularity] = {};
+        frame_arena_stats counters;
+        bool destroyed = false;
+    };
+
+}
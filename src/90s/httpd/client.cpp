@@ -15,6 +15,7 @@ namespace s90 {
         }
 
         aiopromise<http_response> http_client::request(present<std::string> method, present<std::string> url, present<dict<std::string, std::string>> user_headers, present<std::string> body) {
+            tracing::span trace("http_client::request", url);
             if(!(url.starts_with("https://") || url.starts_with("http://"))) co_return with_error(errors::INVALID_ADDRESS);
             std::string host_name;
             std::string script = "/";
@@ -35,10 +36,7 @@ namespace s90 {
                 headers["authorization"] = "Basic " + util::to_b64(auth);
             }
 
-            auto dns_resp = co_await ctx->get_dns()->query(host_name, dns_type::A, false);
-            if(!dns_resp) co_return with_error("dns:" + dns_resp.error());
-
-            s90::connect_result fd;
+            s90::pooled_connection fd;
             s90::read_arg arg;
 
             std::string data = method;
@@ -53,34 +51,41 @@ namespace s90 {
             data += "\r\n";
             data += body;
 
+            auto pool = ctx->get_pool(
+                "http:" + host_name + ":" + std::to_string(port),
+                [ctx = ctx, host_name, port, ssl]() -> aiopromise<connect_result> {
+                    // both queries run at once, missing IPv6 is not an error
+                    auto v4_query = ctx->get_dns()->query(host_name, dns_type::A, false);
+                    auto v6_query = ctx->get_dns()->query(host_name, dns_type::AAAA, true);
+                    auto v4 = co_await v4_query;
+                    auto v6 = co_await v6_query;
+                    if(!v4 && !v6) co_return connect_result { true, nullptr, "dns:" + v4.error() };
+                    std::vector<std::string> addresses;
+                    if(v6) addresses.insert(addresses.end(), v6->records.begin(), v6->records.end());
+                    if(v4) addresses.insert(addresses.end(), v4->records.begin(), v4->records.end());
+                    co_return std::move(co_await ctx->connect_any(host_name, addresses, port, ssl ? proto::tls : proto::tcp));
+                }
+            );
+
             int max_attempts = 2;
             
             for(int i = 0; i < max_attempts; i++) {
                 
+                // connecting already went through all the addresses, so the retry is immediate, it's
+                // mostly for pooled connections that were closed by the server in the meantime
                 if(i > 0) {
-                    dbgf(LOG_ALWAYS, "[http_client] Reconnect attempt %d to %s://%s:%d [ip=%s]\n", i + 1, ssl ? "https" : "http", host_name.c_str(), port, dns_resp->records[0].c_str());
-                    co_await ctx->sleep(5);
+                    dbgf(LOG_ALWAYS, "[http_client] Reconnect attempt %d to %s://%s:%d\n", i + 1, ssl ? "https" : "http", host_name.c_str(), port);
                 }
 
-                fd = co_await ctx->connect(
-                    host_name + "@" + dns_resp->records[0],
-                    dns_type::A,
-                    port,
-                    ssl ? proto::tls : proto::tcp,
-                    "http:" + host_name + ":" + std::to_string(port)
-                );
+                fd = co_await pool->checkout();
 
                 if(!fd) {
-                    ctx->revoke_named_fd(fd.fd);
                     if(i < max_attempts - 1) continue;
                     co_return with_error(fd.error_message + "|connect");
                 }
-                //fd->set_timeout(90);
 
-                co_await fd->lock();
                 if(!co_await fd->write(data)) {
-                    ctx->revoke_named_fd(fd.fd);
-                    fd->unlock();
+                    fd.invalidate();
                     if(i < max_attempts - 1) continue;
                     co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|initial_write");
                 }
@@ -88,8 +93,7 @@ namespace s90 {
                 arg = co_await fd->read_until("\r\n\r\n");
 
                 if(!arg) {
-                    ctx->revoke_named_fd(fd.fd);
-                    fd->unlock();
+                    fd.invalidate();
                     if(i < max_attempts - 1) continue;
                     co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|read_header");
                 }
@@ -106,7 +110,7 @@ namespace s90 {
             resp.error_message = "?";
 
             if(pivot == std::string::npos) {
-                fd->unlock();
+                fd.invalidate();
                 co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|status_line_missing");
             }
             status = std::string_view(arg.data.begin(), arg.data.begin() + pivot);
@@ -117,7 +121,7 @@ namespace s90 {
                 resp.status_line = status;
                 resp.status = atoi(status.substr(pivot + 1).data());
             } else {
-                fd->unlock();
+                fd.invalidate();
                 co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|status_line_invalid");
             }
 
@@ -144,28 +148,28 @@ namespace s90 {
                 while(true) {
                     auto chunk_length = co_await fd->read_until("\r\n");
                     if(!chunk_length) {
-                        fd->unlock();
+                        fd.invalidate();
                         co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|chunk_read_length");
                     }
                     size_t length = 0;
                     if(chunk_length.data.length() > 0 && !util::str_to_n(std::string(chunk_length.data), length, 16)) {
-                        fd->unlock();
+                        fd.invalidate();
                         co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|invalid_chunk_length");
                     }
                     if(length == 0) {
                         auto next_crlf = co_await fd->read_n(2);
                         if(!next_crlf) {
-                            fd->unlock();
+                            fd.invalidate();
                             co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|chunked_eof");
                         } else if(std::string(next_crlf.data) != "\r\n") {
-                            fd->unlock();
+                            fd.invalidate();
                             co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|corrupted_eof");
                         }
                         break;
                     }
                     auto chunk = co_await fd->read_n(length + 2);
                     if(!chunk) {
-                        fd->unlock();
+                        fd.invalidate();
                         co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|chunk_read");
                     }
                     
@@ -174,19 +178,23 @@ namespace s90 {
             } else if(cl != resp.headers.end()) {
                 size_t length = 0;
                 if(!util::str_to_n(cl->second, length, 10)) {
-                    fd->unlock();
+                    fd.invalidate();
                     co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|invalid_length");
                 }
                 if(length > 0) {
                     auto chunk = co_await fd->read_n(length);
                     if(!chunk) {
-                        fd->unlock();
+                        fd.invalidate();
                         co_return with_error(std::string(errors::PROTOCOL_ERROR) + "|chunk_read");
                     }
                     resp.body = chunk.data;
                 }
             }
-            fd->unlock();
+            auto conn_header = resp.headers.find("connection");
+            if(conn_header != resp.headers.end() && conn_header->second == "close") {
+                fd.invalidate();
+            }
+            fd.release();
             resp.error = false;
             resp.error_message.clear();
             co_return std::move(resp);
@@ -0,0 +1,143 @@
+#include "compression.hpp"
+#include "../util/util.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <ranges>
+#include <80s/crypto.h>
+
+namespace s90 {
+    namespace httpd {
+
+        static bool iequals(std::string_view a, std::string_view b) {
+            return std::ranges::equal(a, b, [](char x, char y) { return std::tolower(x) == std::tolower(y); });
+        }
+
+        static std::string_view trim(std::string_view text) {
+            while(!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+            while(!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+            return text;
+        }
+
+        content_coding negotiate_coding(std::string_view accept_encoding) {
+            // quality in thousandths, -1 when the coding isn't listed at all
+            int gzip = -1, deflate = -1, any = -1;
+            for(auto part : std::ranges::split_view(accept_encoding, ',')) {
+                std::string_view item(part.begin(), part.end());
+                auto params = item.find(';');
+                auto name = trim(item.substr(0, params));
+                int quality = 1000;
+                if(params != std::string_view::npos) {
+                    auto q = trim(item.substr(params + 1));
+                    if(q.starts_with("q=") || q.starts_with("Q=")) {
+                        // qvalue is at most three decimals, 0.5 becomes 500
+                        q.remove_prefix(2);
+                        int whole = 0;
+                        auto [ptr, _] = std::from_chars(q.data(), q.data() + q.length(), whole);
+                        quality = whole * 1000;
+                        if(ptr < q.data() + q.length() && *ptr == '.') {
+                            int scale = 100;
+                            for(ptr++; ptr < q.data() + q.length() && scale > 0 && std::isdigit(*ptr); ptr++, scale /= 10)
+                                quality += (*ptr - '0') * scale;
+                        }
+                    }
+                }
+                if(iequals(name, "gzip") || iequals(name, "x-gzip")) gzip = quality;
+                else if(iequals(name, "deflate")) deflate = quality;
+                else if(name == "*") any = quality;
+            }
+            if(gzip < 0) gzip = any;
+            if(deflate < 0) deflate = any;
+            if(gzip > 0 && gzip >= deflate) return content_coding::gzip;
+            if(deflate > 0) return content_coding::deflate;
+            return content_coding::identity;
+        }
+
+        bool compressible_type(std::string_view content_type) {
+            // pages don't have to set any, those are HTML
+            if(content_type.empty()) return true;
+            auto mime = trim(content_type.substr(0, content_type.find(';')));
+            if(mime.length() >= 5 && iequals(mime.substr(0, 5), "text/")) return true;
+            for(std::string_view type : { "application/json", "application/javascript", "application/xml", "image/svg+xml" }) {
+                if(iequals(mime, type)) return true;
+            }
+            // application/ld+json, application/atom+xml and such
+            return mime.ends_with("+json") || mime.ends_with("+xml");
+        }
+
+        const char *coding_name(content_coding coding) {
+            switch(coding) {
+                case content_coding::gzip: return "gzip";
+                case content_coding::deflate: return "deflate";
+                default: return "identity";
+            }
+        }
+
+        ptr<compression_cache> compression_cache::local(icontext *ctx) {
+            constexpr std::string_view store_key = "httpd::compression_cache";
+            auto cache = static_pointer_cast<compression_cache>(ctx->store(store_key));
+            if(!cache) {
+                cache = ptr_new<compression_cache>();
+                ctx->store(store_key, cache);
+            }
+            return cache;
+        }
+
+        ptr<const std::string> compression_cache::compress(std::span<const std::string> body, content_coding coding, bool memoize) {
+            std::string key;
+            if(memoize) {
+                // SHA-256 of the body, or of the hashes of its buffers if there are more of them,
+                // hashing is an order of magnitude cheaper than compressing
+                unsigned char digest[32];
+                if(body.size() == 1) {
+                    crypto_sha256(body[0].data(), body[0].length(), digest, sizeof(digest));
+                } else {
+                    std::string digests;
+                    digests.reserve(body.size() * sizeof(digest));
+                    for(const auto& part : body) {
+                        crypto_sha256(part.data(), part.length(), digest, sizeof(digest));
+                        digests.append((const char*)digest, sizeof(digest));
+                    }
+                    crypto_sha256(digests.data(), digests.length(), digest, sizeof(digest));
+                }
+                key.reserve(sizeof(digest) + 1);
+                key += (char)coding;
+                key.append((const char*)digest, sizeof(digest));
+
+                auto it = entries.find(key);
+                if(it != entries.end()) {
+                    recently_used.splice(recently_used.end(), recently_used, it->second.order);
+                    return it->second.body;
+                }
+            }
+
+            util::deflate_stream stream(
+                true,
+                coding == content_coding::gzip ? util::compression_format::gzip : util::compression_format::zlib,
+                response_compression_level
+            );
+            auto compressed = ptr_new<std::string>();
+            for(size_t i = 0; i < body.size(); i++) {
+                auto mode = i + 1 == body.size() ? util::flush_mode::finish : util::flush_mode::none;
+                if(!stream.update(body[i], *compressed, mode)) return nullptr;
+            }
+            if(body.empty() && !stream.update({}, *compressed, util::flush_mode::finish)) return nullptr;
+
+            if(memoize && compressed->length() <= max_cached_bytes) {
+                cached_bytes += compressed->length();
+                while(cached_bytes > max_cached_bytes && !recently_used.empty()) {
+                    auto oldest = entries.find(recently_used.front());
+                    cached_bytes -= oldest->second.body->length();
+                    entries.erase(oldest);
+                    recently_used.pop_front();
+                }
+                recently_used.push_back(key);
+                entries.emplace(std::move(key), entry { compressed, std::prev(recently_used.end()) });
+            }
+            return compressed;
+        }
+
+        void compression_cache::update() {
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "../context.hpp"
+#include <list>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace s90 {
+    namespace httpd {
+
+        /// @brief Content coding of a response body
+        enum class content_coding {
+            identity,
+            gzip,
+            deflate
+        };
+
+        /// @brief Smallest body worth compressing, below that the headers outweigh what's saved
+        constexpr size_t min_compressed_length = 1024;
+
+        /// @brief Compression level of responses, compressing per request has to stay cheap
+        constexpr int response_compression_level = 1;
+
+        /// @brief Pick content coding out of Accept-Encoding, gzip wins over deflate at the same quality
+        /// @param accept_encoding Accept-Encoding header value
+        /// @return coding, identity if the client accepts neither
+        content_coding negotiate_coding(std::string_view accept_encoding);
+
+        /// @brief Check if the content type is one that compresses well, i.e. text, JSON or SVG
+        /// @param content_type Content-Type header value, empty if none
+        /// @return true if compressible
+        bool compressible_type(std::string_view content_type);
+
+        /// @brief Get the name of coding as used in Content-Encoding
+        /// @param coding coding
+        /// @return name
+        const char *coding_name(content_coding coding);
+
+        /// @brief Compressed response bodies of the worker, remembered by hash of the content they
+        /// were compressed from, so identical renders of a page aren't compressed over and over
+        class compression_cache : public storable {
+            /// @brief Most bytes of compressed bodies kept, least recently used ones go first
+            static constexpr size_t max_cached_bytes = 16 * 1024 * 1024;
+
+            struct entry {
+                ptr<const std::string> body;
+                std::list<std::string>::iterator order;
+            };
+
+            dict<std::string, entry> entries;
+            std::list<std::string> recently_used;
+            size_t cached_bytes = 0;
+
+        public:
+            /// @brief Get the cache of the worker
+            /// @param ctx global context
+            /// @return cache
+            static ptr<compression_cache> local(icontext *ctx);
+
+            /// @brief Compress body that may be split into several buffers
+            /// @param body body buffers in order
+            /// @param coding gzip or deflate
+            /// @param memoize true to look the result up by content hash and remember it
+            /// @return compressed body or nullptr on failure
+            ptr<const std::string> compress(std::span<const std::string> body, content_coding coding, bool memoize);
+
+            void update() override;
+        };
+    }
+}
@@ -1,42 +1,289 @@
 #include "environment.hpp"
 #include "page.hpp"
+#include "compression.hpp"
 #include "../util/util.hpp"
 #include "../cache/cache.hpp"
 #include <cctype>
 #include <cstring>
 #include <algorithm>
+#include <charconv>
+#include <functional>
 #include <ranges>
+#include <fstream>
 #include <80s/crypto.h>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define FILE_OPEN(path) _open(path, _O_RDONLY | _O_BINARY)
+#else
+#include <fcntl.h>
+#define FILE_OPEN(path) open(path, O_RDONLY | O_CLOEXEC)
+#endif
+
 namespace s90 {
     namespace httpd {
-        aiopromise<std::string> environment::http_response(bool with_content_length) {
-            std::string rendered;
-            if(!redirects)
-                rendered = std::move(co_await output_context->finalize());
+        static void append_chunk(std::string& out, std::string_view data) {
+            if(data.empty()) return;
+            char size[20];
+            auto [end, _] = std::to_chars(size, size + sizeof(size), data.length(), 16);
+            out.append(size, end);
+            out += "\r\n";
+            out += data;
+            out += "\r\n";
+        }
 
+        aiopromise<std::string> environment::http_response(bool with_content_length) {
+            auto segments = co_await http_response_segments(with_content_length);
+            // the body that would follow the head on its own is joined with it too
+            if(shared_body) {
+                segments.emplace_back(*shared_body);
+                shared_body.reset();
+            }
+            if(segments.size() == 1) co_return std::move(segments.front());
+            size_t length = 0;
+            for(const auto& segment : segments) length += segment.length();
             std::string response;
-            if(with_content_length) {
-                output_headers["content-length"] = std::to_string(rendered.length());
+            response.reserve(length);
+            for(const auto& segment : segments) response += segment;
+            co_return std::move(response);
+        }
+
+        ptr<const std::string> environment::encode_body(std::span<const std::string> body, size_t length) {
+            if(length < min_compressed_length || output_headers.contains("content-encoding") || !global_context_ptr) return nullptr;
+            auto type = output_headers.find("content-type");
+            if(!compressible_type(type == output_headers.end() ? std::string_view() : std::string_view(type->second))) return nullptr;
+            auto accept_encoding = header_view("accept-encoding");
+            auto coding = accept_encoding ? negotiate_coding(*accept_encoding) : content_coding::identity;
+            // the response depends on Accept-Encoding whether it ends up compressed or not
+            auto& vary = output_headers["vary"];
+            if(vary.empty()) {
+                vary = "accept-encoding";
+            } else {
+                std::string lower_vary = vary;
+                std::transform(lower_vary.begin(), lower_vary.end(), lower_vary.begin(), [](auto c) -> auto { return std::tolower(c); });
+                if(lower_vary.find("accept-encoding") == std::string::npos) vary += ", accept-encoding";
+            }
+            if(coding == content_coding::identity) return nullptr;
+
+            // responses that are the same for everyone are likely to be rendered the same again
+            bool memoize = http_method == "GET" && status_line.starts_with("200") && !output_headers.contains("set-cookie");
+            auto encoded = compression_cache::local(global_context_ptr)->compress(body, coding, memoize);
+            if(!encoded) return nullptr;
+            output_headers["content-encoding"] = coding_name(coding);
+            return encoded;
+        }
+
+        aiopromise<std::vector<std::string>> environment::http_response_segments(bool with_content_length) {
+            // head comes first, it's filled in once the length of the body is known
+            std::vector<std::string> segments(1);
+            size_t length = 0;
+            bool chunked = streamed && with_content_length && !redirects && !attached_file;
+            if(attached_file) {
+                // small files go right after the head, larger ones are sent on their own without a copy
+                length = attached_file->length;
+                length_estimate += attached_file->variant->fields.length();
+                auto& contents = attached_file->variant->contents;
+                if(attached_file->pending && contents && length <= max_inlined_file_size) {
+                    segments.emplace_back(std::string_view(*contents).substr(attached_file->offset, length));
+                    attached_file->pending = false;
+                }
+            } else if(chunked) {
+                // whatever is rendered already goes out along with the head, the rest follows in chunks
+                std::string rendered;
+                output_done = output_context->drain(rendered);
+                output_headers["transfer-encoding"] = "chunked";
+                length = rendered.length();
+                if(length > 0) segments.emplace_back(std::move(rendered));
+            } else if(!redirects) {
+                length = co_await output_context->finalize(segments);
+                // cached output isn't in the context, it's in the shared body already
+                if(shared_body) length = shared_body->length();
+                if(with_content_length) {
+                    auto body = shared_body ? std::span<const std::string>(shared_body.get(), 1) : std::span<const std::string>(segments).subspan(1);
+                    auto encoded = encode_body(body, length);
+                    if(encoded) {
+                        segments.resize(1);
+                        length = encoded->length();
+                        shared_body = std::move(encoded);
+                    }
+                }
+                // shared body follows the head without being copied, unless it's small enough to go along
+                if(shared_body && length <= max_inlined_file_size) {
+                    segments.emplace_back(*shared_body);
+                    shared_body.reset();
+                }
+            }
+
+            // responses that never have a body don't tell its length either
+            if(with_content_length && !chunked && !status_line.starts_with("304") && !status_line.starts_with("204")) {
+                output_headers["content-length"] = std::to_string(length);
             }
-            length_estimate = length_estimate + 9 + status_line.length() + 4 + rendered.length();
-            response.reserve(length_estimate);
 
-            response += "HTTP/1.1 ";
-            response += status_line;
-            response += "\r\n";
+            auto& head = segments.front();
+            length_estimate = length_estimate + 9 + status_line.length() + 4;
+            head.reserve(length_estimate + 32);
+
+            head += "HTTP/1.1 ";
+            head += status_line;
+            head += "\r\n";
             
             for(const auto& [k, v] : output_headers) {
-                response += k;
-                response += ": ";
-                response += v;
-                response += "\r\n";
+                head += k;
+                head += ": ";
+                head += v;
+                head += "\r\n";
             }
+            if(attached_file) head += attached_file->variant->fields;
             
-            response += "\r\n";
-            if(rendered.length() > 0)
-                response += rendered;
-            co_return std::move(response);
+            head += "\r\n";
+            if(chunked) {
+                // the first chunk is framed around the rendered output, so it doesn't need to be copied
+                std::string trailer;
+                if(length > 0) {
+                    char size[20];
+                    auto [end, _] = std::to_chars(size, size + sizeof(size), length, 16);
+                    head.append(size, end);
+                    head += "\r\n";
+                    trailer = "\r\n";
+                }
+                if(output_done) trailer += "0\r\n\r\n";
+                if(!trailer.empty()) segments.emplace_back(std::move(trailer));
+            }
+            co_return std::move(segments);
+        }
+
+        aiopromise<ptr<const std::string>> environment::http2_response(hpack::header_list& response_headers) {
+            std::string rendered;
+            bool chunked = streamed && !redirects && !attached_file;
+            size_t length = 0;
+            if(attached_file) {
+                // DATA frames are sent from memory anyway, so files not kept in memory are read here
+                length = attached_file->length;
+                auto& contents = attached_file->variant->contents;
+                if(attached_file->pending && contents) {
+                    rendered = std::string_view(*contents).substr(attached_file->offset, length);
+                } else if(attached_file->pending) {
+                    std::ifstream is(attached_file->variant->path, std::ios_base::binary);
+                    rendered.resize(length);
+                    if(!is.is_open() || !is.seekg(attached_file->offset) || !is.read(rendered.data(), length)) {
+                        status_line = "500 Internal server error";
+                        rendered.clear();
+                        length = 0;
+                    }
+                }
+                attached_file->pending = false;
+            } else if(chunked) {
+                // DATA frames end the stream, so a streamed response needs no length at all
+                output_done = output_context->drain(rendered);
+            } else if(!redirects) {
+                rendered = std::move(co_await output_context->finalize());
+                // cached output isn't in the context, it's in the shared body already
+                auto body = shared_body ? std::span<const std::string>(shared_body.get(), 1) : std::span<const std::string>(&rendered, 1);
+                auto encoded = encode_body(body, body.front().length());
+                if(encoded) {
+                    shared_body = std::move(encoded);
+                    rendered.clear();
+                }
+            }
+            if(!attached_file) length = shared_body ? shared_body->length() : rendered.length();
+
+            response_headers.clear();
+            response_headers.reserve(output_headers.size() + 2);
+            response_headers.emplace_back(":status", status_line.substr(0, status_line.find(' ')));
+            for(const auto& [k, v] : output_headers) {
+                std::string key = k;
+                std::transform(key.begin(), key.end(), key.begin(), [](auto c) -> auto { return std::tolower(c); });
+                // connection specific headers are not allowed in HTTP/2 (RFC 9113 section 8.2.2)
+                if(key == "connection" || key == "keep-alive" || key == "proxy-connection" || key == "transfer-encoding"
+                    || key == "upgrade" || key == "content-length") continue;
+                response_headers.emplace_back(std::move(key), v);
+            }
+            if(attached_file) {
+                std::string_view fields = attached_file->variant->fields;
+                while(!fields.empty()) {
+                    auto end = fields.find("\r\n");
+                    auto separator = fields.find(": ");
+                    response_headers.emplace_back(std::string(fields.substr(0, separator)), std::string(fields.substr(separator + 2, end - separator - 2)));
+                    fields.remove_prefix(end + 2);
+                }
+            }
+            if(!chunked && !status_line.starts_with("304") && !status_line.starts_with("204")) {
+                response_headers.emplace_back("content-length", std::to_string(length));
+            }
+            // DATA frames are cut straight out of the shared body
+            if(shared_body) co_return std::move(shared_body);
+            co_return ptr_new<const std::string>(std::move(rendered));
+        }
+
+        void environment::write_file(ptr<const static_file> file, const static_file::variant& variant, uint64_t offset, size_t length, bool send) {
+            attached_file = file_body { std::move(file), &variant, offset, length, send && length > 0 };
+        }
+
+        void environment::write_cached(const cached_page& page) {
+            status_line = page.status_line;
+            for(const auto& [k, v] : page.headers) {
+                length_estimate += k.length() + v.length() + 4;
+                output_headers[k] = v;
+            }
+            shared_body = page.body;
+        }
+
+        aiopromise<ptr<const cached_page>> environment::capture() {
+            if(!status_line.starts_with("200") || redirects || streamed || attached_file || output_headers.contains("set-cookie")) co_return nullptr;
+            auto page = ptr_new<cached_page>();
+            std::vector<std::string> segments;
+            auto length = co_await output_context->finalize(segments);
+            std::string body;
+            body.reserve(length);
+            for(const auto& segment : segments) body += segment;
+            page->body = ptr_new<const std::string>(std::move(body));
+            page->status_line = status_line;
+            page->headers.assign(output_headers.begin(), output_headers.end());
+            // finalizing took the output out of the context, it's sent from the same buffer the cache keeps
+            shared_body = page->body;
+            co_return page;
+        }
+
+        bool environment::sends_body() const {
+            return shared_body || (attached_file && attached_file->pending);
+        }
+
+        aiopromise<bool> environment::send_body(std::shared_ptr<iafd> out) {
+            if(shared_body) {
+                auto body = std::move(shared_body);
+                co_return co_await out->write(std::move(body));
+            }
+            if(!sends_body()) co_return true;
+            attached_file->pending = false;
+            auto& file = *attached_file;
+            auto& contents = file.variant->contents;
+            if(contents) {
+                if(file.offset == 0 && file.length == contents->length()) co_return co_await out->write(contents);
+                co_return co_await out->write(std::string_view(*contents).substr(file.offset, file.length));
+            }
+            int handle = FILE_OPEN(file.variant->path.c_str());
+            if(handle < 0) co_return false;
+            co_return co_await out->write_file(handle, file.offset, file.length);
+        }
+
+        bool environment::streaming() const {
+            return !output_done;
+        }
+
+        aiopromise<std::string> environment::next_output() {
+            co_await output_context->wait();
+            std::string part;
+            output_done = output_context->drain(part);
+            co_return std::move(part);
+        }
+
+        aiopromise<std::string> environment::http_chunk() {
+            auto part = co_await next_output();
+            std::string chunk;
+            append_chunk(chunk, part);
+            if(output_done) chunk += "0\r\n\r\n";
+            co_return std::move(chunk);
         }
 
         void environment::clear() {
@@ -44,6 +291,33 @@ namespace s90 {
             output_headers.clear();
             output_context->clear();
             length_estimate = 0;
+            streamed = false;
+            output_done = true;
+            attached_file.reset();
+            shared_body.reset();
+        }
+
+        void environment::recycle() {
+            // render context still referred to from elsewhere can't be shared with the next request
+            if(output_context.use_count() > 1) output_context = ptr_new<render_context>();
+            clear();
+            redirects = false;
+            local_context_ptr = nullptr;
+            global_context_ptr = nullptr;
+            http_method = "GET";
+            endpoint_path = "/";
+            enc_base.clear();
+            peer_name.clear();
+            fd.reset();
+            request_head.clear();
+            header_table.clear();
+            query_offset = query_length = 0;
+            signed_params.clear();
+            query_params.clear();
+            query_parsed = signed_parsed = false;
+            http_body.clear();
+            route = route_match {};
+            http2_stream = false;
         }
 
         void environment::disable() const {
@@ -56,16 +330,25 @@ namespace s90 {
 
         std::optional<std::string> environment::header(std::string&& key) const {
             std::transform(key.begin(), key.end(), key.begin(), [](auto c) -> auto { return std::tolower(c); });
-            auto it = headers.find(std::move(key));
-            if(it == headers.end()) return {};
-            return it->second;
+            auto value = header_view(key);
+            if(!value) return {};
+            return std::string(*value);
+        }
+
+        std::optional<std::string_view> environment::header_view(std::string_view key) const {
+            // the last occurence wins, same as if it overwrote the previous ones
+            for(auto it = header_table.rbegin(); it != header_table.rend(); ++it) {
+                if(std::string_view(request_head).substr(it->key_offset, it->key_length) == key)
+                    return std::string_view(request_head).substr(it->value_offset, it->value_length);
+            }
+            return {};
         }
 
         void environment::header(const std::string& key, const std::string& value) {
             std::string lower_key = key;
             std::transform(lower_key.begin(), lower_key.end(), lower_key.begin(), [](auto c) -> auto { return std::tolower(c); });
             length_estimate += key.length() + 4 + value.length();
-            output_headers[key] = value;
+            output_headers[std::move(lower_key)] = value;
         }
 
         void environment::header(std::string&& key, std::string&& value) {
@@ -107,17 +390,25 @@ namespace s90 {
         }
 
         std::optional<std::string> environment::query(std::string&& key) const {
-            auto it = query_params.find(std::move(key));
-            if(it == query_params.end()) return {};
+            const auto& params = query();
+            auto it = params.find(std::move(key));
+            if(it == params.end()) return {};
             return it->second;
         }
         
         std::optional<std::string> environment::signed_query(std::string&& key) const {
-            auto it = signed_params.find(std::move(key));
-            if(it == signed_params.end()) return {};
+            const auto& params = signed_query();
+            auto it = params.find(std::move(key));
+            if(it == params.end()) return {};
             return it->second;
         }
 
+        std::optional<std::string_view> environment::param(std::string_view key) const {
+            auto value = route.find(key);
+            if(!value) return {};
+            return *value;
+        }
+
         dict<std::string, std::string> environment::cookies() const {
             dict<std::string, std::string> all;
             auto hdr = header("cookie");
@@ -134,10 +425,30 @@ namespace s90 {
         }
 
         const dict<std::string, std::string>& environment::query() const {
+            if(!query_parsed) {
+                query_parsed = true;
+                if(query_length > 0)
+                    query_params = util::parse_query_string(std::string_view(request_head).substr(query_offset, query_length));
+            }
             return query_params;
         }
 
         const dict<std::string, std::string>& environment::signed_query() const {
+            if(!signed_parsed) {
+                signed_parsed = true;
+                // if there is encrypted query, try to decrypt it using (enc_base + endpoint) as a key
+                const auto& params = query();
+                auto e_it = params.find("e");
+                if(enc_base.length() >= 16 && e_it != params.end()) {
+                    auto decoded = util::from_b64(e_it->second);
+                    if(decoded.has_value()) {
+                        auto decrypted = util::cipher(*decoded, enc_base + endpoint_path, false, false);
+                        if(decrypted.has_value()) {
+                            signed_params = util::parse_query_string(*decrypted);
+                        }
+                    }
+                }
+            }
             return signed_params;
         }
 
@@ -203,6 +514,10 @@ namespace s90 {
             redirects = true;
         }
 
+        void environment::stream_output(bool enable) {
+            streamed = enable;
+        }
+
         void *const environment::local_context() const {
             return local_context_ptr;
         }
@@ -254,7 +569,8 @@ namespace s90 {
     
         aiopromise<std::expected<bool, std::string>> environment::websocket_upgrade() {
             auto secKey = header("sec-websocket-key");
-            if(!secKey) {
+            // a HTTP/2 stream can't take over the connection it shares with others
+            if(!secKey || http2_stream) {
                 co_return std::unexpected(errors::PROTOCOL_ERROR);
             }
             
@@ -325,7 +641,7 @@ namespace s90 {
                             message[i] = (char)((((unsigned char)message[i])& 255) ^ mask[i & 3]);
                     }
                     response += message;
-                    if(!co_await fd->write(response))
+                    if(!co_await fd->write(std::move(response)))
                         co_return std::unexpected(errors::PROTOCOL_ERROR);
                 } else if(opcode == 8) {
                     fd->close();
@@ -367,7 +683,7 @@ namespace s90 {
                 message += (((uint8_t)data[i]) & 255) ^ mask[i & 3];
             }
 
-            return fd->write(message);
+            return fd->write(std::move(message));
         }
 
         std::string environment::remote_ip() const {
@@ -381,21 +697,48 @@ namespace s90 {
             http_body = std::move(data);
         }
 
-        void environment::write_header(std::string&& key, std::string&& value) {
-            std::transform(key.begin(), key.end(), key.begin(), [](auto c) -> auto { return std::tolower(c); });
-            headers[std::move(key)] = std::move(value);
+        std::string_view environment::write_request_head(std::string_view head) {
+            request_head = head;
+            header_table.reserve(16);
+            return request_head;
         }
 
-        void environment::write_method(std::string&& method) {
-            http_method = std::move(method);
+        std::optional<size_t> environment::locate(std::string_view part) const {
+            std::less<const char*> before;
+            const char *begin = request_head.data(), *end = begin + request_head.length();
+            if(before(part.data(), begin) || before(end, part.data() + part.length())) return {};
+            return part.data() - begin;
         }
 
-        void environment::write_query(dict<std::string, std::string>&& qs) {
-            query_params = std::move(qs);
+        size_t environment::slice(std::string_view part) {
+            auto offset = locate(part);
+            if(offset) return *offset;
+            request_head += part;
+            return request_head.length() - part.length();
         }
 
-        void environment::write_signed_query(dict<std::string, std::string>&& qs) {
-            signed_params = std::move(qs);
+        void environment::write_header(std::string_view key, std::string_view value) {
+            // appending either of them can move the head, so both get located before that
+            auto key_within = locate(key), value_within = locate(value);
+            size_t key_offset = key_within ? *key_within : slice(key);
+            size_t value_offset = value_within ? *value_within : slice(value);
+            std::transform(
+                request_head.begin() + key_offset, request_head.begin() + key_offset + key.length(),
+                request_head.begin() + key_offset, [](auto c) -> auto { return std::tolower(c); }
+            );
+            header_table.emplace_back(header_slice {
+                (uint32_t)key_offset, (uint32_t)key.length(), (uint32_t)value_offset, (uint32_t)value.length()
+            });
+        }
+
+        void environment::write_method(std::string&& method) {
+            http_method = std::move(method);
+        }
+
+        void environment::write_query(std::string_view query_string) {
+            query_offset = slice(query_string);
+            query_length = query_string.length();
+            query_parsed = signed_parsed = false;
         }
 
         void environment::write_local_context(void *ctx) {
@@ -422,5 +765,13 @@ namespace s90 {
             fd = fdesc;
         }
 
+        void environment::write_http2() {
+            http2_stream = true;
+        }
+
+        void environment::write_route(route_match&& match) {
+            route = std::move(match);
+        }
+
     }
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
 #pragma once
 #include "../context.hpp"
 #include "render_context.hpp"
+#include "hpack.hpp"
+#include "router.hpp"
+#include "page_cache.hpp"
+#include "static_files.hpp"
+#include <span>
 #include "../orm/json.hpp"
 #include <string>
 #include <expected>
@@ -10,6 +15,7 @@ namespace s90 {
     namespace httpd {
         class page;
         class httpd_server;
+        class http2_session;
 
         enum class encryption {
             none,
@@ -66,6 +72,11 @@ namespace s90 {
             /// @return argument value
             virtual std::optional<std::string> signed_query(std::string&& key) const = 0;
 
+            /// @brief Get a path parameter captured by `:name` or `*name` segment of the page's route
+            /// @param key parameter name
+            /// @return parameter value, valid as long as the environment
+            virtual std::optional<std::string_view> param(std::string_view key) const = 0;
+
             /// @brief Get entire query
             /// @return query dictionary
             virtual const dict<std::string, std::string>& query() const = 0;
@@ -109,6 +120,12 @@ namespace s90 {
             /// @param target redirect URL
             virtual void redirect(std::string_view target) = 0;
 
+            /// @brief Stream the output instead of sending it at once when the page is rendered. Headers
+            /// and status must be set by the time the page returns, the output rendered so far is sent
+            /// right away and deferred writes follow as they resolve (chunked in HTTP/1.1)
+            /// @param enable true to stream
+            virtual void stream_output(bool enable = true) = 0;
+
             /// @brief Get the local context (context created by initialize of main.so)
             /// @return local context
             virtual void *const local_context() const = 0;
@@ -238,10 +255,42 @@ namespace s90 {
             std::string enc_base = "";
             std::string peer_name = "";
             std::shared_ptr<iafd> fd;
-            dict<std::string, std::string> signed_params;
-            dict<std::string, std::string> query_params;
-            dict<std::string, std::string> headers;
+
+            /// @brief Position of a header field within request_head
+            struct header_slice {
+                uint32_t key_offset;
+                uint32_t key_length;
+                uint32_t value_offset;
+                uint32_t value_length;
+            };
+
+            // the request is copied once into request_head, header fields and the query string are
+            // just positions within it, query parameters get decoded only when asked for
+            std::string request_head;
+            std::vector<header_slice> header_table;
+            size_t query_offset = 0;
+            size_t query_length = 0;
+            mutable dict<std::string, std::string> signed_params;
+            mutable dict<std::string, std::string> query_params;
+            mutable bool query_parsed = false;
+            mutable bool signed_parsed = false;
             std::string http_body;
+            route_match route;
+            bool http2_stream = false;
+            bool streamed = false;
+            bool output_done = true;
+
+            /// @brief File sent in place of the rendered output
+            struct file_body {
+                ptr<const static_file> file;
+                const static_file::variant *variant;
+                uint64_t offset = 0;
+                size_t length = 0;
+                bool pending = true;
+            };
+            std::optional<file_body> attached_file;
+            /// @brief Body kept in a buffer shared with a cache, i.e. cached page output or memoized compressed output
+            ptr<const std::string> shared_body;
         public:
             void disable() const override;
             void clear() override;
@@ -262,6 +311,7 @@ namespace s90 {
 
             std::optional<std::string> query(std::string&& key) const override;
             std::optional<std::string> signed_query(std::string&& key) const override;
+            std::optional<std::string_view> param(std::string_view key) const override;
 
             const std::string& body() const override;
             dict<std::string, std::string> form() const override;
@@ -271,6 +321,7 @@ namespace s90 {
             
             ptr<irender_context> output() const override;
             void redirect(std::string_view target) override;
+            void stream_output(bool enable = true) override;
 
             void *const local_context() const override;
             icontext *const global_context() const override;
@@ -303,10 +354,40 @@ namespace s90 {
 
         private:
             friend class s90::httpd::httpd_server;
+            friend class s90::httpd::http2_session;
             void write_method(std::string&& method);
-            void write_header(std::string&& key, std::string&& value);
-            void write_query(dict<std::string, std::string>&& qs);
-            void write_signed_query(dict<std::string, std::string>&& qs);
+
+            /// @brief Reset the environment for the next request, unlike clear() this resets the
+            /// request too, buffers keep their capacity
+            void recycle();
+            /// @brief Store the raw request head, it is the only copy made of it
+            /// @param head request line and header fields
+            /// @return view of the stored copy, header fields and query string can be sliced from it
+            std::string_view write_request_head(std::string_view head);
+
+            /// @brief Add request header, key gets lowercased
+            /// @param key header name, either a slice of the stored head or any other string
+            /// @param value header value, the same as for key applies
+            void write_header(std::string_view key, std::string_view value);
+
+            /// @brief Set query string that gets decoded once query() is first called
+            /// @param query_string query string, either a slice of the stored head or any other string
+            void write_query(std::string_view query_string);
+
+            /// @brief Get request header without copying it
+            /// @param key lowercase header name
+            /// @return header value, valid as long as the environment
+            std::optional<std::string_view> header_view(std::string_view key) const;
+
+            /// @brief Get position of a string within request_head
+            /// @param part string to locate
+            /// @return offset within request_head or nothing if it lies elsewhere
+            std::optional<size_t> locate(std::string_view part) const;
+
+            /// @brief Get position of a string within request_head, appending it if it isn't there
+            /// @param part string to locate
+            /// @return offset within request_head
+            size_t slice(std::string_view part);
             void write_body(std::string&& data);
             void write_local_context(void *ctx);
             void write_global_context(icontext *ctx);
@@ -314,6 +395,64 @@ namespace s90 {
             void write_enc_base(std::string_view enc_base);
             void write_peer(const std::string& peer_name);
             void write_fd(std::shared_ptr<iafd> fd);
+            void write_http2();
+            void write_route(route_match&& match);
+
+            /// @brief Compress the body if the client accepts it and it's worth it, sets Content-Encoding
+            /// @param body body buffers
+            /// @param length body length
+            /// @return compressed body or nullptr to send the body as it is
+            ptr<const std::string> encode_body(std::span<const std::string> body, size_t length);
+
+            /// @brief Render HTTP/1.1 response without joining it, so it can go out in a single gather write
+            /// @param with_content_length include content-length header
+            /// @return head followed by the body in buffers as it was rendered
+            aiopromise<std::vector<std::string>> http_response_segments(bool with_content_length = true);
+
+            /// @brief Render the output of a HTTP/2 stream, framing is up to the session
+            /// @param response_headers output for :status and the headers allowed in HTTP/2
+            /// @return response body, possibly shared with a cache
+            aiopromise<ptr<const std::string>> http2_response(hpack::header_list& response_headers);
+
+            /// @brief Respond with a file instead of the rendered output, the file isn't copied into the output
+            /// and its header fields are added to the ones set so far
+            /// @param file file
+            /// @param variant variant of the file to be sent
+            /// @param offset first byte to be sent
+            /// @param length number of bytes to be sent
+            /// @param send false to send just the response head, i.e. for HEAD requests
+            void write_file(ptr<const static_file> file, const static_file::variant& variant, uint64_t offset, size_t length, bool send = true);
+
+            /// @brief Respond with cached output of a page in place of rendering it
+            /// @param page output
+            void write_cached(const cached_page& page);
+
+            /// @brief Take the finalized output of the rendered page, so it can be cached, the output
+            /// is sent as it would be otherwise
+            /// @return output, nullptr if the response is specific to the request, i.e. it sets a cookie
+            aiopromise<ptr<const cached_page>> capture();
+
+            /// @brief Check if there is a file or a shared body to be sent after the HTTP/1.1 response head
+            /// @return true if there is
+            bool sends_body() const;
+
+            /// @brief Send the body that didn't go out along with the HTTP/1.1 response head without copying
+            /// it, files are sent directly from disk if they aren't kept in memory
+            /// @param out connection
+            /// @return true on success
+            aiopromise<bool> send_body(std::shared_ptr<iafd> out);
+
+            /// @brief Check if a streamed response still has output to come after the response head
+            /// @return true if there is more output
+            bool streaming() const;
+
+            /// @brief Wait for the next part of a streamed response
+            /// @return rendered output
+            aiopromise<std::string> next_output();
+
+            /// @brief Wait for the next part of a streamed response, encoded as HTTP/1.1 chunk
+            /// @return chunk, the last one is followed by the terminating chunk
+            aiopromise<std::string> http_chunk();
         };
     }
 }
\ No newline at end of file
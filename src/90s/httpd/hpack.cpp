@@ -0,0 +1,367 @@
+#include "hpack.hpp"
+#include <algorithm>
+
+namespace s90 {
+    namespace httpd {
+        namespace hpack {
+
+            static const header static_table[] = {
+                { ":authority", "" },
+                { ":method", "GET" },
+                { ":method", "POST" },
+                { ":path", "/" },
+                { ":path", "/index.html" },
+                { ":scheme", "http" },
+                { ":scheme", "https" },
+                { ":status", "200" },
+                { ":status", "204" },
+                { ":status", "206" },
+                { ":status", "304" },
+                { ":status", "400" },
+                { ":status", "404" },
+                { ":status", "500" },
+                { "accept-charset", "" },
+                { "accept-encoding", "gzip, deflate" },
+                { "accept-language", "" },
+                { "accept-ranges", "" },
+                { "accept", "" },
+                { "access-control-allow-origin", "" },
+                { "age", "" },
+                { "allow", "" },
+                { "authorization", "" },
+                { "cache-control", "" },
+                { "content-disposition", "" },
+                { "content-encoding", "" },
+                { "content-language", "" },
+                { "content-length", "" },
+                { "content-location", "" },
+                { "content-range", "" },
+                { "content-type", "" },
+                { "cookie", "" },
+                { "date", "" },
+                { "etag", "" },
+                { "expect", "" },
+                { "expires", "" },
+                { "from", "" },
+                { "host", "" },
+                { "if-match", "" },
+                { "if-modified-since", "" },
+                { "if-none-match", "" },
+                { "if-range", "" },
+                { "if-unmodified-since", "" },
+                { "last-modified", "" },
+                { "link", "" },
+                { "location", "" },
+                { "max-forwards", "" },
+                { "proxy-authenticate", "" },
+                { "proxy-authorization", "" },
+                { "range", "" },
+                { "referer", "" },
+                { "refresh", "" },
+                { "retry-after", "" },
+                { "server", "" },
+                { "set-cookie", "" },
+                { "strict-transport-security", "" },
+                { "transfer-encoding", "" },
+                { "user-agent", "" },
+                { "vary", "" },
+                { "via", "" },
+                { "www-authenticate", "" },
+            };
+
+            constexpr size_t static_table_size = sizeof(static_table) / sizeof(static_table[0]);
+
+            // code lengths of symbols 0-255 and EOS (RFC 7541 appendix B), the code is canonical,
+            // so the codes themselves follow from the lengths
+            static const uint8_t huffman_lengths[257] = {
+                13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+                28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+                6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+                5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+                13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+                7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+                15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+                6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+                20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+                24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+                22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+                21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+                26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+                19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+                20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+                26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+                30
+            };
+
+            constexpr size_t huffman_max_length = 30;
+            constexpr uint16_t huffman_eos = 256;
+
+            struct huffman_code {
+                // code of every symbol, used for encoding
+                uint32_t codes[257];
+                // for every length, the first code of that length, number of such codes and where
+                // their symbols start in `symbols`, used for decoding
+                uint32_t first[huffman_max_length + 1];
+                uint32_t count[huffman_max_length + 1];
+                uint32_t offset[huffman_max_length + 1];
+                uint16_t symbols[257];
+
+                huffman_code() {
+                    uint32_t code = 0;
+                    size_t n = 0;
+                    for(size_t length = 1; length <= huffman_max_length; length++) {
+                        first[length] = code;
+                        count[length] = 0;
+                        offset[length] = n;
+                        for(uint16_t symbol = 0; symbol < 257; symbol++) {
+                            if(huffman_lengths[symbol] != length) continue;
+                            codes[symbol] = code++;
+                            symbols[n++] = symbol;
+                            count[length]++;
+                        }
+                        code <<= 1;
+                    }
+                }
+            };
+
+            static const huffman_code huffman;
+
+            bool huffman_decode(std::string_view data, std::string& out) {
+                uint32_t code = 0;
+                size_t length = 0;
+                for(unsigned char c : data) {
+                    for(int bit = 7; bit >= 0; bit--) {
+                        code = (code << 1) | ((c >> bit) & 1);
+                        length++;
+                        if(length > huffman_max_length) return false;
+                        if(code - huffman.first[length] < huffman.count[length]) {
+                            uint16_t symbol = huffman.symbols[huffman.offset[length] + code - huffman.first[length]];
+                            if(symbol == huffman_eos) return false;
+                            out += (char)symbol;
+                            code = 0;
+                            length = 0;
+                        }
+                    }
+                }
+                // whatever remains must be a prefix of EOS, that is all ones and shorter than a byte
+                return length < 8 && code == (1U << length) - 1;
+            }
+
+            void huffman_encode(std::string_view data, std::string& out) {
+                uint64_t bits = 0;
+                size_t n_bits = 0;
+                for(unsigned char c : data) {
+                    bits = (bits << huffman_lengths[c]) | huffman.codes[c];
+                    n_bits += huffman_lengths[c];
+                    while(n_bits >= 8) {
+                        n_bits -= 8;
+                        out += (char)(bits >> n_bits);
+                    }
+                }
+                if(n_bits > 0) {
+                    out += (char)((bits << (8 - n_bits)) | (0xFF >> n_bits));
+                }
+            }
+
+            size_t huffman_length(std::string_view data) {
+                size_t n_bits = 0;
+                for(unsigned char c : data) n_bits += huffman_lengths[c];
+                return (n_bits + 7) / 8;
+            }
+
+            static size_t entry_size(std::string_view name, std::string_view value) {
+                // every entry is counted with 32 bytes of overhead (RFC 7541 section 4.1)
+                return name.length() + value.length() + 32;
+            }
+
+            void table::evict(size_t room) {
+                while(!entries.empty() && used + room > capacity) {
+                    used -= entry_size(entries.back().first, entries.back().second);
+                    entries.pop_back();
+                }
+            }
+
+            void table::resize(size_t new_capacity) {
+                capacity = new_capacity;
+                evict(0);
+            }
+
+            void table::insert(std::string_view name, std::string_view value) {
+                size_t size = entry_size(name, value);
+                // the name may refer to an entry that is about to be evicted
+                header entry { std::string(name), std::string(value) };
+                evict(size);
+                if(size > capacity) return;
+                entries.emplace_front(std::move(entry));
+                used += size;
+            }
+
+            const header* table::at(size_t index) const {
+                if(index == 0) return nullptr;
+                if(index <= static_table_size) return &static_table[index - 1];
+                index -= static_table_size + 1;
+                if(index >= entries.size()) return nullptr;
+                return &entries[index];
+            }
+
+            size_t table::find(std::string_view name, std::string_view value, bool& exact) const {
+                size_t name_match = 0;
+                exact = false;
+                for(size_t i = 0; i < static_table_size; i++) {
+                    if(static_table[i].first != name) continue;
+                    if(static_table[i].second == value) {
+                        exact = true;
+                        return i + 1;
+                    }
+                    if(!name_match) name_match = i + 1;
+                }
+                for(size_t i = 0; i < entries.size(); i++) {
+                    if(entries[i].first != name) continue;
+                    if(entries[i].second == value) {
+                        exact = true;
+                        return static_table_size + i + 1;
+                    }
+                    if(!name_match) name_match = static_table_size + i + 1;
+                }
+                return name_match;
+            }
+
+            static void encode_int(std::string& out, uint64_t value, int prefix_bits, uint8_t flags) {
+                uint64_t max_prefix = (1 << prefix_bits) - 1;
+                if(value < max_prefix) {
+                    out += (char)(flags | value);
+                    return;
+                }
+                out += (char)(flags | max_prefix);
+                value -= max_prefix;
+                while(value >= 128) {
+                    out += (char)((value & 127) | 128);
+                    value >>= 7;
+                }
+                out += (char)value;
+            }
+
+            static bool decode_int(std::string_view& data, int prefix_bits, uint64_t& value) {
+                if(data.empty()) return false;
+                uint64_t max_prefix = (1 << prefix_bits) - 1;
+                value = ((uint8_t)data[0]) & max_prefix;
+                data = data.substr(1);
+                if(value < max_prefix) return true;
+                for(int shift = 0; shift < 35; shift += 7) {
+                    if(data.empty()) return false;
+                    uint8_t c = (uint8_t)data[0];
+                    data = data.substr(1);
+                    value += (uint64_t)(c & 127) << shift;
+                    if((c & 128) == 0) return true;
+                }
+                // nothing sensible needs more than 32 bits
+                return false;
+            }
+
+            static void encode_string(std::string& out, std::string_view data) {
+                size_t coded_length = huffman_length(data);
+                if(coded_length < data.length()) {
+                    encode_int(out, coded_length, 7, 0x80);
+                    huffman_encode(data, out);
+                } else {
+                    encode_int(out, data.length(), 7, 0x00);
+                    out += data;
+                }
+            }
+
+            static bool decode_string(std::string_view& data, std::string& out) {
+                if(data.empty()) return false;
+                bool huffman_coded = (((uint8_t)data[0]) & 0x80) != 0;
+                uint64_t length = 0;
+                if(!decode_int(data, 7, length) || length > data.length()) return false;
+                auto literal = data.substr(0, length);
+                data = data.substr(length);
+                if(huffman_coded) return huffman_decode(literal, out);
+                out = literal;
+                return true;
+            }
+
+            std::expected<header_list, std::string> decoder::decode(std::string_view block, size_t max_list_size) {
+                header_list headers;
+                size_t list_size = 0;
+                bool block_start = true;
+                while(!block.empty()) {
+                    uint8_t c = (uint8_t)block[0];
+                    uint64_t index = 0;
+                    header entry;
+                    if(c & 0x80) {
+                        // indexed header field
+                        if(!decode_int(block, 7, index)) return std::unexpected("invalid index");
+                        auto found = dynamic.at(index);
+                        if(!found) return std::unexpected("index out of range");
+                        entry = *found;
+                    } else if((c & 0xE0) == 0x20) {
+                        // dynamic table size update, allowed only at the beginning of a block
+                        if(!block_start || !decode_int(block, 5, index) || index > max_table_size)
+                            return std::unexpected("invalid table size update");
+                        dynamic.resize(index);
+                        continue;
+                    } else {
+                        // literal header field, either with incremental indexing, without indexing
+                        // or never indexed, the latter two differ only for intermediaries
+                        bool incremental = (c & 0xC0) == 0x40;
+                        if(!decode_int(block, incremental ? 6 : 4, index)) return std::unexpected("invalid index");
+                        if(index > 0) {
+                            auto found = dynamic.at(index);
+                            if(!found) return std::unexpected("index out of range");
+                            entry.first = found->first;
+                        } else if(!decode_string(block, entry.first)) {
+                            return std::unexpected("invalid name literal");
+                        }
+                        if(!decode_string(block, entry.second)) return std::unexpected("invalid value literal");
+                        if(incremental) dynamic.insert(entry.first, entry.second);
+                    }
+                    block_start = false;
+                    list_size += entry_size(entry.first, entry.second);
+                    if(list_size > max_list_size) return std::unexpected("header list too large");
+                    headers.emplace_back(std::move(entry));
+                }
+                return headers;
+            }
+
+            void encoder::set_max_table_size(size_t size) {
+                // there is no need to go beyond the default, larger tables would only cost memory
+                size = std::min(size, default_table_size);
+                if(size == table_size) return;
+                table_size = size;
+                dynamic.resize(size);
+                size_update = true;
+            }
+
+            void encoder::encode(std::string& out, std::string_view name, std::string_view value, bool index) {
+                bool exact = false;
+                size_t found = dynamic.find(name, value, exact);
+                if(exact) {
+                    encode_int(out, found, 7, 0x80);
+                    return;
+                }
+                encode_int(out, found, index ? 6 : 4, index ? 0x40 : 0x00);
+                if(!found) encode_string(out, name);
+                encode_string(out, value);
+                if(index) dynamic.insert(name, value);
+            }
+
+            std::string encoder::encode(const header_list& headers) {
+                std::string out;
+                if(size_update) {
+                    encode_int(out, table_size, 5, 0x20);
+                    size_update = false;
+                }
+                for(const auto& [name, value] : headers) {
+                    // values that differ with every response would only push useful entries out
+                    bool index = !(
+                        name == "content-length" || name == "date" || name == "etag" || name == "last-modified"
+                        || name == "location" || name == "set-cookie" || name == "expires"
+                    );
+                    encode(out, name, value, index);
+                }
+                return out;
+            }
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace s90 {
+    namespace httpd {
+        namespace hpack {
+
+            using header = std::pair<std::string, std::string>;
+            using header_list = std::vector<header>;
+
+            /// @brief Size of the dynamic table both ends start with (RFC 7541 section 4.2)
+            constexpr size_t default_table_size = 4096;
+
+            /// @brief Dynamic table (RFC 7541 section 2.3), its indices follow right after the static table
+            class table {
+                std::deque<header> entries;
+                size_t used = 0;
+                size_t capacity = default_table_size;
+
+                void evict(size_t room);
+            public:
+                /// @brief Change the maximum size, evicting the oldest entries that don't fit anymore
+                /// @param new_capacity new size in bytes as counted by HPACK
+                void resize(size_t new_capacity);
+
+                /// @brief Add an entry, evicting the oldest ones to make room for it
+                /// @param name header name
+                /// @param value header value
+                void insert(std::string_view name, std::string_view value);
+
+                /// @brief Get entry by index, static table included
+                /// @param index index starting at 1
+                /// @return entry or nullptr if the index is out of range
+                const header* at(size_t index) const;
+
+                /// @brief Find index of an entry, static table included
+                /// @param name header name
+                /// @param value header value
+                /// @param exact set to true if value matched as well, otherwise only the name did
+                /// @return index or 0 if not even the name is present
+                size_t find(std::string_view name, std::string_view value, bool& exact) const;
+            };
+
+            class decoder {
+                table dynamic;
+                size_t max_table_size = default_table_size;
+            public:
+                /// @brief Decode a complete header block, every block received on the connection must go
+                /// through here in order, even the ones that get rejected, so the tables stay in sync
+                /// @param block header block fragments concatenated
+                /// @param max_list_size limit for sum of the decoded names and values
+                /// @return decoded headers or error
+                std::expected<header_list, std::string> decode(std::string_view block, size_t max_list_size);
+            };
+
+            class encoder {
+                table dynamic;
+                size_t table_size = default_table_size;
+                bool size_update = false;
+
+                void encode(std::string& out, std::string_view name, std::string_view value, bool index);
+            public:
+                /// @brief Apply SETTINGS_HEADER_TABLE_SIZE received from the peer, the next block starts
+                /// with a table size update then
+                /// @param size the peer's limit
+                void set_max_table_size(size_t size);
+
+                /// @brief Encode a header block, frequent headers are added to the dynamic table while
+                /// the ones that differ per response stay out of it
+                /// @param headers headers with lowercase names, pseudo headers first
+                /// @return header block
+                std::string encode(const header_list& headers);
+            };
+
+            /// @brief Decode Huffman coded string literal
+            /// @param data coded string
+            /// @param out output the decoded string is appended to
+            /// @return false if the input isn't valid
+            bool huffman_decode(std::string_view data, std::string& out);
+
+            /// @brief Huffman code a string literal
+            /// @param data string
+            /// @param out output the coded string is appended to
+            void huffman_encode(std::string_view data, std::string& out);
+
+            /// @brief Get length of the Huffman coded string
+            /// @param data string
+            /// @return length in bytes
+            size_t huffman_length(std::string_view data);
+        }
+    }
+}
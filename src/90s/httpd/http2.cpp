@@ -0,0 +1,562 @@
+#include "http2.hpp"
+#include "server.hpp"
+#include "environment.hpp"
+#include "../util/util.hpp"
+#include <algorithm>
+
+namespace s90 {
+    namespace httpd {
+
+        // frame types (RFC 9113 section 6)
+        constexpr uint8_t frame_data = 0x0;
+        constexpr uint8_t frame_headers = 0x1;
+        constexpr uint8_t frame_priority = 0x2;
+        constexpr uint8_t frame_rst_stream = 0x3;
+        constexpr uint8_t frame_settings = 0x4;
+        constexpr uint8_t frame_push_promise = 0x5;
+        constexpr uint8_t frame_ping = 0x6;
+        constexpr uint8_t frame_goaway = 0x7;
+        constexpr uint8_t frame_window_update = 0x8;
+        constexpr uint8_t frame_continuation = 0x9;
+
+        constexpr uint8_t flag_end_stream = 0x1;
+        constexpr uint8_t flag_ack = 0x1;
+        constexpr uint8_t flag_end_headers = 0x4;
+        constexpr uint8_t flag_padded = 0x8;
+        constexpr uint8_t flag_priority = 0x20;
+
+        // error codes (RFC 9113 section 7)
+        constexpr uint32_t error_none = 0x0;
+        constexpr uint32_t error_protocol = 0x1;
+        constexpr uint32_t error_flow_control = 0x3;
+        constexpr uint32_t error_stream_closed = 0x5;
+        constexpr uint32_t error_frame_size = 0x6;
+        constexpr uint32_t error_refused_stream = 0x7;
+        constexpr uint32_t error_compression = 0x9;
+        constexpr uint32_t error_enhance_your_calm = 0xb;
+
+        constexpr uint16_t setting_header_table_size = 0x1;
+        constexpr uint16_t setting_enable_push = 0x2;
+        constexpr uint16_t setting_max_concurrent_streams = 0x3;
+        constexpr uint16_t setting_initial_window_size = 0x4;
+        constexpr uint16_t setting_max_frame_size = 0x5;
+        constexpr uint16_t setting_max_header_list_size = 0x6;
+
+        // frames we accept are never larger than this, as we don't raise SETTINGS_MAX_FRAME_SIZE
+        constexpr size_t default_max_frame_size = 16384;
+        constexpr int64_t max_window = 0x7FFFFFFF;
+        constexpr std::string_view client_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+        static uint32_t read_u32(std::string_view data) {
+            return ((uint32_t)(uint8_t)data[0] << 24) | ((uint32_t)(uint8_t)data[1] << 16)
+                 | ((uint32_t)(uint8_t)data[2] << 8) | (uint32_t)(uint8_t)data[3];
+        }
+
+        static void write_u32(std::string& out, uint32_t value) {
+            out += (char)(value >> 24);
+            out += (char)(value >> 16);
+            out += (char)(value >> 8);
+            out += (char)value;
+        }
+
+        static void write_setting(std::string& out, uint16_t id, uint32_t value) {
+            out += (char)(id >> 8);
+            out += (char)id;
+            write_u32(out, value);
+        }
+
+        http2_session::http2_session(httpd_server *server, ptr<iafd> fd, std::string peer_name)
+            : server(server), fd(fd), peer_name(std::move(peer_name)) {}
+
+        void http2_session::frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+            char header[9] = {
+                (char)(payload.length() >> 16), (char)(payload.length() >> 8), (char)payload.length(),
+                (char)type, (char)flags,
+                (char)((stream_id >> 24) & 0x7F), (char)(stream_id >> 16), (char)(stream_id >> 8), (char)stream_id
+            };
+            out.append(header, sizeof(header));
+            out.append(payload);
+        }
+
+        void http2_session::flush() {
+            if(out.empty()) return;
+            if(closed) {
+                out.clear();
+                return;
+            }
+            fd->write(std::move(out));
+            out.clear();
+            // a client that advertises large windows but doesn't read would otherwise make
+            // the write queue grow without bound
+            if(!write_blocked) {
+                auto writable = fd->wait_writable();
+                if(!writable.is_settled()) resume_writes(shared_from_this(), std::move(writable));
+            }
+        }
+
+        aiopromise<nil> http2_session::resume_writes(std::shared_ptr<http2_session> self, aiopromise<bool> writable) {
+            write_blocked = true;
+            bool ok = co_await writable;
+            write_blocked = false;
+            if(ok && !closed) {
+                pump();
+                flush();
+            }
+            co_return nil {};
+        }
+
+        void http2_session::reset(uint32_t stream_id, uint32_t error_code) {
+            std::string payload;
+            write_u32(payload, error_code);
+            frame(frame_rst_stream, 0, stream_id, payload);
+            auto it = streams.find(stream_id);
+            if(it == streams.end()) return;
+            buffered_body -= it->second.body.length();
+            streams.erase(it);
+        }
+
+        void http2_session::window_update(uint32_t stream_id, uint32_t increment) {
+            std::string payload;
+            write_u32(payload, increment);
+            frame(frame_window_update, 0, stream_id, payload);
+        }
+
+        uint32_t http2_session::apply_settings(std::string_view payload) {
+            if(payload.length() % 6 != 0) return error_frame_size;
+            for(size_t i = 0; i < payload.length(); i += 6) {
+                uint16_t id = ((uint16_t)(uint8_t)payload[i] << 8) | (uint8_t)payload[i + 1];
+                uint32_t value = read_u32(payload.substr(i + 2));
+                switch(id) {
+                    case setting_header_table_size:
+                        encoder.set_max_table_size(value);
+                        break;
+                    case setting_enable_push:
+                        if(value > 1) return error_protocol;
+                        break;
+                    case setting_initial_window_size:
+                        if(value > max_window) return error_flow_control;
+                        // applies to the windows of open streams as well (RFC 9113 section 6.9.2)
+                        for(auto& [_, s] : streams) {
+                            s.send_window += (int64_t)value - initial_send_window;
+                        }
+                        initial_send_window = value;
+                        break;
+                    case setting_max_frame_size:
+                        if(value < 16384 || value > 16777215) return error_protocol;
+                        max_frame_size = value;
+                        break;
+                    default:
+                        // unknown settings are ignored, and so are the limits that only matter
+                        // to a server pushing streams
+                        break;
+                }
+            }
+            return error_none;
+        }
+
+        aiopromise<nil> http2_session::serve(std::shared_ptr<environment> upgraded, page *upgraded_page, std::string_view settings) {
+            // server connection preface, SETTINGS must be the first frame sent
+            std::string payload;
+            write_setting(payload, setting_enable_push, 0);
+            write_setting(payload, setting_max_concurrent_streams, max_concurrent_streams);
+            write_setting(payload, setting_initial_window_size, stream_window);
+            write_setting(payload, setting_max_header_list_size, max_header_list_size);
+            frame(frame_settings, 0, 0, payload);
+            window_update(0, connection_window - recv_window);
+            recv_window = connection_window;
+
+            uint32_t error = error_none;
+            if(upgraded) {
+                // HTTP2-Settings carries SETTINGS payload in base64url without padding, the 101 response
+                // acknowledges it implicitly
+                std::string encoded(settings);
+                std::replace(encoded.begin(), encoded.end(), '-', '+');
+                std::replace(encoded.begin(), encoded.end(), '_', '/');
+                while(encoded.length() % 4 != 0) encoded += '=';
+                auto decoded = util::from_b64(encoded);
+                if(!decoded) error = error_protocol;
+                else error = apply_settings(*decoded);
+
+                if(error == error_none) {
+                    // the upgraded request becomes stream 1, half closed by the client already
+                    last_stream_id = 1;
+                    auto& s = streams[1];
+                    s.env = upgraded;
+                    s.current_page = upgraded_page;
+                    s.head = upgraded->method() == "HEAD";
+                    s.send_window = initial_send_window;
+                    upgraded->write_http2();
+                    start(1, s);
+                }
+            }
+            flush();
+
+            if(upgraded && error == error_none) {
+                // client sends its preface only after it received the 101 response
+                auto preface = co_await fd->read_n(client_preface.length());
+                if(!preface || preface.data != client_preface) error = error_protocol;
+            }
+
+            while(error == error_none) {
+                // responses of a client that doesn't read aren't rendered into memory any further
+                if(write_blocked && !co_await fd->wait_writable()) break;
+                auto frame_header = co_await fd->read_n(9);
+                if(!frame_header) break;
+                std::string_view h = frame_header.data;
+                size_t length = ((size_t)(uint8_t)h[0] << 16) | ((size_t)(uint8_t)h[1] << 8) | (uint8_t)h[2];
+                uint8_t type = (uint8_t)h[3];
+                uint8_t flags = (uint8_t)h[4];
+                uint32_t stream_id = read_u32(h.substr(5)) & 0x7FFFFFFF;
+                if(length > default_max_frame_size) {
+                    error = error_frame_size;
+                    break;
+                }
+                std::string_view frame_payload;
+                if(length > 0) {
+                    auto frame_body = co_await fd->read_n(length);
+                    if(!frame_body) break;
+                    frame_payload = frame_body.data;
+                }
+                // frames are processed right away, so the payload can be used without copying it
+                // out of the read buffer
+                error = on_frame(type, flags, stream_id, frame_payload);
+                flush();
+            }
+
+            if(error != error_none) {
+                payload.clear();
+                write_u32(payload, last_stream_id);
+                write_u32(payload, error);
+                frame(frame_goaway, 0, 0, payload);
+                std::string goaway = std::move(out);
+                out.clear();
+                co_await fd->write(std::move(goaway));
+                fd->close();
+            }
+
+            // pages that still render find their stream gone and their response is dropped
+            closed = true;
+            streams.clear();
+            co_return nil {};
+        }
+
+        uint32_t http2_session::on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+            // a header block must not be interleaved with any other frame
+            if(header_stream != 0 && (type != frame_continuation || stream_id != header_stream)) return error_protocol;
+
+            switch(type) {
+                case frame_data:
+                    return on_data(flags, stream_id, payload);
+                case frame_headers:
+                    if(stream_id == 0 || (stream_id & 1) == 0) return error_protocol;
+                    if(flags & flag_padded) {
+                        if(payload.empty() || (uint8_t)payload[0] >= payload.length()) return error_protocol;
+                        payload = payload.substr(1, payload.length() - 1 - (uint8_t)payload[0]);
+                    }
+                    if(flags & flag_priority) {
+                        if(payload.length() < 5) return error_frame_size;
+                        payload = payload.substr(5);
+                    }
+                    header_block = payload;
+                    header_stream = stream_id;
+                    header_end_stream = (flags & flag_end_stream) != 0;
+                    if(flags & flag_end_headers) return on_headers(stream_id, header_end_stream);
+                    return error_none;
+                case frame_continuation:
+                    if(header_stream == 0) return error_protocol;
+                    header_block += payload;
+                    if(header_block.length() > 2 * max_header_list_size) return error_enhance_your_calm;
+                    if(flags & flag_end_headers) return on_headers(stream_id, header_end_stream);
+                    return error_none;
+                case frame_priority:
+                    // priorities are deprecated and ignored (RFC 9113 section 5.3.2)
+                    if(stream_id == 0) return error_protocol;
+                    if(payload.length() != 5) reset(stream_id, error_frame_size);
+                    return error_none;
+                case frame_rst_stream:
+                    if(stream_id == 0 || stream_id > last_stream_id) return error_protocol;
+                    if(payload.length() != 4) return error_frame_size;
+                    if(auto it = streams.find(stream_id); it != streams.end()) {
+                        buffered_body -= it->second.body.length();
+                        streams.erase(it);
+                    }
+                    return error_none;
+                case frame_settings: {
+                    if(stream_id != 0) return error_protocol;
+                    if(flags & flag_ack) return payload.empty() ? error_none : error_frame_size;
+                    uint32_t error = apply_settings(payload);
+                    if(error != error_none) return error;
+                    frame(frame_settings, flag_ack, 0, {});
+                    // new initial window may have unblocked some of the streams
+                    pump();
+                    return error_none;
+                }
+                case frame_push_promise:
+                    // clients can't push
+                    return error_protocol;
+                case frame_ping:
+                    if(stream_id != 0) return error_protocol;
+                    if(payload.length() != 8) return error_frame_size;
+                    if(!(flags & flag_ack)) frame(frame_ping, flag_ack, 0, payload);
+                    return error_none;
+                case frame_goaway:
+                    // streams that are open get their responses still, new ones are refused
+                    if(stream_id != 0) return error_protocol;
+                    peer_going_away = true;
+                    return error_none;
+                case frame_window_update: {
+                    if(payload.length() != 4) return error_frame_size;
+                    uint32_t increment = read_u32(payload) & 0x7FFFFFFF;
+                    if(stream_id == 0) {
+                        if(increment == 0) return error_protocol;
+                        send_window += increment;
+                        if(send_window > max_window) return error_flow_control;
+                    } else {
+                        if(stream_id > last_stream_id) return error_protocol;
+                        auto it = streams.find(stream_id);
+                        if(it == streams.end()) return error_none;
+                        if(increment == 0) {
+                            reset(stream_id, error_protocol);
+                            return error_none;
+                        }
+                        it->second.send_window += increment;
+                        if(it->second.send_window > max_window) {
+                            reset(stream_id, error_flow_control);
+                            return error_none;
+                        }
+                    }
+                    pump();
+                    return error_none;
+                }
+                default:
+                    // unknown frame types must be ignored
+                    return error_none;
+            }
+        }
+
+        uint32_t http2_session::on_headers(uint32_t stream_id, bool end_stream) {
+            header_stream = 0;
+            // every header block must be decoded, even for streams that get refused, to keep
+            // the dynamic table in sync with the client
+            auto decoded = decoder.decode(header_block, max_header_list_size);
+            header_block.clear();
+            if(!decoded) return error_compression;
+
+            auto it = streams.find(stream_id);
+            if(it != streams.end()) {
+                // trailers, they end the request body and are not passed to the page
+                if(it->second.remote_closed) {
+                    reset(stream_id, error_stream_closed);
+                    return error_none;
+                }
+                if(!end_stream) return error_protocol;
+                start(stream_id, it->second);
+                return error_none;
+            }
+
+            if(stream_id <= last_stream_id) return error_stream_closed;
+            last_stream_id = stream_id;
+
+            if(peer_going_away || streams.size() >= max_concurrent_streams) {
+                reset(stream_id, error_refused_stream);
+                return error_none;
+            }
+
+            auto env = server->acquire_environment();
+            std::string path, authority, cookies;
+            bool has_method = false, regular = false, valid = true;
+            for(auto& [name, value] : *decoded) {
+                if(name.starts_with(':')) {
+                    // pseudo headers come before the regular ones
+                    if(regular) valid = false;
+                    else if(name == ":method") { env->write_method(std::move(value)); has_method = true; }
+                    else if(name == ":path") path = std::move(value);
+                    else if(name == ":authority") authority = std::move(value);
+                    else if(name != ":scheme") valid = false;
+                    continue;
+                }
+                regular = true;
+                if(std::any_of(name.begin(), name.end(), [](char c) { return c >= 'A' && c <= 'Z'; })) {
+                    valid = false;
+                } else if(name == "cookie") {
+                    // cookies may be split into several fields to compress better (RFC 9113 section 8.2.3)
+                    if(!cookies.empty()) cookies += "; ";
+                    cookies += value;
+                } else {
+                    env->write_header(name, value);
+                }
+            }
+
+            if(!valid || !has_method || path.empty()) {
+                reset(stream_id, error_protocol);
+                return error_none;
+            }
+
+            if(!authority.empty() && !env->header_view("host")) env->write_header("host", authority);
+            if(!cookies.empty()) env->write_header("cookie", cookies);
+
+            auto& s = streams[stream_id];
+            s.env = env;
+            s.head = env->method() == "HEAD";
+            s.send_window = initial_send_window;
+            s.recv_window = stream_window;
+            s.current_page = server->prepare(env, path, peer_name, fd);
+            env->write_http2();
+            if(end_stream) start(stream_id, s);
+            return error_none;
+        }
+
+        uint32_t http2_session::on_data(uint8_t flags, uint32_t stream_id, std::string_view payload) {
+            if(stream_id == 0) return error_protocol;
+
+            // flow control counts the whole payload, padding included, and the connection window
+            // is consumed even by frames of streams that are gone already
+            int64_t length = payload.length();
+            recv_window -= length;
+            if(recv_window < 0) return error_flow_control;
+            if(recv_window < connection_window / 2) {
+                window_update(0, connection_window - recv_window);
+                recv_window = connection_window;
+            }
+
+            if(flags & flag_padded) {
+                if(payload.empty() || (uint8_t)payload[0] >= payload.length()) return error_protocol;
+                payload = payload.substr(1, payload.length() - 1 - (uint8_t)payload[0]);
+            }
+
+            auto it = streams.find(stream_id);
+            if(it == streams.end()) {
+                if(stream_id > last_stream_id) return error_protocol;
+                reset(stream_id, error_stream_closed);
+                return error_none;
+            }
+
+            auto& s = it->second;
+            if(s.remote_closed) {
+                reset(stream_id, error_stream_closed);
+                return error_none;
+            }
+            s.recv_window -= length;
+            if(s.recv_window < 0) {
+                reset(stream_id, error_flow_control);
+                return error_none;
+            }
+            // WINDOW_UPDATE keeps reopening the window, so the window alone doesn't bound the body
+            if(s.body.length() + payload.length() > max_body_size || buffered_body + payload.length() > max_buffered_body) {
+                reset(stream_id, error_enhance_your_calm);
+                return error_none;
+            }
+            s.body += payload;
+            buffered_body += payload.length();
+            if(flags & flag_end_stream) {
+                start(stream_id, s);
+            } else if(s.recv_window < stream_window / 2) {
+                window_update(stream_id, stream_window - s.recv_window);
+                s.recv_window = stream_window;
+            }
+            return error_none;
+        }
+
+        void http2_session::start(uint32_t stream_id, stream& s) {
+            s.remote_closed = true;
+            buffered_body -= s.body.length();
+            if(!s.body.empty()) s.env->write_body(std::move(s.body));
+            s.body.clear();
+            // root of the spans recorded while handling this stream, it ends once the response is sent
+            tracing::span request_trace("httpd::request", s.env->endpoint());
+            render(shared_from_this(), stream_id, s.env, s.current_page);
+            request_trace.detach();
+
+            // rendering might have finished and sent the whole response already
+            auto it = streams.find(stream_id);
+            if(it != streams.end()) it->second.trace = std::move(request_trace);
+        }
+
+        aiopromise<nil> http2_session::render(std::shared_ptr<http2_session> self, uint32_t stream_id, std::shared_ptr<environment> env, page *current_page) {
+            co_await server->render(env, current_page);
+            hpack::header_list headers;
+            auto body = co_await env->http2_response(headers);
+
+            // the client might have reset the stream or closed the connection meanwhile
+            auto it = streams.find(stream_id);
+            if(closed || it == streams.end()) {
+                server->recycle_environment(std::move(env));
+                co_return nil {};
+            }
+
+            auto& s = it->second;
+            s.env.reset();
+            bool end_stream = s.head || (body->empty() && !env->streaming());
+            auto block = encoder.encode(headers);
+            std::string_view remaining(block);
+            bool first = true;
+            // header block goes out in HEADERS frame followed by as many CONTINUATION frames as needed
+            do {
+                auto fragment = remaining.substr(0, max_frame_size);
+                remaining = remaining.substr(fragment.length());
+                uint8_t flags = remaining.empty() ? flag_end_headers : 0;
+                if(first && end_stream) flags |= flag_end_stream;
+                frame(first ? frame_headers : frame_continuation, flags, stream_id, fragment);
+                first = false;
+            } while(!remaining.empty());
+
+            if(end_stream) {
+                streams.erase(it);
+            } else {
+                s.output = std::move(body);
+                s.output_complete = !env->streaming();
+                s.responded = true;
+                pump();
+            }
+            flush();
+
+            // rest of a streamed response goes out as it renders
+            while(!end_stream && env->streaming()) {
+                auto part = co_await env->next_output();
+                it = streams.find(stream_id);
+                if(closed || it == streams.end()) break;
+                auto& current = it->second;
+                // what was sent already is dropped, so the buffer doesn't grow with the whole page
+                auto unsent = std::string_view(*current.output).substr(current.output_offset);
+                current.output = ptr_new<const std::string>(unsent.empty() ? std::move(part) : std::string(unsent) + part);
+                current.output_offset = 0;
+                current.output_complete = !env->streaming();
+                pump();
+                flush();
+            }
+            server->recycle_environment(std::move(env));
+            co_return nil {};
+        }
+
+        void http2_session::pump() {
+            // the rest goes out once the client reads what's queued
+            if(write_blocked) return;
+            // streams take turns frame by frame, so a large response doesn't hold back the others
+            bool progress = true;
+            while(progress && send_window > 0) {
+                progress = false;
+                for(auto it = streams.begin(); it != streams.end() && send_window > 0;) {
+                    auto& s = it->second;
+                    if(!s.responded || s.send_window <= 0) {
+                        it++;
+                        continue;
+                    }
+                    size_t remaining = s.output->length() - s.output_offset;
+                    if(remaining == 0 && !s.output_complete) {
+                        it++;
+                        continue;
+                    }
+                    size_t n = std::min({ remaining, (size_t)s.send_window, (size_t)send_window, max_frame_size });
+                    bool last = n == remaining && s.output_complete;
+                    frame(frame_data, last ? flag_end_stream : 0, it->first, std::string_view(*s.output).substr(s.output_offset, n));
+                    s.output_offset += n;
+                    s.send_window -= n;
+                    send_window -= n;
+                    progress = true;
+                    if(last) it = streams.erase(it);
+                    else it++;
+                }
+            }
+        }
+    }
+}
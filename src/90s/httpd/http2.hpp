@@ -0,0 +1,111 @@
+#pragma once
+#include "../context.hpp"
+#include "../afd.hpp"
+#include "../tracing.hpp"
+#include "hpack.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace s90 {
+    namespace httpd {
+
+        class httpd_server;
+        class environment;
+        class page;
+
+        /// @brief Rest of the client connection preface once "PRI * HTTP/2.0\r\n\r\n" was read as a request
+        constexpr std::string_view http2_preface_tail = "SM\r\n\r\n";
+
+        /// @brief Cleartext HTTP/2 connection (RFC 9113), started either with prior knowledge or by
+        /// Upgrade: h2c. Every stream gets its own environment rendered by the server's pages, so
+        /// requests on a single connection render concurrently and responses are interleaved as
+        /// flow control permits
+        class http2_session : public std::enable_shared_from_this<http2_session> {
+        public:
+            /// @brief Streams a client may have open at once, further ones are refused
+            static constexpr uint32_t max_concurrent_streams = 100;
+            /// @brief Receive window of a stream, request bodies beyond it wait for WINDOW_UPDATE
+            static constexpr int64_t stream_window = 1 << 20;
+            /// @brief Receive window of the whole connection
+            static constexpr int64_t connection_window = 16 << 20;
+            /// @brief Limit for a decoded request header list
+            static constexpr size_t max_header_list_size = 64 * 1024;
+            /// @brief Largest request body of a stream, streams sending more get reset
+            static constexpr size_t max_body_size = 16 << 20;
+            /// @brief Most request body data buffered for all streams of the connection together,
+            /// the same as what a HTTP/1.1 connection may buffer
+            static constexpr size_t max_buffered_body = default_read_limit;
+
+            http2_session(httpd_server *server, ptr<iafd> fd, std::string peer_name);
+
+            /// @brief Serve the connection until the client closes it or a connection error occurs
+            /// @param upgraded request that came with Upgrade: h2c and is answered as stream 1,
+            /// nullptr when the client connected with prior knowledge
+            /// @param upgraded_page page resolved for the upgraded request
+            /// @param settings value of HTTP2-Settings header of the upgraded request
+            /// @return nil once the connection is done
+            aiopromise<nil> serve(std::shared_ptr<environment> upgraded = nullptr, page *upgraded_page = nullptr, std::string_view settings = {});
+
+        private:
+            struct stream {
+                std::shared_ptr<environment> env;
+                page *current_page = nullptr;
+                std::string body;
+                ptr<const std::string> output;
+                size_t output_offset = 0;
+                int64_t send_window = 0;
+                int64_t recv_window = 0;
+                bool remote_closed = false;
+                bool responded = false;
+                // streamed responses get their output in parts, the stream ends with the last one
+                bool output_complete = true;
+                bool head = false;
+                tracing::span trace;
+            };
+
+            httpd_server *server;
+            ptr<iafd> fd;
+            std::string peer_name;
+            hpack::decoder decoder;
+            hpack::encoder encoder;
+            dict<uint32_t, stream> streams;
+            uint32_t last_stream_id = 0;
+
+            // header block being received, split over HEADERS and CONTINUATION frames
+            std::string header_block;
+            uint32_t header_stream = 0;
+            bool header_end_stream = false;
+
+            int64_t send_window = 65535;
+            int64_t initial_send_window = 65535;
+            int64_t recv_window = 65535;
+            size_t max_frame_size = 16384;
+            bool peer_going_away = false;
+            bool closed = false;
+            // request body data of streams that didn't start rendering yet
+            size_t buffered_body = 0;
+            // set while the client doesn't read and the write queue is above its high watermark,
+            // nothing more is read from the client nor sent to it until the queue drains
+            bool write_blocked = false;
+
+            // frames are gathered here and written at once when the current event is handled
+            std::string out;
+
+            void frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+            void flush();
+            aiopromise<nil> resume_writes(std::shared_ptr<http2_session> self, aiopromise<bool> writable);
+            void reset(uint32_t stream_id, uint32_t error_code);
+            void window_update(uint32_t stream_id, uint32_t increment);
+            uint32_t apply_settings(std::string_view payload);
+
+            uint32_t on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+            uint32_t on_headers(uint32_t stream_id, bool end_stream);
+            uint32_t on_data(uint8_t flags, uint32_t stream_id, std::string_view payload);
+
+            void start(uint32_t stream_id, stream& s);
+            aiopromise<nil> render(std::shared_ptr<http2_session> self, uint32_t stream_id, std::shared_ptr<environment> env, page *current_page);
+            void pump();
+        };
+    }
+}
@@ -27,6 +27,10 @@ namespace s90 {
             /// @return endpoint name
             virtual const char* name() const = 0;
 
+            /// @brief Get output cache directive of the page, i.e. `30s vary=query:name` of `#! CACHE 30s vary=query:name`
+            /// @return directive, nullptr if the page is rendered for every request
+            virtual const char* cache() const { return nullptr; }
+
             /// @brief Render the page
             /// @param env environment
             /// @return nil
@@ -0,0 +1,210 @@
+#include "page_cache.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <mutex>
+#include <ranges>
+
+namespace s90 {
+    namespace httpd {
+
+        std::optional<cache_policy> parse_cache_policy(std::string_view directive) {
+            cache_policy policy { std::chrono::seconds(0) };
+            bool has_ttl = false;
+            for(auto part : std::ranges::split_view(directive, ' ')) {
+                std::string_view word(part.begin(), part.end());
+                if(word.empty()) continue;
+                if(word == "shared") {
+                    policy.shared = true;
+                } else if(word.starts_with("vary=")) {
+                    word.remove_prefix(5);
+                    for(auto field : std::ranges::split_view(word, ',')) {
+                        std::string_view spec(field.begin(), field.end());
+                        auto colon = spec.find(':');
+                        auto from = spec.substr(0, colon);
+                        std::string name(colon == std::string_view::npos ? std::string_view() : spec.substr(colon + 1));
+                        cache_vary vary { cache_vary::source::query, name };
+                        if(from == "query") vary.from = cache_vary::source::query;
+                        else if(from == "cookie") vary.from = cache_vary::source::cookie;
+                        else if(from == "header") vary.from = cache_vary::source::header;
+                        else if(from == "param") vary.from = cache_vary::source::param;
+                        else return {};
+                        // only the query can be varied by as a whole
+                        if(name.empty() && vary.from != cache_vary::source::query) return {};
+                        if(vary.from == cache_vary::source::header) {
+                            for(auto& c : vary.name) c = std::tolower(c);
+                        }
+                        policy.vary.emplace_back(std::move(vary));
+                    }
+                } else if(!has_ttl) {
+                    uint64_t value = 0;
+                    auto [end, ec] = std::from_chars(word.data(), word.data() + word.length(), value);
+                    if(ec != std::errc() || end == word.data()) return {};
+                    std::string_view unit(end, word.data() + word.length());
+                    if(unit.empty() || unit == "s") policy.ttl = std::chrono::seconds(value);
+                    else if(unit == "m") policy.ttl = std::chrono::minutes(value);
+                    else if(unit == "h") policy.ttl = std::chrono::hours(value);
+                    else return {};
+                    has_ttl = true;
+                } else {
+                    return {};
+                }
+            }
+            if(!has_ttl || policy.ttl.count() == 0) return {};
+            return policy;
+        }
+
+        // output shared by all workers, outputs themselves are immutable so they're safe to be
+        // handed over from one worker to another, only the store needs to be locked
+        static std::mutex shared_lock;
+
+        page_cache::lookup page_cache::store::find(const std::string& key, std::chrono::steady_clock::time_point now) {
+            auto it = entries.find(key);
+            if(it == entries.end()) return {};
+            if(now >= it->second.discard) {
+                erase(it);
+                return {};
+            }
+            return lookup { it->second.page, now < it->second.expire };
+        }
+
+        bool page_cache::store::claim(const std::string& key, std::chrono::steady_clock::time_point now) {
+            auto [it, inserted] = claims.emplace(key, now);
+            if(inserted) return true;
+            if(now - it->second < claim_timeout) return false;
+            it->second = now;
+            return true;
+        }
+
+        void page_cache::store::insert(const std::string& key, entry&& value, std::chrono::steady_clock::time_point now) {
+            auto it = entries.find(key);
+            if(it != entries.end()) erase(it);
+            if(value.cost > max_cached_bytes) return;
+            if(cached_bytes + value.cost > max_cached_bytes) purge(now);
+            while(cached_bytes + value.cost > max_cached_bytes && !entries.empty()) {
+                // the output closest to expiring has the least use left in it
+                auto first = std::ranges::min_element(entries, {}, [](const auto& pair) { return pair.second.expire; });
+                erase(first);
+            }
+            cached_bytes += value.cost;
+            entries.emplace(key, std::move(value));
+        }
+
+        void page_cache::store::erase(dict<std::string, entry>::iterator it) {
+            cached_bytes -= it->second.cost;
+            entries.erase(it);
+        }
+
+        void page_cache::store::purge(std::chrono::steady_clock::time_point now) {
+            for(auto it = entries.begin(); it != entries.end();) {
+                if(now >= it->second.discard) {
+                    cached_bytes -= it->second.cost;
+                    it = entries.erase(it);
+                } else {
+                    it++;
+                }
+            }
+            for(auto it = claims.begin(); it != claims.end();) {
+                if(now - it->second >= claim_timeout) it = claims.erase(it);
+                else it++;
+            }
+        }
+
+        void page_cache::store::clear() {
+            entries.clear();
+            cached_bytes = 0;
+        }
+
+        page_cache::store& page_cache::shared_store() {
+            static page_cache::store store;
+            return store;
+        }
+
+        ptr<page_cache> page_cache::local(icontext *ctx) {
+            constexpr std::string_view store_key = "httpd::page_cache";
+            auto cache = static_pointer_cast<page_cache>(ctx->store(store_key));
+            if(!cache) {
+                cache = ptr_new<page_cache>();
+                ctx->store(store_key, cache);
+            }
+            return cache;
+        }
+
+        page_cache::lookup page_cache::find(const std::string& key, bool shared) {
+            auto now = std::chrono::steady_clock::now();
+            if(!shared) return own.find(key, now);
+            std::lock_guard guard(shared_lock);
+            return shared_store().find(key, now);
+        }
+
+        bool page_cache::claim(const std::string& key, bool shared) {
+            auto now = std::chrono::steady_clock::now();
+            // the worker's own claim goes first, so requests of this worker can wait for the render
+            if(!own.claim(key, now)) return false;
+            if(!shared) return true;
+            std::lock_guard guard(shared_lock);
+            if(shared_store().claim(key, now)) return true;
+            own.claims.erase(key);
+            return false;
+        }
+
+        aiopromise<ptr<const cached_page>> page_cache::wait(icontext *ctx, const std::string& key) {
+            auto claim = own.claims.find(key);
+            if(claim == own.claims.end()) co_return nullptr;
+            // render still going once its claim times out is assumed lost, so is the wait for it
+            auto left = std::chrono::ceil<std::chrono::seconds>(claim_timeout - (std::chrono::steady_clock::now() - claim->second));
+            aiopromise<ptr<const cached_page>> result;
+            waiting[key].push_back(result);
+            result.cancel_on(ctx->deadline(std::max<int>(1, (int)left.count())), nullptr);
+            co_return co_await result;
+        }
+
+        void page_cache::fill(const std::string& key, ptr<const cached_page> page, const cache_policy& policy) {
+            auto now = std::chrono::steady_clock::now();
+            own.claims.erase(key);
+            if(page) {
+                size_t cost = key.length() + sizeof(cached_page) + page->status_line.length() + page->body->length();
+                for(const auto& [k, v] : page->headers) cost += k.length() + v.length();
+                entry value { page, now + policy.ttl, now + 2 * policy.ttl, cost };
+                if(policy.shared) {
+                    std::lock_guard guard(shared_lock);
+                    shared_store().claims.erase(key);
+                    shared_store().insert(key, std::move(value), now);
+                } else {
+                    own.insert(key, std::move(value), now);
+                }
+            } else if(policy.shared) {
+                std::lock_guard guard(shared_lock);
+                shared_store().claims.erase(key);
+            }
+
+            auto it = waiting.find(key);
+            if(it == waiting.end()) return;
+            auto waiters = std::move(it->second);
+            waiting.erase(it);
+            for(auto& waiter : waiters) waiter.resolve(ptr<const cached_page>(page));
+        }
+
+        void page_cache::clear() {
+            own.clear();
+            std::lock_guard guard(shared_lock);
+            shared_store().clear();
+        }
+
+        void page_cache::update() {
+            auto now = std::chrono::steady_clock::now();
+            own.purge(now);
+            // nothing fills the output of a lost render anymore, waits for it end empty handed
+            for(auto it = waiting.begin(); it != waiting.end();) {
+                if(own.claims.contains(it->first)) {
+                    it++;
+                    continue;
+                }
+                for(auto& waiter : it->second) waiter.resolve(nullptr);
+                it = waiting.erase(it);
+            }
+            std::lock_guard guard(shared_lock);
+            shared_store().purge(now);
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include "../context.hpp"
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace s90 {
+    namespace httpd {
+
+        /// @brief Part of the request that the output of a cached page differs by
+        struct cache_vary {
+            enum class source {
+                query,
+                cookie,
+                header,
+                param
+            };
+
+            source from;
+            /// @brief field name, empty to vary by the whole query string
+            std::string name;
+        };
+
+        /// @brief How long and by what output of a page is cached, as declared by `#! CACHE` of the template
+        struct cache_policy {
+            std::chrono::seconds ttl;
+            /// @brief true if the output is shared by all workers instead of each keeping its own
+            bool shared = false;
+            std::vector<cache_vary> vary;
+        };
+
+        /// @brief Parse cache directive, i.e. `30s shared vary=query:name,cookie:lang`, time to live is
+        /// in seconds unless followed by m or h
+        /// @param directive directive without the leading CACHE
+        /// @return policy, nothing if the directive is invalid
+        std::optional<cache_policy> parse_cache_policy(std::string_view directive);
+
+        /// @brief Finalized response of a page, as it is sent every time it's looked up
+        struct cached_page {
+            std::string status_line;
+            std::vector<std::pair<std::string, std::string>> headers;
+            /// @brief body, responses are sent straight out of it
+            ptr<const std::string> body;
+        };
+
+        /// @brief Output of cached pages, per worker and shared by all workers. Only one request renders
+        /// an expired page at a time, the others get the expired output meanwhile, or if there is none yet,
+        /// wait for the render when it happens on the same worker
+        class page_cache : public storable {
+        public:
+            /// @brief Result of a look up
+            struct lookup {
+                /// @brief cached output, possibly expired
+                ptr<const cached_page> page;
+                /// @brief true if the output hasn't expired yet
+                bool fresh = false;
+            };
+
+        private:
+            /// @brief Most bytes of output kept, outputs that expire first go first
+            static constexpr size_t max_cached_bytes = 64 * 1024 * 1024;
+
+            /// @brief Claim of a render that didn't end by then is assumed lost
+            static constexpr std::chrono::seconds claim_timeout { 30 };
+
+            struct entry {
+                ptr<const cached_page> page;
+                std::chrono::steady_clock::time_point expire;
+                /// @brief expired output is kept as long again, to be served while it's rendered anew
+                std::chrono::steady_clock::time_point discard;
+                size_t cost = 0;
+            };
+
+            /// @brief Outputs and claims of renders, the store of the worker or the one shared by all of them
+            struct store {
+                dict<std::string, entry> entries;
+                dict<std::string, std::chrono::steady_clock::time_point> claims;
+                size_t cached_bytes = 0;
+
+                lookup find(const std::string& key, std::chrono::steady_clock::time_point now);
+                bool claim(const std::string& key, std::chrono::steady_clock::time_point now);
+                void insert(const std::string& key, entry&& value, std::chrono::steady_clock::time_point now);
+                void erase(dict<std::string, entry>::iterator it);
+                void purge(std::chrono::steady_clock::time_point now);
+                void clear();
+            };
+
+            /// @brief Get the store shared by all workers, it's to be locked while used
+            static store& shared_store();
+
+            store own;
+            dict<std::string, std::vector<aiopromise<ptr<const cached_page>>>> waiting;
+
+        public:
+            /// @brief Get the cache of the worker
+            /// @param ctx global context
+            /// @return cache
+            static ptr<page_cache> local(icontext *ctx);
+
+            /// @brief Look up output of a page
+            /// @param key cache key
+            /// @param shared true to look into the output shared by all workers
+            /// @return output, if there is any
+            lookup find(const std::string& key, bool shared);
+
+            /// @brief Claim rendering of the page, so that concurrent requests don't render it as well
+            /// @param key cache key
+            /// @param shared true if shared by all workers
+            /// @return true if claimed, false if it's being rendered already
+            bool claim(const std::string& key, bool shared);
+
+            /// @brief Wait for the output of a page that's being rendered on this worker, at most until
+            /// the claim of the render times out
+            /// @param ctx global context
+            /// @param key cache key
+            /// @return output, nullptr if it's not being rendered here, the output can't be cached or
+            /// the render didn't end in time
+            aiopromise<ptr<const cached_page>> wait(icontext *ctx, const std::string& key);
+
+            /// @brief Store output of a claimed render and pass it to requests waiting for it
+            /// @param key cache key
+            /// @param page output, nullptr if it can't be cached, which just releases the claim
+            /// @param policy cache policy of the page
+            void fill(const std::string& key, ptr<const cached_page> page, const cache_policy& policy);
+
+            /// @brief Drop all output, i.e. when pages get reloaded
+            void clear();
+
+            void update() override;
+        };
+    }
+}
@@ -39,6 +39,11 @@ namespace s90 {
             }
         }
 
+        void render_context::write(aiopromise<std::string>&& text) {
+            if(disabled) return;
+            blocks.emplace_back(output_block { output_type::deferred, {}, {}, std::move(text) });
+        }
+
         void render_context::write_json(const orm::any& any) {
             if(disabled) return;
             orm::json_encoder enc;
@@ -104,8 +109,10 @@ namespace s90 {
                     } else {
                         ss += std::move(it.text);
                     }
-                } else {
+                } else if(it.type == output_type::block) {
                     ss += std::move(co_await it.block->finalize());
+                } else {
+                    ss += co_await it.deferred;
                 }
                 first = false;
             }
@@ -113,5 +120,61 @@ namespace s90 {
             blocks.clear();
             co_return ss;
         }
-    }
+
+        aiopromise<size_t> render_context::finalize(std::vector<std::string>& segments) {
+            size_t length = 0;
+            for(auto& it : blocks) {
+                if(it.type == output_type::text) {
+                    length += it.text.length();
+                    if(!it.text.empty()) segments.emplace_back(std::move(it.text));
+                } else if(it.type == output_type::block) {
+                    length += co_await it.block->finalize(segments);
+                } else {
+                    auto text = co_await it.deferred;
+                    length += text.length();
+                    if(!text.empty()) segments.emplace_back(std::move(text));
+                }
+            }
+            est_length = 0;
+            blocks.clear();
+            co_return length;
+        }
+
+        bool render_context::drain(std::string& out) {
+            size_t i = 0;
+            bool complete = true;
+            for(; i < blocks.size(); i++) {
+                auto& it = blocks[i];
+                if(it.type == output_type::text) {
+                    out += it.text;
+                } else if(it.type == output_type::deferred || !it.block->drain(out)) {
+                    complete = false;
+                    break;
+                }
+            }
+            blocks.erase(blocks.begin(), blocks.begin() + i);
+            if(complete) est_length = 0;
+            return complete;
+        }
+
+        aiopromise<nil> render_context::wait() {
+            // once drained, the first block is the one that holds the output back
+            if(blocks.empty()) co_return nil {};
+            auto& first = blocks.front();
+            if(first.type == output_type::deferred) {
+                // the page can keep writing meanwhile, so the block itself may move
+                auto pending = first.deferred;
+                auto text = co_await pending;
+                // blocks might have been cleared meanwhile
+                if(!blocks.empty() && blocks.front().type == output_type::deferred) {
+                    blocks.front().type = output_type::text;
+                    blocks.front().text = std::move(text);
+                }
+            } else if(first.type == output_type::block) {
+                auto block = first.block;
+                co_await block->wait();
+            }
+            co_return nil {};
+        }
+}
 }
\ No newline at end of file
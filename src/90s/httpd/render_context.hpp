@@ -45,6 +45,12 @@ namespace s90 {
             /// @param text text to be written
             virtual void write(const std::string& text) = 0;
 
+            /// @brief Write text that is still being rendered, i.e. a block that needs data from
+            /// the database. Output that follows it waits for it, streamed output stops at it until
+            /// it resolves
+            /// @param text promise of the text
+            virtual void write(aiopromise<std::string>&& text) = 0;
+
             /// @brief Write JSON to the context
             /// @param any value to be written
             virtual void write_json(const orm::any& any) = 0;
@@ -65,13 +71,15 @@ namespace s90 {
         class render_context : public irender_context {
             enum class output_type {
                 text,
-                block
+                block,
+                deferred
             };
 
             struct output_block {
                 output_type type;
                 std::string text;
                 ptr<render_context> block;
+                aiopromise<std::string> deferred;
             };
 
             std::vector<output_block> blocks;
@@ -89,9 +97,25 @@ namespace s90 {
             
             void write(std::string&& text) override;
             void write(const std::string& text) override;
+            void write(aiopromise<std::string>&& text) override;
             void write_json(const orm::any& any) override;
 
             std::string escape_string(std::string_view view) const override;
+
+            /// @brief Render the output as the list of buffers it was written in instead of joining them
+            /// @param segments where to move the buffers
+            /// @return total length
+            aiopromise<size_t> finalize(std::vector<std::string>& segments);
+
+            /// @brief Move out the leading part of the output that is rendered already, it stops
+            /// at the first deferred text
+            /// @param out where to append the output
+            /// @return true if the whole output was moved out
+            bool drain(std::string& out);
+
+            /// @brief Wait until the deferred text drain() stopped at resolves
+            /// @return nil
+            aiopromise<nil> wait();
         };
     }
 }
\ No newline at end of file
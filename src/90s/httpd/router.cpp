@@ -0,0 +1,149 @@
+#include "router.hpp"
+
+namespace s90 {
+    namespace httpd {
+
+        const router::route* router::node::find_route(std::string_view method) const {
+            const route *exact = nullptr;
+            for(const auto& r : routes) {
+                // pages without method take precedence, same as they always did
+                if(r.method.empty()) return &r;
+                if(r.method == method) exact = &r;
+            }
+            return exact;
+        }
+
+        router::node* router::insert_static(node *parent, std::string_view text) {
+            node *current = parent;
+            while(!text.empty()) {
+                size_t idx = current->indices.find(text[0]);
+                if(idx == std::string::npos) {
+                    auto child = std::make_unique<node>();
+                    child->prefix = text;
+                    current->indices += text[0];
+                    current->children.emplace_back(std::move(child));
+                    return current->children.back().get();
+                }
+                node *child = current->children[idx].get();
+                size_t common = 0;
+                while(common < child->prefix.length() && common < text.length() && child->prefix[common] == text[common]) common++;
+                if(common < child->prefix.length()) {
+                    // split the child, so the shared part becomes a node of its own
+                    auto split = std::make_unique<node>();
+                    split->prefix = child->prefix.substr(0, common);
+                    child->prefix.erase(0, common);
+                    split->indices += child->prefix[0];
+                    split->children.emplace_back(std::move(current->children[idx]));
+                    current->children[idx] = std::move(split);
+                    child = current->children[idx].get();
+                }
+                current = child;
+                text = text.substr(common);
+            }
+            return current;
+        }
+
+        bool router::insert(std::string_view name, page *target) {
+            std::string_view method, path = name;
+            if(!name.starts_with('/')) {
+                size_t space = name.find(' ');
+                if(space == std::string::npos) return false;
+                method = name.substr(0, space);
+                path = name.substr(space + 1);
+                while(path.starts_with(' ')) path = path.substr(1);
+            }
+            if(!path.starts_with('/')) return false;
+
+            auto names = std::make_shared<std::vector<std::string>>();
+            node *current = &root;
+            size_t offset = 0;
+            while(offset < path.length()) {
+                size_t special = path.find_first_of(":*", offset);
+                auto text = path.substr(offset, special == std::string::npos ? std::string::npos : special - offset);
+                if(!text.empty()) current = insert_static(current, text);
+                if(special == std::string::npos) break;
+
+                // parameters always span a whole segment
+                if(path[special - 1] != '/') return false;
+                size_t end = path.find('/', special);
+                auto param_name = path.substr(special + 1, end == std::string::npos ? std::string::npos : end - special - 1);
+                if(param_name.empty() || names->size() >= max_route_params) return false;
+                names->emplace_back(param_name);
+
+                if(path[special] == ':') {
+                    if(!current->param) current->param = std::make_unique<node>();
+                    current = current->param.get();
+                    offset = end == std::string::npos ? path.length() : end;
+                } else {
+                    // wildcard takes the rest, so nothing can follow it
+                    if(end != std::string::npos) return false;
+                    if(!current->wildcard) current->wildcard = std::make_unique<node>();
+                    current = current->wildcard.get();
+                    offset = path.length();
+                }
+            }
+
+            for(auto& r : current->routes) {
+                if(r.method == method) {
+                    r.target = target;
+                    r.names = std::move(names);
+                    return true;
+                }
+            }
+            current->routes.emplace_back(route { std::string(method), target, std::move(names) });
+            n_routes++;
+            return true;
+        }
+
+        bool router::match(const node *current, std::string_view method, std::string_view path, route_match& result, size_t depth) {
+            if(path.empty()) {
+                if(auto r = current->find_route(method)) {
+                    result.target = r->target;
+                    result.names = r->names;
+                    result.size = depth;
+                    return true;
+                }
+            } else {
+                // static text first, then a parameter, the wildcard goes last and each of them
+                // backtracks to the next one if the rest of the path doesn't match
+                size_t idx = current->indices.find(path[0]);
+                if(idx != std::string::npos) {
+                    const node *child = current->children[idx].get();
+                    if(path.starts_with(child->prefix) && match(child, method, path.substr(child->prefix.length()), result, depth))
+                        return true;
+                }
+                if(current->param && depth < max_route_params) {
+                    auto segment = path.substr(0, path.find('/'));
+                    if(!segment.empty()) {
+                        result.values[depth] = segment;
+                        if(match(current->param.get(), method, path.substr(segment.length()), result, depth + 1))
+                            return true;
+                    }
+                }
+            }
+            if(current->wildcard && depth < max_route_params) {
+                if(auto r = current->wildcard->find_route(method)) {
+                    result.values[depth] = path;
+                    result.target = r->target;
+                    result.names = r->names;
+                    result.size = depth + 1;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool router::match(std::string_view method, std::string_view path, route_match& result) const {
+            return match(&root, method, path, result, 0);
+        }
+
+        void router::clear() {
+            root = node();
+            n_routes = 0;
+        }
+
+        size_t router::size() const {
+            return n_routes;
+        }
+    }
+}
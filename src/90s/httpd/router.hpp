@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace s90 {
+    namespace httpd {
+
+        class page;
+
+        /// @brief Most path parameters a single route can capture
+        constexpr size_t max_route_params = 8;
+
+        /// @brief Result of a route lookup, parameter values refer to the looked up path
+        struct route_match {
+            page *target = nullptr;
+            std::shared_ptr<const std::vector<std::string>> names;
+            std::array<std::string_view, max_route_params> values;
+            size_t size = 0;
+
+            /// @brief Get captured parameter by name
+            /// @param name parameter name without : or *
+            /// @return value or nullptr if the route doesn't have such parameter
+            const std::string_view* find(std::string_view name) const {
+                if(!names) return nullptr;
+                for(size_t i = 0; i < size; i++) {
+                    if((*names)[i] == name) return &values[i];
+                }
+                return nullptr;
+            }
+        };
+
+        /// @brief Radix tree of page routes. Besides static text, a route can have `:name` segments
+        /// that capture a single path segment and end with `*name` that captures the rest of the
+        /// path. Static text has priority over parameters, and those over the wildcard. Lookups
+        /// don't allocate
+        class router {
+            struct route {
+                std::string method;
+                page *target = nullptr;
+                std::shared_ptr<const std::vector<std::string>> names;
+            };
+
+            struct node {
+                std::string prefix;
+                // first characters of static children, so the right child is found without
+                // touching the others
+                std::string indices;
+                std::vector<std::unique_ptr<node>> children;
+                std::unique_ptr<node> param;
+                std::unique_ptr<node> wildcard;
+                std::vector<route> routes;
+
+                const route* find_route(std::string_view method) const;
+            };
+
+            node root;
+            size_t n_routes = 0;
+
+            static node* insert_static(node *parent, std::string_view text);
+            static bool match(const node *current, std::string_view method, std::string_view path, route_match& result, size_t depth);
+        public:
+            /// @brief Add a route, existing route for the same method and path gets replaced
+            /// @param name page name, that is method and path, i.e. GET /posts/:id, or just path for all methods
+            /// @param target page
+            /// @return false if the path is malformed
+            bool insert(std::string_view name, page *target);
+
+            /// @brief Find page for a request
+            /// @param method HTTP method
+            /// @param path URL decoded path without query string
+            /// @param result page and captured parameters referring to `path`
+            /// @return true if found
+            bool match(std::string_view method, std::string_view path, route_match& result) const;
+
+            /// @brief Remove all routes
+            void clear();
+
+            /// @brief Get number of routes
+            /// @return number of routes
+            size_t size() const;
+        };
+    }
+}
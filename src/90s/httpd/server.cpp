@@ -1,9 +1,12 @@
 #include "server.hpp"
 #include "environment.hpp"
+#include "http2.hpp"
+#include "compression.hpp"
+#include "static_files.hpp"
 #include "../util/util.hpp"
+#include <algorithm>
+#include <charconv>
 #include <filesystem>
-#include <fstream>
-#include <sstream>
 #include <80s/algo.h>
 
 #ifdef _WIN32
@@ -40,50 +43,13 @@ namespace s90 {
         std::mutex httpd_server::loaded_libs_lock;
 
         class generic_error_page : public page {
-            std::string static_path = "";
         public:
             const char *name() const override {
                 return "GET /404";
             }
 
-            void set_static_path(const std::string& path) {
-                static_path = path;
-            }
-            
             aiopromise<std::expected<nil, status>> render(std::shared_ptr<ienvironment> env) const {
-                auto& ep = env->endpoint();
-                if(static_path.length() > 0 && ep.find("/static/") == 0) {
-                    std::filesystem::path root(static_path);
-                    root = root.lexically_normal();
-                    auto dest = root.concat(ep).lexically_normal();
-                    auto[rootEnd, nothing] = std::mismatch(root.begin(), root.end(), dest.begin());
-
-                    if(rootEnd != root.end())
-                        return render_error(env, status::forbidden);
-
-                    std::string mime = "text/plain";
-                    if(ep.ends_with(".js")) mime = "application/javascript";
-                    else if(ep.ends_with(".html")) mime = "text/html";
-                    else if(ep.ends_with(".css")) mime = "text/css";
-                    else if(ep.ends_with(".jpg")) mime = "image/jpeg";
-                    else if(ep.ends_with(".png")) mime = "image/png";
-                    if(std::filesystem::exists(dest)) {
-                        env->status("200 OK");
-                        env->header("content-type", mime);
-                        env->header("cache-control", "public, immutable, max-age=86400");
-                        std::ifstream is(dest, std::ios_base::binary);
-                        if(!is.is_open()) return render_error(env, status::internal_server_error);
-                        std::stringstream contents; contents << is.rdbuf();
-                        env->output()->write(contents.str());
-                        aiopromise<std::expected<nil, status>> prom;
-                        prom.resolve({});
-                        return prom;
-                    } else {
-                        return render_error(env, status::not_found);
-                    }
-                } else {
-                    return render_error(env, status::not_found);
-                }
+                return render_error(env, status::not_found);
             }
 
             aiopromise<std::expected<nil, status>> render_exception(std::shared_ptr<ienvironment> env, std::exception_ptr ptr) const {
@@ -185,7 +151,12 @@ namespace s90 {
         void httpd_server::load_libs() {
             std::string web_root = config.web_root;
             std::string master_key = config.master_key;
-            if(config.web_static.length() > 0) static_path = config.web_static;
+            if(config.web_static.length() > 0) {
+                // kept normalized and without the trailing slash, so endpoints can be appended to it as they are
+                auto root = std::filesystem::path(config.web_static).lexically_normal();
+                if(!root.has_filename()) root = root.parent_path();
+                static_path = root.string();
+            }
 
             enc_base = master_key;
 
@@ -199,8 +170,6 @@ namespace s90 {
             if(enc_base.length() == 0) enc_base = "ABCDEFGHIJKLMNOP";
             if(enc_base.length() < 16) enc_base = util::sha256(enc_base);
 
-            ((generic_error_page*)default_page)->set_static_path(static_path);
-
             for(auto& page : config.pages) {
                 load_page(page);
             }
@@ -217,6 +186,7 @@ namespace s90 {
                     printf("failed to load dynamic content from web root %s\n", web_root.c_str());
                 }
             }
+            build_routes();
         }
 
         void httpd_server::load_lib(const std::string& name) {
@@ -315,23 +285,275 @@ namespace s90 {
             }
 
             if(config.releaser && local_context) local_context = config.releaser(global_context, local_context);
+            build_routes();
         }
 
         void httpd_server::load_page(page* webpage) {
             pages[webpage->name()] = {webpage, false};
         }
 
+        void httpd_server::build_routes() {
+            routes.clear();
+            cache_policies.clear();
+            for(auto& [name, entry] : pages) {
+                if(!routes.insert(name, entry.webpage)) {
+                    dbgf(LOG_ERROR, "Invalid route %s\n", name.c_str());
+                }
+                auto directive = entry.webpage->cache();
+                if(directive) {
+                    auto policy = parse_cache_policy(directive);
+                    if(policy) {
+                        cache_policies[entry.webpage] = std::move(*policy);
+                    } else {
+                        dbgf(LOG_ERROR, "Invalid cache directive %s of %s\n", directive, name.c_str());
+                    }
+                }
+            }
+            // output of pages that were reloaded may differ now
+            if(global_context) page_cache::local(global_context)->clear();
+        }
+
+        page* httpd_server::prepare(std::shared_ptr<environment> env, std::string_view script, const std::string& peer_name, ptr<iafd> fd) {
+            page *current_page = default_page;
+
+            // parse status line into script & query string, query params get decoded once
+            // the page asks for them
+            size_t pivot = script.find('?');
+            if(pivot != std::string::npos) {
+                env->write_query(script.substr(pivot + 1));
+                script = script.substr(0, pivot);
+            }
+            // parameters captured by the route refer to the endpoint owned by the environment
+            env->write_endpoint(s90::util::url_decode(script));
+            route_match match;
+            if(routes.match(env->method(), env->endpoint(), match)) {
+                current_page = match.target;
+                env->write_route(std::move(match));
+            }
+
+            env->write_global_context(global_context);
+            env->write_local_context(local_context);
+            env->write_enc_base(enc_base);
+            env->write_peer(peer_name);
+            env->write_fd(fd);
+            return current_page;
+        }
+
+        bool httpd_server::serve_static(std::shared_ptr<environment> env) {
+            const auto& endpoint = env->endpoint();
+            bool head = env->method() == "HEAD";
+            if(static_path.empty() || !endpoint.starts_with("/static/") || (!head && env->method() != "GET")) return false;
+
+            std::string dest;
+            if(endpoint.find("/.") == std::string::npos && endpoint.find('\\') == std::string::npos) {
+                // nothing that could lead out of the directory, no need to normalize
+                dest = static_path + endpoint;
+            } else {
+                std::filesystem::path root(static_path);
+                auto normal = (root / endpoint.substr(1)).lexically_normal();
+                auto [root_end, _] = std::mismatch(root.begin(), root.end(), normal.begin(), normal.end());
+                if(root_end != root.end()) {
+                    static_cast<generic_error_page*>(default_page)->render_error(env, status::forbidden);
+                    return true;
+                }
+                dest = normal.string();
+            }
+
+            auto file = static_files::local(global_context)->get(dest);
+            if(!file) return false;
+
+            const static_file::variant *variant = &file->identity;
+            if(file->gzip) {
+                auto accept_encoding = env->header_view("accept-encoding");
+                if(accept_encoding && negotiate_coding(*accept_encoding) == content_coding::gzip) {
+                    variant = &*file->gzip;
+                }
+            }
+
+            // If-Modified-Since is only looked at without If-None-Match, browsers send it back as it was given
+            auto if_none_match = env->header_view("if-none-match");
+            auto if_modified_since = env->header_view("if-modified-since");
+            if(if_none_match ? etag_matches(*if_none_match, variant->etag) : if_modified_since && *if_modified_since == file->last_modified) {
+                env->status("304 Not Modified");
+                env->write_file(file, *variant, 0, 0, false);
+                return true;
+            }
+
+            byte_range range { 0, variant->size, true };
+            auto range_header = env->header_view("range");
+            auto if_range = env->header_view("if-range");
+            if(range_header && (!if_range || *if_range == variant->etag || *if_range == file->last_modified)) {
+                auto requested = parse_range(*range_header, variant->size);
+                if(requested && !requested->satisfiable) {
+                    env->status("416 Range Not Satisfiable");
+                    env->header("content-range", "bytes */" + std::to_string(variant->size));
+                    return true;
+                } else if(requested) {
+                    range = *requested;
+                    env->status("206 Partial Content");
+                    env->header("content-range", "bytes " + std::to_string(range.offset) + "-" + std::to_string(range.offset + range.length - 1) + "/" + std::to_string(variant->size));
+                }
+            }
+            env->write_file(file, *variant, range.offset, range.length, !head);
+            return true;
+        }
+
+        std::string httpd_server::cache_key(std::shared_ptr<environment> env, page *current_page, const cache_policy& policy) const {
+            std::string key = current_page->name();
+            key += '\n';
+            key += env->endpoint();
+            std::optional<dict<std::string, std::string>> cookies;
+            // values are prefixed by their length, so no two different requests end up with the same key
+            auto append = [&key](std::optional<std::string_view> value) {
+                key += '\n';
+                if(!value) return;
+                key += std::to_string(value->length());
+                key += ':';
+                key += *value;
+            };
+            for(const auto& vary : policy.vary) {
+                switch(vary.from) {
+                    case cache_vary::source::query:
+                        if(vary.name.empty()) {
+                            for(const auto& [k, v] : env->query()) {
+                                append(k);
+                                append(v);
+                            }
+                            key += '\n';
+                        } else {
+                            auto value = env->query(std::string(vary.name));
+                            append(value ? std::optional<std::string_view>(*value) : std::nullopt);
+                        }
+                        break;
+                    case cache_vary::source::cookie: {
+                        if(!cookies) cookies = env->cookies();
+                        auto it = cookies->find(vary.name);
+                        append(it == cookies->end() ? std::nullopt : std::optional<std::string_view>(it->second));
+                        break;
+                    }
+                    case cache_vary::source::header:
+                        append(env->header_view(vary.name));
+                        break;
+                    case cache_vary::source::param:
+                        append(env->param(vary.name));
+                        break;
+                }
+            }
+            return key;
+        }
+
+        aiopromise<nil> httpd_server::render_cached(std::shared_ptr<environment> env, page *current_page, const cache_policy& policy) {
+            auto cache = page_cache::local(global_context);
+            auto key = cache_key(env, current_page, policy);
+            auto found = cache->find(key, policy.shared);
+            if(!found.fresh) {
+                if(cache->claim(key, policy.shared)) {
+                    co_await render_page(env, current_page);
+                    cache->fill(key, co_await env->capture(), policy);
+                    co_return nil {};
+                }
+                // it's being rendered already, the expired output will do until then, without any
+                // the render is waited for if it happens on this worker, if it never ends, the page is rendered here
+                if(!found.page) found.page = co_await cache->wait(global_context, key);
+            }
+            if(found.page) {
+                env->write_cached(*found.page);
+                co_return nil {};
+            }
+            co_await render_page(env, current_page);
+            co_return nil {};
+        }
+
+        aiopromise<nil> httpd_server::render(std::shared_ptr<environment> env, page *current_page) {
+            // files of the static directory are served unless a page claims the path
+            if(current_page == default_page && serve_static(env)) co_return nil {};
+            if(!cache_policies.empty() && (env->method() == "GET" || env->method() == "HEAD")) {
+                auto policy = cache_policies.find(current_page);
+                if(policy != cache_policies.end()) {
+                    co_await render_cached(env, current_page, policy->second);
+                    co_return nil {};
+                }
+            }
+            co_await render_page(env, current_page);
+            co_return nil {};
+        }
+
+        aiopromise<nil> httpd_server::render_page(std::shared_ptr<environment> env, page *current_page) {
+            tracing::span render_trace("page::render");
+            auto page_coro = current_page->render(env);
+            auto page_result = co_await page_coro;
+            render_trace.end();
+            if(page_coro.has_exception()) {
+                env->clear();
+                static_cast<generic_error_page*>(default_page)->render_exception(env, page_coro.exception());
+            } else if(!page_result.has_value()) {
+                env->clear();
+                static_cast<generic_error_page*>(default_page)->render_error(env, page_result.error());
+            }
+            co_return nil {};
+        }
+
+        aiopromise<std::vector<std::string>> httpd_server::respond(std::shared_ptr<environment> env, page *current_page) {
+            co_await render(env, current_page);
+            co_return co_await env->http_response_segments();
+        }
+
+        std::shared_ptr<environment> httpd_server::acquire_environment() {
+            if(environment_pool.empty()) return std::make_shared<environment>();
+            auto env = std::move(environment_pool.back());
+            environment_pool.pop_back();
+            return env;
+        }
+
+        void httpd_server::recycle_environment(std::shared_ptr<environment>&& env) {
+            if(env.use_count() != 1 || environment_pool.size() >= max_pooled_environments) return;
+            env->recycle();
+            environment_pool.emplace_back(std::move(env));
+        }
+
+        aiopromise<bool> httpd_server::flush_responses(ptr<iafd> fd, std::deque<pending_response>& in_flight, size_t keep) {
+            // responses are written as the buffers they were rendered in, without joining them
+            std::vector<std::string> batch;
+            while(in_flight.size() > keep) {
+                auto pending = std::move(in_flight.front());
+                in_flight.pop_front();
+                auto segments = co_await pending.response;
+                if(batch.empty()) batch = std::move(segments);
+                else batch.insert(batch.end(), std::make_move_iterator(segments.begin()), std::make_move_iterator(segments.end()));
+                // finished coroutine frame holds the environment too, until the promise is gone
+                pending.response = aiopromise<std::vector<std::string>>();
+                bool streamed = pending.env->streaming();
+
+                // responses that are rendered already go out in the same write, so a burst of small
+                // responses doesn't end up in many small segments
+                if(streamed || pending.env->sends_body() || in_flight.size() <= keep || !in_flight.front().response.await_ready()) {
+                    if(!co_await fd->write(std::move(batch))) co_return false;
+                    batch = std::vector<std::string>();
+                }
+
+                // files and shared bodies that weren't small enough to go along with the head follow it without being copied
+                if(pending.env->sends_body() && !co_await pending.env->send_body(fd)) co_return false;
+
+                // rest of a streamed response goes out as it renders, responses after it wait for it
+                while(pending.env->streaming()) {
+                    auto chunk = co_await pending.env->http_chunk();
+                    if(!chunk.empty() && !co_await fd->write(std::move(chunk))) co_return false;
+                }
+                recycle_environment(std::move(pending.env));
+            }
+            co_return true;
+        }
+
         aiopromise<nil> httpd_server::on_accept(ptr<iafd> fd) {
             int64_t *rnrn_ref = rnrn.data();
             std::string peer_name;
-            dict<std::string, page*>::iterator it;
             page *current_page = default_page;
             std::string_view script;
-            std::string endpoint;
             read_arg arg;
-            std::shared_ptr<environment> env = std::make_shared<environment>();
-            size_t pivot = 0, body_length = 0, prev_pivot = 0;
-            bool write_status = true;
+            std::shared_ptr<environment> env;
+            size_t pivot = 0;
+            // responses of pipelined requests, oldest first, they are written strictly in this order
+            std::deque<pending_response> in_flight;
 
             char peer_name_buff[100];
             int peer_port = 0;
@@ -343,6 +565,9 @@ namespace s90 {
             }
 
             fd->set_timeout(90);
+            // responses of pipelined requests are written one by one as they finish rendering, with
+            // Nagle the second one would wait for the client's delayed ACK of the first
+            fd->set_nodelay(true);
 
             #if 0
             auto ssl_ctx = global_context->new_ssl_server_context("private/pubkey.pem", "private/privkey.pem");
@@ -356,14 +581,36 @@ namespace s90 {
             while(true) {
                 // implement basic HTTP loop by waiting until \r\n\r\n, parsing header and then
                 // optinally waiting for `n` bytes of the body
-                arg = co_await fd->read_until("\r\n\r\n", rnrn_ref);
+                auto next_request = fd->read_until("\r\n\r\n", rnrn_ref);
+
+                // while further pipelined requests are already buffered, keep parsing them so they render
+                // concurrently, once there is nothing more to parse, write out what is done meanwhile
+                if(!next_request.is_settled()) {
+                    if(!co_await flush_responses(fd, in_flight, 0)) co_return {};
+                } else if(in_flight.size() >= max_pipeline_depth) {
+                    if(!co_await flush_responses(fd, in_flight, max_pipeline_depth - 1)) co_return {};
+                }
+
+                arg = co_await next_request;
                 if(arg.error) co_return {};
+                env = acquire_environment();
 
                 pivot = arg.data.find("\r\n");
-                std::string_view remaining(arg.data);
-                std::string_view status(arg.data);
-                if(pivot == std::string::npos) co_return {};
-                status = std::string_view(arg.data.begin(), arg.data.begin() + pivot);
+                if(pivot == std::string::npos) {
+                    // HTTP/2 connection preface reads as a request line with no headers
+                    if(arg.data != "PRI * HTTP/2.0") co_return {};
+                    if(!co_await flush_responses(fd, in_flight, 0)) co_return {};
+                    auto preface = co_await fd->read_n(http2_preface_tail.length());
+                    if(preface.error || preface.data != http2_preface_tail) co_return {};
+                    auto session = std::make_shared<http2_session>(this, fd, peer_name);
+                    co_await session->serve();
+                    co_return {};
+                }
+
+                // the read buffer gets reused by the next read while this request may still be
+                // rendering, so the head is copied once and everything else only refers to the copy
+                std::string_view remaining = env->write_request_head(arg.data);
+                std::string_view status = remaining.substr(0, pivot);
                 pivot = status.find(' ');
                 
                 // parse the status line
@@ -387,56 +634,29 @@ namespace s90 {
                     std::string_view header_line = remaining.substr(0, pivot);
                     auto mid_key = header_line.find(": ");
                     if(mid_key != std::string::npos) {
-                        env->write_header(
-                            std::string(header_line.substr(0, mid_key)),
-                            std::string(header_line.substr(mid_key + 2))
-                        );
+                        env->write_header(header_line.substr(0, mid_key), header_line.substr(mid_key + 2));
                     }
                     if(pivot == std::string::npos) break;
                     remaining = remaining.substr(pivot + 2);
                     if(remaining.length() == 0) break;
                 }
 
-                // parse status line into script & query params
-                pivot = script.find('?');
-                if(pivot != std::string::npos) {
-                    auto query_string = script.substr(pivot + 1);
-                    script = script.substr(0, pivot);
-                    endpoint = s90::util::url_decode(script);
-                    auto query = s90::util::parse_query_string(query_string);
-                    // if there is encrypted query, try to decrypt it using (enc_base + endpoint) as a key
-                    if(enc_base.length() >= 16) {
-                        auto e_it = query.find("e");
-                        if(e_it != query.end()) {
-                            auto decoded = util::from_b64(e_it->second);
-                            if(decoded.has_value()) {
-                                auto decrypted = util::cipher(*decoded, enc_base + endpoint, false, false);
-                                if(decrypted.has_value()) {
-                                    env->write_signed_query(std::move(util::parse_query_string(*decrypted)));
-                                }
-                            }
-                        }
-                    }
-                    env->write_query(std::move(query));
-                } else {
-                    endpoint = s90::util::url_decode(script);
-                }
-                auto page_it = pages.find(endpoint);
-                if(page_it == pages.end()) {
-                    page_it = pages.find(env->method() + " " + endpoint);
-                    if(page_it == pages.end()) {
-                        current_page = default_page;
-                    } else {
-                        current_page = page_it->second.webpage;
-                    }
-                } else {
-                    current_page = page_it->second.webpage;
-                }
+                current_page = prepare(env, script, peer_name, fd);
+
+                // root of the spans recorded while handling this request
+                tracing::span request_trace("httpd::request", env->endpoint());
+
+                // requests that may have side effects see all the previous ones finished and finish
+                // before any later one starts, same goes for the ones that can take over the connection
+                auto upgrade = env->header_view("upgrade");
+                bool concurrent = (env->method() == "GET" || env->method() == "HEAD") && !upgrade;
+                if(!concurrent && !co_await flush_responses(fd, in_flight, 0)) co_return {};
 
                 // read body if applicable
-                auto content_length = env->header("content-length");
+                auto content_length = env->header_view("content-length");
                 if(content_length) {
-                    auto len = atoll(content_length->c_str());
+                    int64_t len = 0;
+                    std::from_chars(content_length->data(), content_length->data() + content_length->length(), len);
                     if(len > 0) {
                         auto body = co_await fd->read_n(len);
                         if(body.error) co_return {};
@@ -444,32 +664,27 @@ namespace s90 {
                     }
                 }
 
-                // generate the response
-                env->header("connection", "keep-alive");
-                env->write_global_context(global_context);
-                env->write_local_context(local_context);
-                env->write_endpoint(endpoint);
-                env->write_enc_base(enc_base);
-                env->write_peer(peer_name);
-                env->write_fd(fd);
-
-                auto page_coro = current_page->render(env);
-                auto page_result = co_await page_coro;
-                if(page_coro.has_exception()) {
-                    env->clear();
-                    static_cast<generic_error_page*>(default_page)->render_exception(env, page_coro.exception());
-                } else if(!page_result.has_value()) {
-                    env->clear();
-                    static_cast<generic_error_page*>(default_page)->render_error(env, page_result.error());
-                }
-                write_status = co_await fd->write(co_await env->http_response());
-                if(!write_status) {
+                // upgrade to cleartext HTTP/2, the request itself is answered as its first stream
+                auto http2_settings = env->header_view("http2-settings");
+                if(upgrade && http2_settings && std::ranges::equal(*upgrade, std::string_view("h2c"), [](char a, char b) { return std::tolower(a) == b; })) {
+                    request_trace.end();
+                    if(!co_await fd->write("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n")) co_return {};
+                    auto session = std::make_shared<http2_session>(this, fd, peer_name);
+                    co_await session->serve(std::move(env), current_page, *http2_settings);
                     co_return {};
-                } else {
-                    env = std::make_shared<environment>();
                 }
+
+                // generate the response
+                env->header("connection", "keep-alive");
+
+                auto response = respond(env, current_page);
+                // the request span ends once its response is written, the environment gets
+                // recycled then too
+                request_trace.detach();
+                in_flight.emplace_back(pending_response { std::move(response), std::move(env), std::move(request_trace) });
+                if(!concurrent && !co_await flush_responses(fd, in_flight, 0)) co_return {};
             }
             co_return {};
         }
     }
-}
\ No newline at end of file
+}
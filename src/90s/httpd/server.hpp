@@ -2,6 +2,9 @@
 #include "../context.hpp"
 #include "../afd.hpp"
 #include "page.hpp"
+#include "page_cache.hpp"
+#include "router.hpp"
+#include <deque>
 #include <memory>
 #include <string>
 #include <mutex>
@@ -9,6 +12,8 @@
 namespace s90 {
     namespace httpd {
 
+        class environment;
+
         typedef void*(*pfnloadpage)();
         typedef void(*pfnunloadwebpage)(void*);
 
@@ -47,6 +52,12 @@ namespace s90 {
         };
 
         class httpd_server : public connection_handler {
+            /// @brief pipelined requests rendered at once per connection, reading further requests waits
+            /// until the oldest response is written
+            static constexpr size_t max_pipeline_depth = 16;
+
+            /// @brief most environments kept for reuse, enough to cover the requests usually in flight
+            static constexpr size_t max_pooled_environments = 256;
 
             struct loaded_lib {
 #ifdef _WIN32
@@ -73,6 +84,9 @@ namespace s90 {
             };
 
             dict<std::string, loaded_page> pages;
+            router routes;
+            /// @brief Cache policies of the pages that declare one, parsed once the routes are built
+            dict<page*, cache_policy> cache_policies;
             static dict<std::string, loaded_lib> loaded_libs;
             static std::mutex loaded_libs_lock;
             void *local_context = nullptr;
@@ -87,6 +101,64 @@ namespace s90 {
             void load_libs();
             void unload_libs();
             void load_page(page *webpage);
+            void build_routes();
+
+            std::vector<std::shared_ptr<environment>> environment_pool;
+
+            /// @brief Get an environment for a new request, reusing a recycled one if possible
+            /// @return empty environment
+            std::shared_ptr<environment> acquire_environment();
+
+            /// @brief Return environment of a finished request to the pool, environments still
+            /// referred to from elsewhere are left alone
+            /// @param env environment
+            void recycle_environment(std::shared_ptr<environment>&& env);
+
+            /// @brief Response of a pipelined request that is being rendered
+            struct pending_response {
+                aiopromise<std::vector<std::string>> response;
+                std::shared_ptr<environment> env;
+                tracing::span trace;
+            };
+
+            /// @brief Parse the request target, resolve the page that handles it and pass the rest
+            /// of the request context to the environment
+            /// @param env environment with method and headers written already
+            /// @param script request target including the query string
+            /// @param peer_name peer name of the connection
+            /// @param fd connection
+            /// @return page to render
+            page* prepare(std::shared_ptr<environment> env, std::string_view script, const std::string& peer_name, ptr<iafd> fd);
+
+            /// @brief Serve a file from the static directory if the request is for one
+            /// @param env environment
+            /// @return true if the response is set up, false if the request is left to the page
+            bool serve_static(std::shared_ptr<environment> env);
+
+            /// @brief Build key the output of a cached page is stored under
+            /// @param env environment
+            /// @param current_page page
+            /// @param policy cache policy of the page
+            /// @return cache key
+            std::string cache_key(std::shared_ptr<environment> env, page *current_page, const cache_policy& policy) const;
+
+            /// @brief Respond with cached output of the page, rendering and storing it if it isn't cached
+            /// or has expired
+            /// @param env environment
+            /// @param current_page page
+            /// @param policy cache policy of the page
+            aiopromise<nil> render_cached(std::shared_ptr<environment> env, page *current_page, const cache_policy& policy);
+
+            /// @brief Render the page itself, errors and exceptions render the error page instead
+            aiopromise<nil> render_page(std::shared_ptr<environment> env, page *current_page);
+
+            /// @brief Render the page or serve it from the static directory or the page cache
+            aiopromise<nil> render(std::shared_ptr<environment> env, page *current_page);
+
+            aiopromise<std::vector<std::string>> respond(std::shared_ptr<environment> env, page *current_page);
+            aiopromise<bool> flush_responses(ptr<iafd> fd, std::deque<pending_response>& in_flight, size_t keep);
+
+            friend class http2_session;
         public:
             httpd_server(icontext *parent, httpd_config config = {});
             ~httpd_server();
@@ -0,0 +1,311 @@
+#include "static_files.hpp"
+#include "compression.hpp"
+#include "../util/util.hpp"
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <ranges>
+
+#ifdef USE_INOTIFY
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace s90 {
+    namespace httpd {
+
+        std::string_view static_content_type(std::string_view path) {
+            static const std::pair<std::string_view, std::string_view> types[] = {
+                { ".html", "text/html" },
+                { ".htm", "text/html" },
+                { ".css", "text/css" },
+                { ".js", "application/javascript" },
+                { ".mjs", "application/javascript" },
+                { ".json", "application/json" },
+                { ".map", "application/json" },
+                { ".xml", "application/xml" },
+                { ".txt", "text/plain" },
+                { ".svg", "image/svg+xml" },
+                { ".png", "image/png" },
+                { ".jpg", "image/jpeg" },
+                { ".jpeg", "image/jpeg" },
+                { ".gif", "image/gif" },
+                { ".webp", "image/webp" },
+                { ".avif", "image/avif" },
+                { ".ico", "image/x-icon" },
+                { ".woff", "font/woff" },
+                { ".woff2", "font/woff2" },
+                { ".ttf", "font/ttf" },
+                { ".wasm", "application/wasm" },
+                { ".pdf", "application/pdf" },
+                { ".mp4", "video/mp4" },
+                { ".webm", "video/webm" },
+            };
+            for(const auto& [extension, type] : types) {
+                if(path.ends_with(extension)) return type;
+            }
+            return "text/plain";
+        }
+
+        std::optional<byte_range> parse_range(std::string_view range, size_t size) {
+            if(!range.starts_with("bytes=")) return {};
+            range.remove_prefix(6);
+            // serving several ranges at once isn't worth it, the whole file goes out instead
+            if(range.find(',') != std::string_view::npos) return {};
+            auto dash = range.find('-');
+            if(dash == std::string_view::npos) return {};
+            auto first = range.substr(0, dash), last = range.substr(dash + 1);
+            uint64_t start = 0, end = 0;
+            if(first.empty()) {
+                // bytes=-n is the last n bytes
+                if(last.empty() || std::from_chars(last.data(), last.data() + last.length(), end).ptr != last.data() + last.length()) return {};
+                if(end == 0 || size == 0) return byte_range { 0, 0, false };
+                end = std::min(end, (uint64_t)size);
+                return byte_range { size - end, (size_t)end, true };
+            }
+            if(std::from_chars(first.data(), first.data() + first.length(), start).ptr != first.data() + first.length()) return {};
+            if(last.empty()) {
+                end = size;
+            } else {
+                if(std::from_chars(last.data(), last.data() + last.length(), end).ptr != last.data() + last.length() || end < start) return {};
+                end = std::min(end + 1, (uint64_t)size);
+            }
+            if(start >= size) return byte_range { 0, 0, false };
+            return byte_range { start, (size_t)(end - start), true };
+        }
+
+        bool etag_matches(std::string_view if_none_match, std::string_view etag) {
+            for(auto part : std::ranges::split_view(if_none_match, ',')) {
+                std::string_view tag(part.begin(), part.end());
+                while(!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) tag.remove_prefix(1);
+                while(!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) tag.remove_suffix(1);
+                if(tag.starts_with("W/")) tag.remove_prefix(2);
+                if(tag == "*" || tag == etag) return true;
+            }
+            return false;
+        }
+
+        static std::optional<static_file::variant> load_variant(const std::string& path) {
+            std::error_code ec;
+            if(!std::filesystem::is_regular_file(path, ec)) return {};
+            auto size = std::filesystem::file_size(path, ec);
+            if(ec) return {};
+            auto modified = std::filesystem::last_write_time(path, ec);
+            if(ec) return {};
+
+            // size and modification time change with every write, that's enough of a validator
+            // without having to hash the contents
+            char etag[64];
+            snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+                (unsigned long long)size,
+                (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(modified.time_since_epoch()).count()
+            );
+
+            static_file::variant result { path, etag, "", size, nullptr };
+            if(size <= max_cached_file_size) {
+                std::ifstream is(path, std::ios_base::binary);
+                if(!is.is_open()) return {};
+                auto contents = ptr_new<std::string>(size, '\0');
+                if(!is.read(contents->data(), size)) return {};
+                result.contents = contents;
+            }
+            return result;
+        }
+
+        static std::string http_date(std::filesystem::file_time_type modified) {
+            auto seconds = std::chrono::system_clock::to_time_t(
+                std::chrono::time_point_cast<std::chrono::system_clock::duration>(std::chrono::file_clock::to_sys(modified))
+            );
+            std::tm utc;
+#ifdef _WIN32
+            gmtime_s(&utc, &seconds);
+#else
+            gmtime_r(&seconds, &utc);
+#endif
+            static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+            static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+            char date[32];
+            snprintf(date, sizeof(date), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                days[utc.tm_wday], utc.tm_mday, months[utc.tm_mon], utc.tm_year + 1900, utc.tm_hour, utc.tm_min, utc.tm_sec);
+            return date;
+        }
+
+        ptr<const static_file> static_files::load(const std::string& path, bool compress) const {
+            auto identity = load_variant(path);
+            if(!identity) return nullptr;
+            std::error_code ec;
+            auto modified = std::filesystem::last_write_time(path, ec);
+            if(ec) return nullptr;
+
+            auto file = ptr_new<static_file>();
+            file->content_type = static_content_type(path);
+            file->last_modified = http_date(modified);
+            file->identity = std::move(*identity);
+
+            // .gz made along with the file is preferred, a stale one that's older than the file is ignored
+            auto gzip = load_variant(path + ".gz");
+            if(gzip && std::filesystem::last_write_time(gzip->path, ec) >= modified) {
+                file->gzip = std::move(gzip);
+            } else if(compress && file->identity.contents && file->identity.size >= min_compressed_length && compressible_type(file->content_type)) {
+                // otherwise files that compress well are compressed once, as well as it gets, since it's kept
+                util::deflate_stream stream(true, util::compression_format::gzip, 9);
+                auto compressed = stream.update(*file->identity.contents, util::flush_mode::finish);
+                if(compressed && compressed->length() < file->identity.size) {
+                    auto size = compressed->length();
+                    file->gzip = static_file::variant { path, file->identity.etag, "", size, ptr_new<std::string>(std::move(*compressed)) };
+                }
+            }
+            if(file->gzip) {
+                // the gzipped variant is a different representation, so it needs a different tag
+                file->gzip->etag.insert(file->gzip->etag.length() - 1, "-gz");
+            }
+
+            // header fields are the same for every response, so they're formatted just once
+            auto format_fields = [&file](static_file::variant& variant, bool gzipped) {
+                variant.fields = "accept-ranges: bytes\r\ncache-control: public, immutable, max-age=86400\r\n";
+                if(gzipped) variant.fields += "content-encoding: gzip\r\n";
+                variant.fields += "content-type: " + file->content_type + "\r\n";
+                variant.fields += "etag: " + variant.etag + "\r\n";
+                variant.fields += "last-modified: " + file->last_modified + "\r\n";
+                if(file->gzip) variant.fields += "vary: accept-encoding\r\n";
+            };
+            format_fields(file->identity, false);
+            if(file->gzip) format_fields(*file->gzip, true);
+            return file;
+        }
+
+        static_files::static_files() {
+#ifdef USE_INOTIFY
+            watcher = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+        }
+
+        static_files::~static_files() {
+#ifdef USE_INOTIFY
+            if(watcher >= 0) close(watcher);
+#endif
+        }
+
+        ptr<static_files> static_files::local(icontext *ctx) {
+            constexpr std::string_view store_key = "httpd::static_files";
+            auto files = static_pointer_cast<static_files>(ctx->store(store_key));
+            if(!files) {
+                files = ptr_new<static_files>();
+                ctx->store(store_key, files);
+            }
+            return files;
+        }
+
+        bool static_files::watch(const std::string& path) {
+#ifdef USE_INOTIFY
+            if(watcher < 0) return false;
+            auto dir = path.substr(0, path.rfind('/') + 1);
+            if(dir.empty()) dir = "./";
+            if(dir_watches.contains(dir)) return true;
+            int wd = inotify_add_watch(watcher, dir.c_str(), IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+            if(wd < 0) return false;
+            watched_dirs[wd] = dir;
+            dir_watches[dir] = wd;
+            return true;
+#else
+            return true;
+#endif
+        }
+
+        ptr<const static_file> static_files::get(const std::string& path) {
+            // the queue is read on every look up, so a file changed before the request came is never
+            // served stale, with nothing queued that's a single read that fails right away
+            drain_events();
+            auto it = entries.find(path);
+            if(it != entries.end()) {
+                recently_used.splice(recently_used.end(), recently_used, it->second.order);
+                return it->second.file;
+            }
+
+            // the watch goes first, so changes made while the file is being read aren't missed, without
+            // it there would be no telling when the file changes, so it's not kept
+            bool watched = watch(path);
+            auto file = load(path, watched);
+            if(!file || !watched) return file;
+
+            size_t cost = path.length() + sizeof(static_file);
+            if(file->identity.contents) cost += file->identity.size;
+            if(file->gzip && file->gzip->contents) cost += file->gzip->size;
+            if(cost > max_cached_bytes) return file;
+            cached_bytes += cost;
+            while(cached_bytes > max_cached_bytes && !recently_used.empty()) {
+                evict(recently_used.front());
+            }
+            recently_used.push_back(path);
+            entries.emplace(path, entry { file, std::prev(recently_used.end()), cost });
+            return file;
+        }
+
+        void static_files::evict(const std::string& path) {
+            auto it = entries.find(path);
+            if(it == entries.end()) return;
+            cached_bytes -= it->second.cost;
+            recently_used.erase(it->second.order);
+            entries.erase(it);
+        }
+
+        void static_files::evict_prefix(const std::string& prefix) {
+            for(auto it = entries.lower_bound(prefix); it != entries.end() && it->first.starts_with(prefix);) {
+                cached_bytes -= it->second.cost;
+                recently_used.erase(it->second.order);
+                it = entries.erase(it);
+            }
+        }
+
+        void static_files::drain_events() {
+#ifdef USE_INOTIFY
+            if(watcher < 0) return;
+            alignas(inotify_event) char events[16384];
+            ssize_t length;
+            while((length = read(watcher, events, sizeof(events))) > 0) {
+                for(ssize_t i = 0; i < length; ) {
+                    auto evt = (const inotify_event*)(events + i);
+                    i += sizeof(inotify_event) + evt->len;
+                    if(evt->mask & IN_Q_OVERFLOW) {
+                        // some events were lost, anything may have changed
+                        entries.clear();
+                        recently_used.clear();
+                        cached_bytes = 0;
+                        continue;
+                    }
+                    auto dir = watched_dirs.find(evt->wd);
+                    if(dir == watched_dirs.end()) continue;
+                    if(evt->len > 0) {
+                        std::string path = dir->second + evt->name;
+                        // change of x.gz changes what's sent for x as well
+                        if(path.ends_with(".gz")) evict(path.substr(0, path.length() - 3));
+                        evict(path);
+                        if(evt->mask & IN_ISDIR) evict_prefix(path + "/");
+                    } else {
+                        // the directory itself went away
+                        evict_prefix(dir->second);
+                    }
+                    if(evt->mask & IN_IGNORED) {
+                        dir_watches.erase(dir->second);
+                        watched_dirs.erase(dir);
+                    }
+                }
+            }
+#endif
+        }
+
+        void static_files::update() {
+#ifdef USE_INOTIFY
+            drain_events();
+#else
+            // there is no telling what changed, so nothing is kept longer than a tick
+            entries.clear();
+            recently_used.clear();
+            cached_bytes = 0;
+#endif
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "../context.hpp"
+#include <chrono>
+#include <ctime>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace s90 {
+    namespace httpd {
+
+        /// @brief Largest file kept in memory, larger ones are sent straight from disk
+        constexpr size_t max_cached_file_size = 1024 * 1024;
+
+        /// @brief Bodies up to this size are copied right after the response head, so both go out in one write
+        constexpr size_t max_inlined_file_size = 16 * 1024;
+
+        /// @brief File of the static directory as it was when it was looked up
+        struct static_file {
+            /// @brief One of the ways the file can be sent, either as it is or gzipped
+            struct variant {
+                std::string path;
+                std::string etag;
+                /// @brief response header fields of the variant, formatted so they can be copied to the head as they are
+                std::string fields;
+                size_t size = 0;
+                /// @brief contents, nullptr if the file is too large to be kept in memory
+                ptr<const std::string> contents;
+            };
+
+            std::string content_type;
+            std::string last_modified;
+            variant identity;
+            /// @brief gzipped variant, either the .gz file next to it or compressed once it was loaded
+            std::optional<variant> gzip;
+        };
+
+        /// @brief Get the MIME type of a file by its extension
+        /// @param path file path
+        /// @return MIME type, text/plain if unknown
+        std::string_view static_content_type(std::string_view path);
+
+        /// @brief Part of a file asked for by Range header
+        struct byte_range {
+            uint64_t offset = 0;
+            size_t length = 0;
+            /// @brief false if the range lies past the end of the file
+            bool satisfiable = true;
+        };
+
+        /// @brief Parse Range header, only a single range of bytes is supported
+        /// @param range Range header value
+        /// @param size file size
+        /// @return range, nothing if the header is to be ignored and the whole file sent
+        std::optional<byte_range> parse_range(std::string_view range, size_t size);
+
+        /// @brief Check if If-None-Match matches the tag, using weak comparison
+        /// @param if_none_match If-None-Match header value
+        /// @param etag entity tag of the file
+        /// @return true if any of the listed tags matches
+        bool etag_matches(std::string_view if_none_match, std::string_view etag);
+
+        /// @brief Files of the static directory of the worker, kept in memory up to a limit and dropped as soon
+        /// as they change on disk (inotify on Linux, elsewhere they are kept for a tick at most)
+        class static_files : public storable {
+            /// @brief Most bytes of file contents kept, least recently used files go first
+            static constexpr size_t max_cached_bytes = 32 * 1024 * 1024;
+
+            struct entry {
+                ptr<const static_file> file;
+                std::list<std::string>::iterator order;
+                size_t cost;
+            };
+
+            dict<std::string, entry> entries;
+            std::list<std::string> recently_used;
+            size_t cached_bytes = 0;
+
+            int watcher = -1;
+            dict<int, std::string> watched_dirs;
+            dict<std::string, int> dir_watches;
+
+            ptr<const static_file> load(const std::string& path, bool compress) const;
+            bool watch(const std::string& path);
+            void evict(const std::string& path);
+            void evict_prefix(const std::string& prefix);
+            void drain_events();
+
+        public:
+            static_files();
+            ~static_files();
+
+            /// @brief Get the files of the worker
+            /// @param ctx global context
+            /// @return files
+            static ptr<static_files> local(icontext *ctx);
+
+            /// @brief Look up a file, loading it if it isn't known yet
+            /// @param path file path
+            /// @return file or nullptr if there is no such regular file
+            ptr<const static_file> get(const std::string& path);
+
+            void update() override;
+        };
+    }
+}
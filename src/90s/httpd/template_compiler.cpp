@@ -259,18 +259,29 @@ namespace s90 {
                 script_name += estimate_name;
             }
 
-            // resolve the #! beginning of the file and parse the endpoint name from it
-            if(data.find("#!") == 0) {
+            // resolve the #! lines at the beginning of the file, the endpoint name and directives such as CACHE
+            std::string cache_directive;
+            while(data.starts_with("#!")) {
                 size_t line_end = data.find("\n");
                 std::string line;
                 if(line_end == std::string::npos) {
                     line = data.substr(2);
+                    data = "";
                 } else {
                     line = data.substr(2, line_end - 2);
-                    data = data.substr(line_end);
+                    data = data.substr(line_end + 1);
                 }
                 trim(line);
-                script_name = line;
+                if(line.starts_with("CACHE ")) {
+                    // it ends up in a string literal, it's validated once the page gets loaded
+                    for(char c : line.substr(6)) {
+                        if(c == '"' || c == '\\') cache_directive += '\\';
+                        cache_directive += c;
+                    }
+                    trim(cache_directive);
+                } else {
+                    script_name = line;
+                }
             }
 
             trim(data);
@@ -287,8 +298,9 @@ namespace s90 {
                     ss << is.rdbuf();
                     included_file = ss.str();
                     // if we include file, make sure we strip the #! from there!
-                    if(included_file.starts_with("#!")) {
-                        included_file = included_file.substr(included_file.find("\n") + 1);
+                    while(included_file.starts_with("#!")) {
+                        auto line_end = included_file.find("\n");
+                        included_file = line_end == std::string::npos ? "" : included_file.substr(line_end + 1);
                     }
                 } else {
                     included_file = "\"Failed to include file " + actual_path.lexically_normal().string() + "\"";
@@ -339,6 +351,10 @@ namespace s90 {
                     "    const char *name() const override {\n"
                     "        return \"" + script_name + "\";\n"
                     "    }\n\n"
+                    + (cache_directive.empty() ? "" :
+                    "    const char *cache() const override {\n"
+                    "        return \"" + cache_directive + "\";\n"
+                    "    }\n\n") +
                     "    aiopromise<std::expected<nil, status>> render(std::shared_ptr<ienvironment> env) const override {\n"
                     "        env->content_type(\"" + mime_type + "\");\n"
                     + out + "\n"
@@ -38,6 +38,10 @@ namespace s90 {
         constexpr auto WRITE_ERROR = "write_error";
 
         constexpr auto WAIT = "wait";
+        constexpr auto TIMEOUT = "timeout";
+
+        constexpr auto POOL_CLOSED = "pool_closed";
+        constexpr auto POOL_FULL = "pool_full";
 
         constexpr auto NOT_IMPLEMENTED = "not_implemented";
         constexpr auto DISK_CONNECTIVITY = "disk_connectivity";
@@ -7,22 +7,6 @@ namespace s90 {
 
         }
 
-        mysql::~mysql() {
-            auto& connection = connection_ref;
-            if(connection && !connection->is_closed() && !connection->is_error()) {
-                connection->close();
-            }
-            while(!connecting.empty()) {
-                auto c = connecting.front();
-                connecting.pop();
-                if(auto p = c.lock()) {
-                    aiopromise(p).resolve(
-                        std::make_tuple<sql_connect, ptr<iafd>>({true, "mysql is gone"}, nullptr)
-                    );
-                }
-            }
-        }
-
         aiopromise<mysql_packet> mysql::read_packet(ptr<iafd> connection) {
             dbgf(LOG_DEBUG, "Read packet header\n");
             auto data = co_await connection->read_n(4);
@@ -89,94 +73,74 @@ namespace s90 {
             sql_port = port;
             db_name = database;
             login_provided = true;
-            co_return std::move(co_await reconnect());
-        }
-
-        aiopromise<std::tuple<sql_connect, ptr<iafd>>> mysql::obtain_connection() {
-            auto& connection = connection_ref;
-            if(connection && !connection->is_closed() && !connection->is_error() && authenticated) {
-                dbgf(LOG_DEBUG, "SQL connection obtained\n");
-                co_return std::make_tuple(sql_connect {false, ""}, connection);
-            }
-            dbgf(LOG_DEBUG, "Obtaining SQL connection\n");
-            if(is_connecting) {
-                dbgf(LOG_DEBUG, "Reconnect - already connecting\n");
-                aiopromise<std::tuple<sql_connect, ptr<iafd>>> promise;
-                connecting.emplace(promise.weak());
-                co_return std::move(co_await promise);
-            } else {
-                dbgf(LOG_DEBUG, "Reconnect - first connect\n");
-                // connect if not connected
-                is_connecting = true;
-                authenticated = false;
-                bool conn_ok = true;
-                std::string conn_error = "unknown error";
-                if(!connection || connection->is_closed() || connection->is_error()) {
+            // instances logging in the same way share the connections, the factory must not refer
+            // to this instance as the pool can outlive it
+            pool = ctx->get_pool(
+                "mysql:" + user + "@" + host + ":" + std::to_string(port) + "/" + db_name,
+                [ctx = ctx, host = host, port, user = user, password = password, db_name = db_name, init_sql = enqueued_sql]() -> aiopromise<connect_result> {
                     dbgf(LOG_DEBUG, "Reconnect - get connection\n");
-                    auto conn_result = co_await ctx->connect(host, dns_type::A, sql_port, proto::tcp);
-                    conn_ok = !conn_result.error;
-                    connection_ref = conn_result.fd;
-                    conn_error = conn_result.error_message;
-                }
-                dbgf(LOG_DEBUG, "Reconnect - connection obtained\n");
-                if(!conn_ok || !connection || connection->is_error() || connection->is_closed()) {
-                    dbgf(LOG_DEBUG, "Reconnect - obtained connection failure\n");
-                    connection = nullptr;
-                    is_connecting = false;
-                    while(!connecting.empty()) {
-                        dbgf(LOG_DEBUG, "Reconnect - resolve waiting (failure)\n");
-                        auto c = connecting.front();
-                        connecting.pop();
-                        if(auto p = c.lock()) {
-                            aiopromise(p).resolve(std::make_tuple<sql_connect, ptr<iafd>>({true, "failed to establish connection: " + conn_error}, nullptr));
-                        }
+                    auto conn_result = co_await ctx->connect(host, dns_type::A, port, proto::tcp);
+                    if(!conn_result) {
+                        dbgf(LOG_DEBUG, "Reconnect - obtained connection failure\n");
+                        co_return connect_result { true, nullptr, "failed to establish connection: " + conn_result.error_message };
                     }
-                    co_return std::make_tuple<sql_connect, ptr<iafd>>({true, "failed to establish connection: " + conn_error}, nullptr);
-                }
-                dbgf(LOG_DEBUG, "Reconnect - obtained connection ok\n");
-                connection->set_name("mysql");
-                auto result = co_await handshake(connection);
-                dbgf(LOG_DEBUG, "Reconnect - handshake %s\n", result.error ? "fail" : "ok");
-                if(!result.error && enqueued_sql.length() > 0) {
-                    dbgf(LOG_DEBUG, "Executing initial SQL\n");
-                    auto command = encode_le24(enqueued_sql.length() + 1) + '\0' + '\3' + enqueued_sql;
-                    enqueued_sql.clear();
-                    auto write_ok = co_await connection->write(command);
-                    if(write_ok) {
-                        auto response = co_await read_packet(connection);
-                        if(!(response.seq < 0 || response.data.length() < 1)) {
-                            mysql_decoder decoder(response.data);
-                            auto status = decoder.decode_status();
-                            if(status.error) {
-                                dbgf(LOG_ERROR, "mysql: SQL On Connect: %s\n", status.error_message.c_str());
+                    auto connection = conn_result.fd;
+                    connection->set_name("mysql");
+                    auto result = co_await handshake(connection, user, password, db_name);
+                    dbgf(LOG_DEBUG, "Reconnect - handshake %s\n", result.error ? "fail" : "ok");
+                    if(result.error) {
+                        connection->close();
+                        co_return connect_result { true, nullptr, result.error_message };
+                    }
+                    if(init_sql->length() > 0) {
+                        dbgf(LOG_DEBUG, "Executing initial SQL\n");
+                        auto command = encode_le24(init_sql->length() + 1) + '\0' + '\3' + *init_sql;
+                        auto write_ok = co_await connection->write(std::move(command));
+                        if(write_ok) {
+                            auto response = co_await read_packet(connection);
+                            if(!(response.seq < 0 || response.data.length() < 1)) {
+                                mysql_decoder decoder(response.data);
+                                auto status = decoder.decode_status();
+                                if(status.error) {
+                                    dbgf(LOG_ERROR, "mysql: SQL On Connect: %s\n", status.error_message.c_str());
+                                }
+                            } else {
+                                dbgf(LOG_ERROR, "mysql: Failed to lock the initial SQL command\n");
                             }
-                        } else {
-                            dbgf(LOG_ERROR, "mysql: Failed to lock the initial SQL command\n");
                         }
+                        dbgf(LOG_DEBUG, "Initial SQL executed\n");
                     }
-                    dbgf(LOG_DEBUG, "Initial SQL executed\n");
-                }
-                is_connecting = false;
-                authenticated = !result.error;
+                    co_return std::move(conn_result);
+                },
+                pool_options {
+                    .min_connections = 1,
+                    .max_connections = 8
+                },
+                ping
+            );
+            co_return std::move(co_await reconnect());
+        }
 
-                dbgf(LOG_DEBUG, "Reconnect - resolve %zu waiters\n", connecting.size());
-                while(!connecting.empty()) {
-                    auto c = connecting.front();
-                    connecting.pop();
-                    if(auto p = c.lock()) {
-                        aiopromise(p).resolve(std::make_tuple(result, connection));
-                    }
-                }
-                co_return std::make_tuple(result, connection);
-            }
+        aiopromise<pooled_connection> mysql::obtain_connection() {
+            if(!pool) co_return pooled_connection::with_error("not connected");
+            co_return std::move(co_await pool->checkout());
         }
 
         aiopromise<sql_connect> mysql::reconnect() {
-            auto [result, conn] = co_await obtain_connection();
-            co_return std::move(result);
+            auto conn = co_await obtain_connection();
+            if(!conn) co_return {true, conn.error_message};
+            co_return {false, ""};
+        }
+
+        aiopromise<bool> mysql::ping(ptr<iafd> connection) {
+            // COM_PING, server responds with OK packet
+            std::string command = encode_le24(1) + '\0' + '\x0e';
+            if(!co_await connection->write(std::move(command))) co_return false;
+            auto response = co_await read_packet(connection);
+            co_return response.seq >= 0 && response.data.length() > 0 && response.data[0] == '\0';
         }
 
-        aiopromise<sql_connect> mysql::handshake(ptr<iafd> connection) {
+        aiopromise<sql_connect> mysql::handshake(ptr<iafd> connection, present<std::string> user, present<std::string> password, present<std::string> db_name) {
             // read handshake packet with method & scramble
             dbgf(LOG_DEBUG, "Handshake - read first packet\n");
             auto result = co_await read_packet(connection);
@@ -203,7 +167,7 @@ namespace s90 {
                 std::string(method) + '\0';
             login = encode_le24(login.length()) + '\1' + login;
             dbgf(LOG_DEBUG, "Handshake - write login\n");
-            auto write_ok = co_await connection->write(login);
+            auto write_ok = co_await connection->write(std::move(login));
             if(!write_ok) {
                 dbgf(LOG_DEBUG, "Handshake - login failed\n");
                 co_return {true, "sending login failed"};
@@ -225,63 +189,51 @@ namespace s90 {
             }
         }
 
-        aiopromise<std::tuple<sql_result<sql_row>, ptr<iafd>>> mysql::raw_exec(present<std::string> query) {
-            dbgf(LOG_DEBUG, "> Request Execute SQL %s", query.c_str());
-            auto [connected, connection] = co_await obtain_connection();
-            if(connected.error) {
-                co_return std::make_tuple(sql_result<sql_row>::with_error(connected.error_message), connection);
-            }
+        aiopromise<sql_result<sql_row>> mysql::raw_exec(ptr<iafd> connection, present<std::string> query) {
             dbgf(LOG_DEBUG, "Execute SQL %s", query.c_str());
             auto command = encode_le24(query.length() + 1) + '\0' + '\3' + std::string(query);
-            auto write_ok = co_await connection->write(command);
+            auto write_ok = co_await connection->write(std::move(command));
             if(!write_ok) {
-                co_return std::make_tuple(sql_result<sql_row>::with_error("failed to write to the connection"), connection);
+                co_return sql_result<sql_row>::with_error("failed to write to the connection");
             }
-            co_return std::make_tuple(sql_result<sql_row>{false}, connection);
+            co_return sql_result<sql_row>{false};
         }
 
         aiopromise<sql_result<sql_row>> mysql::native_exec(present<std::string> query) {
-            auto lock_prom = command_lock.lock();
-            if(co_await lock_prom) {
-                dbgf(LOG_DEBUG, "Reading SQL result of %s", query.c_str());
-                auto result {co_await exec_subproc(query)};
-                if(!result) {
-                    dbgf(LOG_ERROR, "[mysql] Error on query %s:\n %s\n", query.c_str(), result.error_message.c_str());
-                }
-                command_lock.unlock();
-                co_return std::move(result);
-            } else {
-                co_return sql_result<sql_row>::with_error("lock failed");
+            auto connection = co_await obtain_connection();
+            if(!connection) co_return sql_result<sql_row>::with_error(connection.error_message);
+            dbgf(LOG_DEBUG, "Reading SQL result of %s", query.c_str());
+            auto result {co_await exec_subproc(connection, query)};
+            if(!result) {
+                dbgf(LOG_ERROR, "[mysql] Error on query %s:\n %s\n", query.c_str(), result.error_message.c_str());
             }
+            co_return std::move(result);
         }
 
         aiopromise<sql_result<sql_row>> mysql::native_select(present<std::string> query) {
-            auto lock_prom = command_lock.lock();
-            if(co_await lock_prom) {
-                dbgf(LOG_DEBUG, "Reading SQL result of %s", query.c_str());
-                auto result {co_await select_subproc(query)};
-                if(!result) {
-                    dbgf(LOG_ERROR, "[mysql] Error on query %s:\n %s\n", query.c_str(), result.error_message.c_str());
-                }
-                command_lock.unlock();
-                co_return std::move(result);
-            } else {
-                co_return sql_result<sql_row>::with_error("lock failed");
+            tracing::span trace("mysql::native_select", query);
+            auto connection = co_await obtain_connection();
+            if(!connection) co_return sql_result<sql_row>::with_error(connection.error_message);
+            dbgf(LOG_DEBUG, "Reading SQL result of %s", query.c_str());
+            auto result {co_await select_subproc(connection, query)};
+            if(!result) {
+                dbgf(LOG_ERROR, "[mysql] Error on query %s:\n %s\n", query.c_str(), result.error_message.c_str());
             }
+            co_return std::move(result);
         }
 
         aiopromise<sql_result<sql_row>> mysql::atomically(present<std::vector<std::string>> queries) {
-            auto lock_prom = command_lock.lock();
-            if(co_await lock_prom) {
+            // the whole transaction has to run on a single connection
+            auto connection = co_await obtain_connection();
+            if(connection) {
 
                 sql_result<sql_row> last_result;
                 int max_retries = 1;
 
                 for(int retry = 0; retry < max_retries; retry++) {
 
-                    auto start_tx = co_await exec_subproc("START TRANSACTION");
+                    auto start_tx = co_await exec_subproc(connection, "START TRANSACTION");
                     if(!start_tx) {
-                        command_lock.unlock();
                         co_return std::move(start_tx);
                     }
 
@@ -297,13 +249,12 @@ namespace s90 {
                         } else if(query == TX_ROLLBACK_IF_ZERO_AFFECTED || query == TX_ROLLBACK_IF_ZERO_SELECTED) {
                             if((query == TX_ROLLBACK_IF_ZERO_AFFECTED && last_result.affected_rows == 0) || (query == TX_ROLLBACK_IF_ZERO_SELECTED && last_result.size() == 0)) {
                                 last_result.flags = TX_ROLLEDBACK_ON_ZERO;
-                                auto rollback_tx = co_await exec_subproc("ROLLBACK");
+                                auto rollback_tx = co_await exec_subproc(connection, "ROLLBACK");
                                 if(!rollback_tx) {
                                     dbgf(LOG_ERROR, "[mysql] CRITICAL ERROR: ROLLBACK@0 FAILED FOR %s, ERR: %s\n", query.c_str(), rollback_tx.error_message.c_str());
-                                    command_lock.unlock();
+                                    connection.invalidate();
                                     co_return std::move(last_result);
                                 } else {
-                                    command_lock.unlock();
                                     co_return std::move(last_result);
                                 }
                             } else {
@@ -311,23 +262,22 @@ namespace s90 {
                             }
                         }
                         if(query.starts_with("SELECT ")) {
-                            last_result = co_await select_subproc(query);
+                            last_result = co_await select_subproc(connection, query);
                         } else {
-                            last_result = co_await exec_subproc(query);
+                            last_result = co_await exec_subproc(connection, query);
                         }
                         if(!last_result) {
                             dbgf(LOG_ERROR, "[mysql] Error on query %s (retry %d):\n %s\n", query.c_str(), retry, last_result.error_message.c_str());
-                            auto rollback_tx = co_await exec_subproc("ROLLBACK");
+                            auto rollback_tx = co_await exec_subproc(connection, "ROLLBACK");
                             if(!rollback_tx) {
                                 dbgf(LOG_ERROR, "[mysql] CRITICAL ERROR: ROLLBACK FAILED FOR %s, ERR: %s\n", query.c_str(), rollback_tx.error_message.c_str());
-                                command_lock.unlock();
+                                connection.invalidate();
                                 co_return std::move(last_result);
                             } else {
                                 if(last_result.error_message.contains("Deadlock") && retry == 0) {
                                     max_retries = 2;
                                     break;
                                 } else {
-                                    command_lock.unlock();
                                     co_return std::move(last_result);
                                 }
                             }
@@ -336,41 +286,52 @@ namespace s90 {
                 
                 }
 
-                auto commit_tx = co_await exec_subproc("COMMIT");
+                auto commit_tx = co_await exec_subproc(connection, "COMMIT");
                 if(!commit_tx) {
                     dbgf(LOG_ERROR, "[mysql] CRITICAL ERROR: COMMIT FAILED, ERR: %s\n", commit_tx.error_message.c_str());
-                    command_lock.unlock();
+                    connection.invalidate();
                     co_return std::move(last_result);
                 } else {
-                    command_lock.unlock();
                     co_return std::move(last_result);
                 }
             } else {
-                co_return sql_result<sql_row>::with_error("lock failed");
+                co_return sql_result<sql_row>::with_error(connection.error_message);
             }
         }
 
         void mysql::exec_on_first_connect(std::string_view str) {
-            enqueued_sql = str;
+            *enqueued_sql = str;
         }
 
-        aiopromise<sql_result<sql_row>> mysql::exec_subproc(present<std::string> query)
+        aiopromise<sql_result<sql_row>> mysql::exec_subproc(pooled_connection& connection, present<std::string> query)
         { 
-            auto [command_sent, connection] = co_await raw_exec(query);
-            if(command_sent.error) co_return std::move(command_sent);
-            auto response = co_await read_packet(connection);
-            if(response.seq < 0 || response.data.length() < 1) co_return sql_result<sql_row>::with_error("failed to read response");
+            // any failure other than an error reported by the server leaves the stream in an unknown
+            // state, such connection must not go back to the pool
+            auto command_sent = co_await raw_exec(*connection, query);
+            if(command_sent.error) {
+                connection.invalidate();
+                co_return std::move(command_sent);
+            }
+            auto response = co_await read_packet(*connection);
+            if(response.seq < 0 || response.data.length() < 1) {
+                connection.invalidate();
+                co_return sql_result<sql_row>::with_error("failed to read response");
+            }
             mysql_decoder decoder(response.data);
             co_return decoder.decode_status();
         };
         
-        aiopromise<sql_result<sql_row>> mysql::select_subproc(present<std::string> query)
+        aiopromise<sql_result<sql_row>> mysql::select_subproc(pooled_connection& connection, present<std::string> query)
         {
-            auto [command_sent, connection] = co_await raw_exec(query);
-            if(command_sent.error) co_return std::move(command_sent);
-            auto n_fields_desc = co_await read_packet(connection);
+            auto command_sent = co_await raw_exec(*connection, query);
+            if(command_sent.error) {
+                connection.invalidate();
+                co_return std::move(command_sent);
+            }
+            auto n_fields_desc = co_await read_packet(*connection);
 
             if(n_fields_desc.seq < 0 || n_fields_desc.data.length() < 1) {
+                connection.invalidate();
                 co_return sql_result<sql_row>::with_error("failed to read initial response");
             }
             
@@ -388,13 +349,17 @@ namespace s90 {
             mysql_decoder decoder(n_fields_desc.data);
             auto n_fields = decoder.lenint();
             if(n_fields == -1) {
+                connection.invalidate();
                 co_return sql_result<sql_row>::with_error("n fields has invalid value");
             }
 
             // read each field and decode it
             for(size_t i = 0; i < n_fields; i++) {
-                auto field_spec = co_await read_packet(connection);
-                if(field_spec.seq < 0) co_return sql_result<sql_row>::with_error("failed to fetch field spec");
+                auto field_spec = co_await read_packet(*connection);
+                if(field_spec.seq < 0) {
+                    connection.invalidate();
+                    co_return sql_result<sql_row>::with_error("failed to fetch field spec");
+                }
                 decoder.reset(field_spec.data);
                 auto field = decoder.decode_field();
                 fields.push_back(field);
@@ -402,8 +367,9 @@ namespace s90 {
             }
 
             // after fields, we expect EOF
-            auto eof = co_await read_packet(connection);
+            auto eof = co_await read_packet(*connection);
             if(eof.seq < 0 || eof.data.size() < 1 || eof.data[0] != '\xFE') {
+                connection.invalidate();
                 co_return sql_result<sql_row>::with_error("expected eof");
             }
 
@@ -411,8 +377,9 @@ namespace s90 {
             sql_result<sql_row> final_result;
             final_result.rows = ptr_new<std::vector<sql_row>>();
             while(true) {
-                auto row = co_await read_packet(connection);
+                auto row = co_await read_packet(*connection);
                 if(row.seq < 0 || row.data.size() < 1) {
+                    connection.invalidate();
                     co_return sql_result<sql_row>::with_error("fetching rows failed");
                 }
                 if(row.data[0] == '\xFE') break;
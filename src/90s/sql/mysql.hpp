@@ -30,25 +30,22 @@ namespace s90 {
             std::string user, password, host, db_name;
             int sql_port;
             bool cache_enabled = true;
-            bool authenticated = false;
-            bool is_connecting = false;
             bool login_provided = false;
             bool tx_locked = false;
-            std::string enqueued_sql = "";
-            util::aiolock command_lock;
+            // shared with the pool, so connections opened later on run it as well
+            ptr<std::string> enqueued_sql = ptr_new<std::string>();
             util::aiolock tx_lock;
-            ptr<iafd> connection_ref;
-            std::queue<aiopromise<std::tuple<sql_connect, ptr<iafd>>>::weak_type> connecting;
+            ptr<connection_pool> pool;
 
-            aiopromise<mysql_packet> read_packet(ptr<iafd> connection);
-            aiopromise<sql_connect> handshake(ptr<iafd> connection);
+            static aiopromise<mysql_packet> read_packet(ptr<iafd> connection);
+            static aiopromise<sql_connect> handshake(ptr<iafd> connection, present<std::string> user, present<std::string> password, present<std::string> db_name);
+            static aiopromise<bool> ping(ptr<iafd> connection);
 
-            aiopromise<std::tuple<sql_connect, ptr<iafd>>> obtain_connection();
-            aiopromise<std::tuple<sql_result<sql_row>, ptr<iafd>>> raw_exec(present<std::string>query);
+            aiopromise<pooled_connection> obtain_connection();
+            aiopromise<sql_result<sql_row>> raw_exec(ptr<iafd> connection, present<std::string> query);
         public:
             using isql::escape;
             mysql(context *ctx);
-            ~mysql();
             aiopromise<sql_connect> connect(present<std::string> hostname, int port, present<std::string> username, present<std::string> passphrase, present<std::string>database) override;
             aiopromise<sql_connect> reconnect() override;
             bool is_connected() const override;
@@ -64,8 +61,8 @@ namespace s90 {
             aiopromise<sql_result<sql_row>> exec_subproc(ptr<iafd> connection);
             aiopromise<sql_result<sql_row>> select_subproc(ptr<iafd> connection);
         #else
-            aiopromise<sql_result<sql_row>> exec_subproc(present<std::string> query);
-            aiopromise<sql_result<sql_row>> select_subproc(present<std::string> query);
+            aiopromise<sql_result<sql_row>> exec_subproc(pooled_connection& connection, present<std::string> query);
+            aiopromise<sql_result<sql_row>> select_subproc(pooled_connection& connection, present<std::string> query);
         #endif
         };
     }
@@ -111,7 +111,7 @@ namespace s90::storage {
             return file_reference {
                 .path = full_path
             };
-        });
+        }, task_priority::disk);
     }
 
     aiopromise<std::expected<std::string, std::string>> disk_storage::load(present<std::string> path, uint8_t flags) {
@@ -126,7 +126,8 @@ namespace s90::storage {
             cache_misses++;
             mtx.unlock();
         }
-        co_return co_await global_context->exec_async<std::expected<std::string, std::string>>(
+        // named rather than a temporary of co_await, see icontext::exec_async
+        std::move_only_function<std::expected<std::string, std::string>()> load =
             [path, this]() -> std::expected<std::string, std::string> {
                 std::string full_path = std::format("{}/{}", config.root, path);
                 std::ifstream ifs(full_path, std::ios::binary);
@@ -142,7 +143,8 @@ namespace s90::storage {
                 } catch(std::exception& ex) {
                     return std::unexpected(errors::INVALID_ENTITY);
                 }
-            });
+            };
+        co_return co_await global_context->exec_async<std::expected<std::string, std::string>>(std::move(load), task_priority::disk);
     }
 
     aiopromise<std::expected<size_t, std::string>> disk_storage::remove(present<std::string> path) {
@@ -170,7 +172,7 @@ namespace s90::storage {
                     return std::unexpected(errors::DISK_DELETE_ERROR);
                 }
             }
-        });
+        }, task_priority::disk);
     }
 
     std::expected<file_reference, std::string> disk_storage::get_reference(present<std::string> path, present<requester_info> details) {
@@ -0,0 +1,115 @@
+#include "task_pool.hpp"
+#include <80s/80s.h>
+#include <algorithm>
+
+namespace s90 {
+
+    // index of the pool thread running on this thread, tasks submitted from within
+    // a task go to the submitter's own queue
+    static thread_local size_t current_queue = (size_t)-1;
+
+    task_pool& task_pool::instance() {
+        // intentionally never destroyed, detached threads keep using it until the process exits
+        static task_pool *pool = new task_pool(std::max(4u, std::thread::hardware_concurrency()));
+        return *pool;
+    }
+
+    task_pool::task_pool(size_t threads) {
+        for(size_t i = 0; i < threads; i++) {
+            queues.emplace_back(std::make_unique<worker_queue>());
+        }
+        for(size_t i = 0; i < threads; i++) {
+            std::thread([this](size_t index) { run(index); }, i).detach();
+        }
+    }
+
+    size_t task_pool::size() const {
+        return queues.size();
+    }
+
+    void task_pool::submit(task_priority priority, task fn) {
+        size_t index = current_queue < queues.size() ? current_queue : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        size_t level = (size_t)priority;
+        {
+            std::lock_guard lock(queues[index]->mtx);
+            queues[index]->jobs[level].emplace_back(job { std::move(fn), std::chrono::steady_clock::now() });
+        }
+        metrics[level].queued.fetch_add(1, std::memory_order_relaxed);
+        pending.fetch_add(1);
+        {
+            // makes sure a thread that just found the queues empty is already waiting
+            std::lock_guard lock(sleep_mtx);
+        }
+        sleep_cv.notify_one();
+    }
+
+    bool task_pool::take(size_t index, job& out, size_t& priority) {
+        for(size_t level = 0; level < task_priorities; level++) {
+            for(size_t i = 0; i < queues.size(); i++) {
+                size_t victim = (index + i) % queues.size();
+                auto& queue = *queues[victim];
+                std::lock_guard lock(queue.mtx);
+                auto& jobs = queue.jobs[level];
+                if(jobs.empty()) continue;
+                if(victim == index) {
+                    out = std::move(jobs.front());
+                    jobs.pop_front();
+                } else {
+                    // steal from the back, the owner keeps working from the front
+                    out = std::move(jobs.back());
+                    jobs.pop_back();
+                    stolen.fetch_add(1, std::memory_order_relaxed);
+                }
+                priority = level;
+                metrics[level].queued.fetch_sub(1, std::memory_order_relaxed);
+                pending.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void task_pool::run(size_t index) {
+        current_queue = index;
+        for(;;) {
+            job current;
+            size_t level = 0;
+            if(!take(index, current, level)) {
+                std::unique_lock lock(sleep_mtx);
+                sleep_cv.wait(lock, [this] { return pending.load() > 0; });
+                continue;
+            }
+            auto started = std::chrono::steady_clock::now();
+            try {
+                current.fn();
+            } catch(std::exception& ex) {
+                dbgf(LOG_ERROR, "[task_pool] task failed with exception: %s\n", ex.what());
+            } catch(...) {
+                dbgf(LOG_ERROR, "[task_pool] task failed with unknown exception\n");
+            }
+            auto finished = std::chrono::steady_clock::now();
+            auto& m = metrics[level];
+            m.completed.fetch_add(1, std::memory_order_relaxed);
+            m.wait_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(started - current.queued_at).count(), std::memory_order_relaxed);
+            m.run_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started).count(), std::memory_order_relaxed);
+        }
+    }
+
+    task_pool_stats task_pool::stats() const {
+        task_pool_stats result;
+        result.threads = queues.size();
+        result.stolen = stolen.load(std::memory_order_relaxed);
+        for(size_t level = 0; level < task_priorities; level++) {
+            auto& m = metrics[level];
+            size_t completed = m.completed.load(std::memory_order_relaxed);
+            result.queued[level] = m.queued.load(std::memory_order_relaxed);
+            result.completed[level] = completed;
+            if(completed > 0) {
+                result.avg_wait_us[level] = m.wait_ns.load(std::memory_order_relaxed) / 1000.0 / completed;
+                result.avg_run_us[level] = m.run_ns.load(std::memory_order_relaxed) / 1000.0 / completed;
+            }
+        }
+        return result;
+    }
+
+}
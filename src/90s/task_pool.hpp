@@ -0,0 +1,94 @@
+#pragma once
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+namespace s90 {
+
+    /// @brief Task priority, lower value is picked up first
+    enum class task_priority {
+        dns = 0,
+        disk = 1,
+        cpu = 2
+    };
+
+    constexpr size_t task_priorities = 3;
+
+    struct task_pool_stats {
+        /// @brief number of pool threads
+        size_t threads = 0;
+        /// @brief tasks currently waiting in the queues
+        size_t queued[task_priorities] = {};
+        /// @brief tasks executed so far
+        size_t completed[task_priorities] = {};
+        /// @brief tasks executed by a different thread than the one they were queued to
+        size_t stolen = 0;
+        /// @brief average time between submission and start of execution in microseconds
+        double avg_wait_us[task_priorities] = {};
+        /// @brief average execution time in microseconds
+        double avg_run_us[task_priorities] = {};
+    };
+
+    /// @brief Process-wide pool of threads for blocking work (DNS, disk, CPU heavy code) shared by
+    /// all workers. Every pool thread has its own queue, tasks are distributed round-robin and idle
+    /// threads steal from the others, always preferring higher priority work. Tasks carry everything
+    /// needed to deliver their result, so the pool itself doesn't care which worker submitted them
+    class task_pool {
+    public:
+        using task = std::move_only_function<void()>;
+
+        /// @brief Get the pool, it is started on first use and lives until the process exits
+        /// @return pool
+        static task_pool& instance();
+
+        /// @brief Queue a task
+        /// @param priority task priority
+        /// @param fn task
+        void submit(task_priority priority, task fn);
+
+        /// @brief Get pool metrics
+        /// @return metrics
+        task_pool_stats stats() const;
+
+        /// @brief Get number of pool threads
+        /// @return number of threads
+        size_t size() const;
+
+    private:
+        struct job {
+            task fn;
+            std::chrono::steady_clock::time_point queued_at;
+        };
+
+        struct worker_queue {
+            std::mutex mtx;
+            std::deque<job> jobs[task_priorities];
+        };
+
+        struct counters {
+            std::atomic<size_t> queued = 0;
+            std::atomic<size_t> completed = 0;
+            std::atomic<uint64_t> wait_ns = 0;
+            std::atomic<uint64_t> run_ns = 0;
+        };
+
+        explicit task_pool(size_t threads);
+        void run(size_t index);
+        bool take(size_t index, job& out, size_t& priority);
+
+        std::vector<std::unique_ptr<worker_queue>> queues;
+        counters metrics[task_priorities];
+        std::atomic<size_t> pending = 0;
+        std::atomic<size_t> next_queue = 0;
+        std::atomic<size_t> stolen = 0;
+        std::mutex sleep_mtx;
+        std::condition_variable sleep_cv;
+    };
+
+}
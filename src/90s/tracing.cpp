@@ -0,0 +1,69 @@
+#include "tracing.hpp"
+#include <cstdio>
+
+namespace s90 {
+    namespace tracing {
+
+        static void json_string(std::string& out, std::string_view data) {
+            out += '"';
+            for(char c : data) {
+                switch(c) {
+                    case '"': out += "\\\""; break;
+                    case '\\': out += "\\\\"; break;
+                    case '\n': out += "\\n"; break;
+                    case '\r': out += "\\r"; break;
+                    case '\t': out += "\\t"; break;
+                    default:
+                        if(c >= 0 && c < 32) {
+                            char buf[8];
+                            snprintf(buf, sizeof(buf), "\\u%04x", c);
+                            out += buf;
+                        } else {
+                            out += c;
+                        }
+                }
+            }
+            out += '"';
+        }
+
+        bool recorder::export_chrome(const std::string& path, int worker_id) const {
+            std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+            bool first = true;
+            for(size_t i = 0; i < ring.size(); i++) {
+                auto& span = ring[(head + i) % ring.size()];
+                if(!first) out += ',';
+                first = false;
+                out += "\n{\"ph\":\"X\",\"cat\":\"90s\",\"name\":";
+                json_string(out, span.name);
+                out += ",\"pid\":"; out += std::to_string(worker_id);
+                out += ",\"tid\":"; out += std::to_string(span.trace);
+                out += ",\"ts\":"; out += std::to_string(span.start);
+                out += ",\"dur\":"; out += std::to_string(span.end - span.start);
+                out += ",\"args\":{\"span\":"; out += std::to_string(span.span);
+                out += ",\"parent\":"; out += std::to_string(span.parent);
+                if(!span.detail.empty()) {
+                    out += ",\"detail\":";
+                    json_string(out, span.detail);
+                }
+                out += "}}";
+            }
+            out += "\n]}\n";
+
+            // write aside and rename, so readers never see a half written file
+            std::string temp = path + ".tmp";
+            FILE *f = fopen(temp.c_str(), "wb");
+            if(!f) return false;
+            bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+            ok = fclose(f) == 0 && ok;
+            if(!ok) {
+                remove(temp.c_str());
+                return false;
+            }
+#ifdef _WIN32
+            remove(path.c_str());
+#endif
+            return rename(temp.c_str(), path.c_str()) == 0;
+        }
+
+    }
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace s90 {
+    namespace tracing {
+
+        /// @brief Identifies the span code currently runs in, trace is the id of the root span
+        struct span_context {
+            uint64_t trace = 0;
+            uint64_t span = 0;
+        };
+
+        struct span_record {
+            uint64_t trace = 0;
+            uint64_t span = 0;
+            uint64_t parent = 0;
+            const char *name = nullptr;
+            std::string detail;
+            int64_t start = 0;
+            int64_t end = 0;
+        };
+
+        /// @brief Switch shared by all workers, when off, spans cost a single branch and nothing is recorded
+        inline std::atomic<bool> active = false;
+
+        inline bool enabled() {
+            return active.load(std::memory_order_relaxed);
+        }
+
+        inline void enable(bool on = true) {
+            active.store(on, std::memory_order_relaxed);
+        }
+
+        /// @brief Get span the current worker runs in, aiopromise keeps it across suspensions
+        /// @return current context
+        inline span_context& current() {
+            static thread_local span_context ctx;
+            return ctx;
+        }
+
+        /// @brief Microseconds on a monotonic clock
+        inline int64_t now() {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /// @brief Per-worker ring buffer of finished spans, once full the oldest spans get overwritten
+        class recorder {
+        public:
+            static constexpr size_t capacity = 16384;
+            static constexpr size_t max_detail_length = 256;
+
+            uint64_t next_id() {
+                return ++ids;
+            }
+
+            void record(span_record&& span) {
+                if(ring.size() < capacity) {
+                    ring.emplace_back(std::move(span));
+                } else {
+                    ring[head] = std::move(span);
+                    head = (head + 1) % capacity;
+                }
+                recorded++;
+            }
+
+            /// @brief Number of spans recorded since the worker started, including the overwritten ones
+            size_t total() const {
+                return recorded;
+            }
+
+            /// @brief Write the spans into a file in Chrome trace event format, viewable in chrome://tracing
+            /// or Perfetto, every request gets its own track
+            /// @param path output file, it is replaced atomically
+            /// @param worker_id worker the spans belong to, used as the process id
+            /// @return true on success
+            bool export_chrome(const std::string& path, int worker_id) const;
+
+            /// @brief Get recorder of the current worker
+            /// @return recorder
+            static recorder& local() {
+                static thread_local recorder rec;
+                return rec;
+            }
+
+        private:
+            std::vector<span_record> ring;
+            size_t head = 0;
+            size_t recorded = 0;
+            uint64_t ids = 0;
+        };
+
+        /// @brief Timed section of work. While alive it is the current span, so spans started from within
+        /// become its children, the one started with nothing current starts a new trace. Inside coroutines
+        /// it follows the coroutine across co_await, see aiopromise
+        class span {
+            span_context self;
+            span_context previous;
+            const char *name = nullptr;
+            std::string detail;
+            int64_t start = 0;
+            bool attached = false;
+
+            void begin(const char *span_name, std::string_view span_detail, bool attach) {
+                auto& rec = recorder::local();
+                auto& ctx = current();
+                previous = ctx;
+                self.span = rec.next_id();
+                self.trace = previous.trace ? previous.trace : self.span;
+                name = span_name;
+                detail = span_detail.substr(0, recorder::max_detail_length);
+                attached = attach;
+                if(attach) ctx = self;
+                start = now();
+            }
+
+        public:
+            span() {}
+
+            /// @brief Start a span and make it current
+            /// @param span_name name, must be a string literal
+            /// @param span_detail additional information, i.e. SQL query
+            explicit span(const char *span_name, std::string_view span_detail = {}) {
+                if(enabled()) [[unlikely]] begin(span_name, span_detail, true);
+            }
+
+            span(const span&) = delete;
+            span& operator=(const span&) = delete;
+
+            span(span&& other) noexcept
+                : self(other.self), previous(other.previous), name(other.name), detail(std::move(other.detail)),
+                  start(other.start), attached(other.attached) {
+                other.name = nullptr;
+            }
+
+            span& operator=(span&& other) noexcept {
+                if(this != &other) {
+                    end();
+                    self = other.self;
+                    previous = other.previous;
+                    name = other.name;
+                    detail = std::move(other.detail);
+                    start = other.start;
+                    attached = other.attached;
+                    other.name = nullptr;
+                }
+                return *this;
+            }
+
+            ~span() {
+                end();
+            }
+
+            /// @brief Start a span that doesn't become current, for work that outlives the scope starting it
+            /// @param span_name name, must be a string literal
+            /// @param span_detail additional information
+            /// @return span, it ends once destroyed or when end() is called
+            static span detached(const char *span_name, std::string_view span_detail = {}) {
+                span result;
+                if(enabled()) [[unlikely]] result.begin(span_name, span_detail, false);
+                return result;
+            }
+
+            /// @brief Stop being the current span while the span keeps running, i.e. when handing it over
+            /// to work that continues elsewhere
+            void detach() {
+                if(!name || !attached) return;
+                auto& ctx = current();
+                if(ctx.span == self.span) ctx = previous;
+                attached = false;
+            }
+
+            /// @brief Finish the span early
+            void end() {
+                if(!name) [[likely]] return;
+                auto& ctx = current();
+                if(attached && ctx.span == self.span) ctx = previous;
+                recorder::local().record(span_record {
+                    .trace = self.trace,
+                    .span = self.span,
+                    .parent = previous.span,
+                    .name = name,
+                    .detail = std::move(detail),
+                    .start = start,
+                    .end = now()
+                });
+                name = nullptr;
+            }
+        };
+    }
+}
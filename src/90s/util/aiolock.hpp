@@ -5,14 +5,18 @@
 namespace s90 {
     namespace util {
         class aiolock {
-            std::queue<aiopromise<bool>::weak_type> waiters;
+            struct waiting {
+                aiopromise<bool>::weak_type promise;
+                tracing::span wait;
+            };
+            std::queue<waiting> waiters;
             int sem = 1;
         public:
             ~aiolock() {
                 while(waiters.size() > 0) {
-                    auto w = waiters.front();
+                    auto w = std::move(waiters.front());
                     waiters.pop();
-                    if(auto p = w.lock())
+                    if(auto p = w.promise.lock())
                         aiopromise(p).resolve(false);
                 }
             }
@@ -28,27 +32,39 @@ namespace s90 {
                     result.resolve(true);
                 } else if(sem == 1) {
                     sem = 0;
-                    auto first = waiters.front();
-                    waiters.pop();
-                    waiters.push(result.weak());
-                    if(auto p = first.lock())
-                        aiopromise(p).resolve(true);
+                    enqueue(result);
+                    if(!handoff()) sem = 1;
                 } else {
-                    waiters.push(result.weak());
+                    enqueue(result);
                 }
                 return result;
             }
 
             void unlock() {
-                if(waiters.size() > 0) {
-                    sem = 0;
-                    auto first = waiters.front();
+                sem = 0;
+                if(!handoff()) sem = 1;
+            }
+
+        private:
+            void enqueue(aiopromise<bool>& waiter) {
+                // cancelled waiter fails with false and is skipped once its turn comes
+                waiter.on_cancel(false);
+                waiters.push({ waiter.weak(), tracing::span::detached("aiolock::wait") });
+            }
+
+            bool handoff() {
+                // pass the lock to the first waiter that still waits, dropped or cancelled
+                // waiters must not take the lock with them
+                while(waiters.size() > 0) {
+                    auto first = std::move(waiters.front());
                     waiters.pop();
-                    if(auto p = first.lock())
+                    first.wait.end();
+                    if(auto p = first.promise.lock(); p && !p->settled) {
                         aiopromise(p).resolve(true);
-                } else {
-                    sem = 1;
+                        return true;
+                    }
                 }
+                return false;
             }
         };
     }
@@ -1,7 +1,7 @@
 #include "util.hpp"
 #include <array>
 #include <80s/crypto.h>
-#include <zlib.h>
+#include <80s/dynstr.h>
 
 namespace s90 {
     namespace util {
@@ -171,90 +171,76 @@ namespace s90 {
             return qs;
         }
 
-        // Compress the input data in-memory
-        int compress(std::string& inout) {
-            // Initialize zlib stream
-            z_stream stream;
-            stream.zalloc = Z_NULL;
-            stream.zfree = Z_NULL;
-            stream.opaque = Z_NULL;
-            stream.avail_in = static_cast<uInt>(inout.size());
-            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(inout.data()));
-
-            // Initialize output buffer
-            std::vector<Bytef> compressedBuffer(inout.size() + 4096); // Adjust buffer size as needed
-
-            stream.avail_out = static_cast<uInt>(compressedBuffer.size());
-            stream.next_out = compressedBuffer.data();
-            
-            // Initialize compression with gzip format
-            int windowBits = 15; // Default windowBits for zlib
-            int GZIP_ENCODING = 16; // Add 16 for gzip format
-            if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, windowBits | GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
-                return -1;
+        deflate_stream::deflate_stream(bool compress, compression_format format, int level, size_t max_output) {
+            const char *err = nullptr;
+            if(zstream_new(compress ? ZSTREAM_DEFLATE : ZSTREAM_INFLATE, (int)format, level, max_output, &stream, &err) < 0) {
+                stream = nullptr;
+                error_message = err ? err : "failed to create stream";
             }
-
-            // Perform compression
-            if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
-                deflateEnd(&stream);
-                return -1;
-            }
-
-            // Finalize compression
-            deflateEnd(&stream);
-
-            // Update inout with compressed data
-            inout.assign(reinterpret_cast<char*>(compressedBuffer.data()), stream.total_out);
-            return 0;
         }
 
-        // Decompress the data in-memory
-        int decompress(std::string& inout) {
-            // Initialize zlib stream
-            z_stream stream;
-            stream.zalloc = Z_NULL;
-            stream.zfree = Z_NULL;
-            stream.opaque = Z_NULL;
-            stream.avail_in = static_cast<uInt>(inout.size());
-            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(inout.data()));
+        deflate_stream::deflate_stream(deflate_stream&& other) noexcept : stream(other.stream), error_message(std::move(other.error_message)) {
+            other.stream = nullptr;
+        }
 
-            // Initialize output buffer
-            std::vector<Bytef> decompressedBuffer(inout.size() * 2 + 4096); // Initial size, adjust as needed
+        deflate_stream& deflate_stream::operator=(deflate_stream&& other) noexcept {
+            if(this != &other) {
+                if(stream) zstream_release(stream);
+                stream = other.stream;
+                error_message = std::move(other.error_message);
+                other.stream = nullptr;
+            }
+            return *this;
+        }
 
-            stream.avail_out = static_cast<uInt>(decompressedBuffer.size());
-            stream.next_out = decompressedBuffer.data();
+        deflate_stream::~deflate_stream() {
+            if(stream) zstream_release(stream);
+        }
 
-            // Initialize decompression with gzip format
-            int windowBits = 15; // Default windowBits for zlib
-            int GZIP_ENCODING = 16; // Add 16 for gzip format
-            if (inflateInit2(&stream, windowBits | GZIP_ENCODING) != Z_OK) {
-                return -1;
+        std::expected<bool, std::string> deflate_stream::update(std::string_view data, std::string& output, flush_mode mode) {
+            if(!stream) return std::unexpected(error_message);
+            char buffer[16384];
+            const char *err = nullptr;
+            dynstr str;
+            dynstr_init(&str, buffer, sizeof(buffer));
+            int status = zstream_update(stream, data.data(), data.length(), (int)mode, &str, &err);
+            if(status >= 0) {
+                output.append(str.ptr, str.length);
             }
+            dynstr_release(&str);
+            if(status < 0) return std::unexpected(err ? err : "stream error");
+            return status > 0;
+        }
 
-            // Perform decompression
-            while (true) {
-                int result = inflate(&stream, Z_NO_FLUSH);
-                if (result == Z_STREAM_END) {
-                    break; // Decompression complete
-                } else if (result != Z_OK) {
-                    inflateEnd(&stream);
-                    return -1;
-                }
+        std::expected<std::string, std::string> deflate_stream::update(std::string_view data, flush_mode mode) {
+            std::string output;
+            auto result = update(data, output, mode);
+            if(!result) return std::unexpected(result.error());
+            return output;
+        }
 
-                // Check if the buffer is full
-                if (stream.avail_out == 0) {
-                    // Resize the buffer
-                    decompressedBuffer.resize(decompressedBuffer.size() + 4096);
-                    stream.avail_out = static_cast<uInt>(decompressedBuffer.size()) - stream.total_out;
-                    stream.next_out = decompressedBuffer.data() + stream.total_out;
-                }
-            }
+        bool deflate_stream::reset() {
+            return stream && zstream_reset(stream) == 0;
+        }
+
+        bool deflate_stream::finished() const {
+            return stream && zstream_is_finished(stream);
+        }
 
-            // Finalize decompression
-            inflateEnd(&stream);
+        // Compress the input data in-memory
+        int compress(std::string& inout, int level) {
+            deflate_stream stream(true, compression_format::gzip, level);
+            auto result = stream.update(inout, flush_mode::finish);
+            if(!result) return -1;
+            inout = std::move(*result);
+            return 0;
+        }
 
-            // Update inout with decompressed data
-            inout.assign(reinterpret_cast<char*>(decompressedBuffer.data()), stream.total_out);
+        int decompress(std::string& inout, size_t max_output) {
+            deflate_stream stream(false, compression_format::gzip, -1, max_output);
+            auto result = stream.update(inout, flush_mode::finish);
+            if(!result) return -1;
+            inout = std::move(*result);
             return 0;
         }
     }
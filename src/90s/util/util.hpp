@@ -1,6 +1,7 @@
 #pragma once
 #include "../shared.hpp"
 #include "../aiopromise.hpp"
+#include <80s/zstream.h>
 #include <string>
 #include <string_view>
 #include <sstream>
@@ -76,8 +77,69 @@ namespace s90 {
             }
         }
 
-        int compress(std::string& data);
-        int decompress(std::string& data);
+        enum class compression_format {
+            gzip = 0,
+            zlib = 1,
+            raw = 2
+        };
+
+        enum class flush_mode {
+            none = 0,
+            sync = 1,
+            finish = 2
+        };
+
+        /// @brief Streaming compressor/decompressor, zlib state is reused within the worker
+        class deflate_stream {
+            zstream *stream = nullptr;
+            std::string error_message;
+        public:
+            /// @brief Create a new stream
+            /// @param compress true to compress, false to decompress
+            /// @param format stream format
+            /// @param level compression level (-1 to 9), ignored for decompression
+            /// @param max_output maximum number of bytes the stream is allowed to produce, 0 if unlimited
+            deflate_stream(bool compress, compression_format format = compression_format::gzip, int level = 6, size_t max_output = 0);
+            deflate_stream(const deflate_stream&) = delete;
+            deflate_stream& operator=(const deflate_stream&) = delete;
+            deflate_stream(deflate_stream&& other) noexcept;
+            deflate_stream& operator=(deflate_stream&& other) noexcept;
+            ~deflate_stream();
+
+            /// @brief Feed more data to the stream
+            /// @param data input data
+            /// @param output output buffer to append the result to
+            /// @param mode flush mode, finish to terminate the stream
+            /// @return true if end of stream was reached, error otherwise
+            std::expected<bool, std::string> update(std::string_view data, std::string& output, flush_mode mode = flush_mode::none);
+
+            /// @brief Feed more data to the stream
+            /// @param data input data
+            /// @param mode flush mode, finish to terminate the stream
+            /// @return produced output or error
+            std::expected<std::string, std::string> update(std::string_view data, flush_mode mode = flush_mode::none);
+
+            /// @brief Reset the stream, so it can be used for new data
+            /// @return true on success
+            bool reset();
+
+            /// @brief Determine if end of stream was reached
+            /// @return true if finished
+            bool finished() const;
+
+            explicit operator bool() const {
+                return stream != nullptr;
+            }
+
+            /// @brief Get the error that occured during initialization
+            /// @return error message
+            const std::string& error() const {
+                return error_message;
+            }
+        };
+
+        int compress(std::string& data, int level = 9);
+        int decompress(std::string& data, size_t max_output = 0);
 
         class call_on_destroy {
             std::function<void()> cb;